@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ofMain.h"
+#include <random>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace benchmark
+{
+	// runs fn until at least minSeconds have passed and returns the seconds per call
+	template<typename F>
+	double measure(F fn, double minSeconds = 0.5)
+	{
+		typedef std::chrono::steady_clock Clock;
+		// one untimed call to warm caches and lazy initialisation
+		fn();
+		size_t iterations = 0;
+		auto start = Clock::now();
+		double elapsed = 0;
+		do
+		{
+			fn();
+			iterations++;
+			elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		} while (elapsed < minSeconds);
+		return elapsed / iterations;
+	}
+
+	// keeps the optimiser from dropping work whose result is unused: the barrier tells the
+	// compiler the value's memory may be read, so it has to be computed
+	template<typename T>
+	inline void doNotOptimize(const T& value)
+	{
+#ifdef _MSC_VER
+		// the pointer itself is volatile, so storing the address is never dropped;
+		// msvc has no inline asm on x64
+		static const void* volatile sink;
+		sink = &value;
+		_ReadWriteBarrier();
+#else
+		asm volatile("" : : "g"(&value) : "memory");
+#endif
+	}
+
+	// one measurement, written out by Report::write for comparing runs
+	struct Result
+	{
+		std::string suite;
+		// the input, e.g. "65536" or "3840x2160"
+		std::string input;
+		// the implementation measured, e.g. "simd"
+		std::string variant;
+		double seconds = 0;
+		// processed per call, 0 when a rate makes no sense
+		double bytes = 0;
+	};
+
+	class Report
+	{
+	public:
+		void add(const std::string& suite, const std::string& input, const std::string& variant, double seconds, double bytes = 0)
+		{
+			mResults.push_back({ suite, input, variant, seconds, bytes });
+		}
+
+		// {"label":..,"results":[{"suite":..,"input":..,"variant":..,"seconds":..,"bytesPerSecond":..}]}
+		bool write(const std::string& path, const std::string& label) const
+		{
+			ofJson results = ofJson::array();
+			for (auto& result : mResults)
+			{
+				ofJson json;
+				json["suite"] = result.suite;
+				json["input"] = result.input;
+				json["variant"] = result.variant;
+				json["seconds"] = result.seconds;
+				if (result.bytes > 0)
+					json["bytesPerSecond"] = result.bytes / result.seconds;
+				results.push_back(json);
+			}
+			ofJson report;
+			report["label"] = label;
+			report["results"] = results;
+			std::ofstream out(path);
+			out << report.dump(1) << "\n";
+			return out.good();
+		}
+
+	private:
+		std::vector<Result> mResults;
+	};
+
+	inline std::string randomBytes(size_t size, unsigned seed = 1)
+	{
+		std::mt19937 rng(seed);
+		std::string bytes(size, 0);
+		for (auto& c : bytes)
+			c = (char)(rng() & 0xff);
+		return bytes;
+	}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "ofMain.h"
+
+// what CloudVision::threadedFunction did with a response before the streaming parser:
+// ofJson::parse the whole body, then copy every field into owning strings and vectors
+namespace legacy
+{
+	struct latLng
+	{
+		double latitude;
+		double longitude;
+	};
+
+	struct Landmark
+	{
+		std::string type;
+		ofVec3f position;
+	};
+
+	struct BoundingPoly
+	{
+		std::vector<ofVec2f> vertices;
+	};
+
+	struct LabelAnnotation
+	{
+		std::string mid;
+		std::string description;
+		float score;
+	};
+
+	struct TextAnnotation
+	{
+		std::string locale;
+		std::string description;
+		BoundingPoly boundingPoly;
+	};
+
+	struct FaceAnnotation
+	{
+		BoundingPoly boundingPoly;
+		BoundingPoly fdBoundingPoly;
+		std::vector<Landmark> landmarks;
+		float rollAngle;
+		float panAngle;
+		float tiltAngle;
+		float detectionConfidence;
+		float landmarkingConfidence;
+		std::string joyLikelihood;
+		std::string sorrowLikelihood;
+		std::string angerLikelihood;
+		std::string surpriseLikelihood;
+		std::string underExposedLikelihood;
+		std::string blurredLikelihood;
+		std::string headwearLikelihood;
+	};
+
+	struct Response
+	{
+		std::vector<LabelAnnotation> labelAnnotations;
+		std::vector<TextAnnotation> textAnnotations;
+		std::vector<FaceAnnotation> faceAnnotations;
+	};
+
+	inline void getVertices(const ofJson& json, std::vector<ofVec2f>& container)
+	{
+		for (auto& vt : json["vertices"])
+		{
+			float x = vt.value("x", 0.0f);
+			float y = vt.value("y", 0.0f);
+			container.emplace_back(x, y);
+		}
+	}
+
+	inline void getLandmarks(const ofJson& json, std::vector<Landmark>& container)
+	{
+		for (auto& landmark : json["landmarks"])
+		{
+			Landmark lm;
+			lm.type = landmark.value("type", "");
+			float x = landmark["position"].value("x", 0.0f);
+			float y = landmark["position"].value("y", 0.0f);
+			float z = landmark["position"].value("z", 0.0f);
+			lm.position.set(x, y, z);
+			container.emplace_back(lm);
+		}
+	}
+
+	inline ofJson parse(const std::string& body)
+	{
+		return ofJson::parse(body);
+	}
+
+	// the extraction lambdas, without the parse
+	inline std::vector<Response> extract(ofJson& document)
+	{
+		std::vector<Response> responses;
+		for (auto& jsonResponse : document["responses"])
+		{
+			Response res;
+			for (auto& jsonLabel : jsonResponse["labelAnnotations"])
+			{
+				LabelAnnotation label;
+				label.mid = jsonLabel.value("mid", "");
+				label.description = jsonLabel.value("description", "");
+				label.score = jsonLabel.value("score", 0.0f);
+				res.labelAnnotations.emplace_back(label);
+			}
+			for (auto& jsonText : jsonResponse["textAnnotations"])
+			{
+				TextAnnotation text;
+				text.locale = jsonText.value("locale", "");
+				text.description = jsonText.value("description", "");
+				getVertices(jsonText["boundingPoly"], text.boundingPoly.vertices);
+				res.textAnnotations.emplace_back(text);
+			}
+			for (auto& jsonFace : jsonResponse["faceAnnotations"])
+			{
+				FaceAnnotation face;
+				getVertices(jsonFace["boundingPoly"], face.boundingPoly.vertices);
+				getVertices(jsonFace["fdBoundingPoly"], face.fdBoundingPoly.vertices);
+				getLandmarks(jsonFace, face.landmarks);
+				face.rollAngle = jsonFace.value("rollAngle", 0.0f);
+				face.panAngle = jsonFace.value("panAngle", 0.0f);
+				face.tiltAngle = jsonFace.value("tiltAngle", 0.0f);
+				face.detectionConfidence = jsonFace.value("detectionConfidence", 0.0f);
+				face.landmarkingConfidence = jsonFace.value("landmarkingConfidence", 0.0f);
+				face.joyLikelihood = jsonFace.value("joyLikelihood", "");
+				face.sorrowLikelihood = jsonFace.value("sorrowLikelihood", "");
+				face.angerLikelihood = jsonFace.value("angerLikelihood", "");
+				face.surpriseLikelihood = jsonFace.value("surpriseLikelihood", "");
+				face.underExposedLikelihood = jsonFace.value("underExposedLikelihood", "");
+				face.blurredLikelihood = jsonFace.value("blurredLikelihood", "");
+				face.headwearLikelihood = jsonFace.value("headwearLikelihood", "");
+				res.faceAnnotations.emplace_back(face);
+			}
+			responses.emplace_back(std::move(res));
+		}
+		return responses;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ofMain.h"
+#include <random>
+
+namespace benchmark
+{
+	// images:annotate answers shaped like the service's, sized by the number of annotations
+
+	inline std::string makeVertices(std::mt19937& rng)
+	{
+		int x = rng() % 3000, y = rng() % 2000, w = 20 + rng() % 200, h = 20 + rng() % 200;
+		return "{\"vertices\":[{\"x\":" + ofToString(x) + ",\"y\":" + ofToString(y) + "},{\"x\":" + ofToString(x + w)
+			+ ",\"y\":" + ofToString(y) + "},{\"x\":" + ofToString(x + w) + ",\"y\":" + ofToString(y + h)
+			+ "},{\"x\":" + ofToString(x) + ",\"y\":" + ofToString(y + h) + "}]}";
+	}
+
+	inline std::string makeFaceResponse(size_t faces, unsigned seed = 1)
+	{
+		static const char* LANDMARKS[] = { "LEFT_EYE", "RIGHT_EYE", "LEFT_OF_LEFT_EYEBROW", "RIGHT_OF_LEFT_EYEBROW",
+			"LEFT_OF_RIGHT_EYEBROW", "RIGHT_OF_RIGHT_EYEBROW", "MIDPOINT_BETWEEN_EYES", "NOSE_TIP", "UPPER_LIP",
+			"LOWER_LIP", "MOUTH_LEFT", "MOUTH_RIGHT", "MOUTH_CENTER", "NOSE_BOTTOM_RIGHT", "NOSE_BOTTOM_LEFT",
+			"NOSE_BOTTOM_CENTER", "LEFT_EYE_TOP_BOUNDARY", "LEFT_EYE_RIGHT_CORNER", "LEFT_EYE_BOTTOM_BOUNDARY",
+			"LEFT_EYE_LEFT_CORNER", "RIGHT_EYE_TOP_BOUNDARY", "RIGHT_EYE_RIGHT_CORNER", "RIGHT_EYE_BOTTOM_BOUNDARY",
+			"RIGHT_EYE_LEFT_CORNER", "LEFT_EYEBROW_UPPER_MIDPOINT", "RIGHT_EYEBROW_UPPER_MIDPOINT", "LEFT_EAR_TRAGION",
+			"RIGHT_EAR_TRAGION", "LEFT_EYE_PUPIL", "RIGHT_EYE_PUPIL", "FOREHEAD_GLABELLA", "CHIN_GNATHION",
+			"CHIN_LEFT_GONION", "CHIN_RIGHT_GONION" };
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<float> real(0, 1000);
+		std::string json = "{\"responses\":[{\"faceAnnotations\":[";
+		for (size_t i = 0; i < faces; i++)
+		{
+			if (i > 0)
+				json += ",";
+			json += "{\"boundingPoly\":" + makeVertices(rng) + ",\"fdBoundingPoly\":" + makeVertices(rng) + ",\"landmarks\":[";
+			for (size_t j = 0; j < sizeof(LANDMARKS) / sizeof(LANDMARKS[0]); j++)
+			{
+				if (j > 0)
+					json += ",";
+				json += "{\"type\":\"" + string(LANDMARKS[j]) + "\",\"position\":{\"x\":" + ofToString(real(rng))
+					+ ",\"y\":" + ofToString(real(rng)) + ",\"z\":" + ofToString(real(rng) - 500) + "}}";
+			}
+			json += "],\"rollAngle\":" + ofToString(real(rng) / 50) + ",\"panAngle\":" + ofToString(real(rng) / 50)
+				+ ",\"tiltAngle\":" + ofToString(real(rng) / 50) + ",\"detectionConfidence\":0.99,\"landmarkingConfidence\":0.7"
+				",\"joyLikelihood\":\"VERY_LIKELY\",\"sorrowLikelihood\":\"VERY_UNLIKELY\",\"angerLikelihood\":\"VERY_UNLIKELY\""
+				",\"surpriseLikelihood\":\"VERY_UNLIKELY\",\"underExposedLikelihood\":\"VERY_UNLIKELY\""
+				",\"blurredLikelihood\":\"VERY_UNLIKELY\",\"headwearLikelihood\":\"POSSIBLE\"}";
+		}
+		json += "]}]}";
+		return json;
+	}
+
+	// the full text first, then one annotation per word, like the service
+	inline std::string makeTextResponse(size_t words, unsigned seed = 1)
+	{
+		std::mt19937 rng(seed);
+		std::vector<std::string> text(words);
+		std::string full;
+		for (auto& word : text)
+		{
+			size_t length = 2 + rng() % 9;
+			for (size_t i = 0; i < length; i++)
+				word += (char)('a' + rng() % 26);
+			full += word + (rng() % 8 == 0 ? "\\n" : " ");
+		}
+		std::string json = "{\"responses\":[{\"textAnnotations\":[{\"locale\":\"en\",\"description\":\"" + full
+			+ "\",\"boundingPoly\":" + makeVertices(rng) + "}";
+		for (auto& word : text)
+			json += ",{\"description\":\"" + word + "\",\"boundingPoly\":" + makeVertices(rng) + "}";
+		json += "]}]}";
+		return json;
+	}
+
+	inline std::string makeLabelResponse(size_t labels, unsigned seed = 1)
+	{
+		std::mt19937 rng(seed);
+		std::string json = "{\"responses\":[{\"labelAnnotations\":[";
+		for (size_t i = 0; i < labels; i++)
+		{
+			if (i > 0)
+				json += ",";
+			json += "{\"mid\":\"/m/0" + ofToString(rng() % 100000) + "\",\"description\":\"label " + ofToString(i)
+				+ "\",\"score\":" + ofToString(1.0f - i * 0.001f) + "}";
+		}
+		json += "]}]}";
+		return json;
+	}
+}
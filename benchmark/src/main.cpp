@@ -0,0 +1,363 @@
+#include "ofMain.h"
+#include "Benchmark.h"
+#include "Legacy.h"
+#include "Responses.h"
+#include "GoogleCloudVision.h"
+#include "GoogleCloudVisionBase64.h"
+#include "GoogleCloudVisionEncoder.h"
+#include "GoogleCloudVisionParser.h"
+#include "GoogleCloudVisionProtobuf.h"
+#include "GoogleCloudVisionRequestBody.h"
+#include "GoogleCloudVisionResize.h"
+#include "Poco/Base64Encoder.h"
+
+// every stage the request path runs on the CPU, each against what it replaced:
+//   benchmark [--filter suite] [--json results.json] [--label commit]
+// the json report is meant for comparing runs, e.g. one per commit
+
+static benchmark::Report report;
+
+// the encoding path CloudVision::toBase64 used before the vectorised encoder:
+// stream the payload byte by byte through Poco::Base64Encoder and copy it out again
+static std::string pocoBase64(const std::string& source)
+{
+	std::istringstream in(source);
+	std::ostringstream out;
+	Poco::Base64Encoder b64out(out);
+
+	std::copy(std::istreambuf_iterator<char>(in),
+		std::istreambuf_iterator<char>(),
+		std::ostreambuf_iterator<char>(b64out));
+	b64out.close();
+
+	return out.str();
+}
+
+// reads a string in place, like the response stream
+struct StringBuffer : public std::streambuf
+{
+	StringBuffer(const std::string& text)
+	{
+		char* data = const_cast<char*>(text.data());
+		setg(data, data, data + text.size());
+	}
+};
+
+// swallows what is written, like a socket that is never full
+struct NullBuffer : public std::streambuf
+{
+	int_type overflow(int_type c) override { return c; }
+	std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+static ofPixels makeFrame(size_t width, size_t height, unsigned seed = 1)
+{
+	ofPixels pixels;
+	pixels.allocate(width, height, OF_IMAGE_COLOR);
+	std::string noise = benchmark::randomBytes(pixels.size(), seed);
+	unsigned char* data = pixels.getData();
+	// gradients under light noise, which compress about like camera frames
+	for (size_t y = 0; y < height; y++)
+	{
+		for (size_t x = 0; x < width; x++)
+		{
+			size_t i = (y * width + x) * 3;
+			data[i] = (unsigned char)(x * 255 / width + (noise[i] & 15));
+			data[i + 1] = (unsigned char)(y * 255 / height + (noise[i + 1] & 15));
+			data[i + 2] = (unsigned char)((x + y) * 127 / (width + height) + (noise[i + 2] & 31));
+		}
+	}
+	return pixels;
+}
+
+static void benchmarkBase64()
+{
+	printf("[base64] implementation: %s\n", google::base64GetImplementation());
+	printf("%-10s %12s %12s %12s %12s\n", "size", "poco MB/s", "scalar MB/s", "simd MB/s", "speedup");
+
+	// typical 640x480 jpeg payloads up to an unresized 4K png
+	for (size_t size : { 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 8 * 1024 * 1024 })
+	{
+		std::string payload = benchmark::randomBytes(size);
+		std::string body(google::base64EncodedSize(size), 0);
+
+		double poco = benchmark::measure([&] {
+			auto encoded = pocoBase64(payload);
+			benchmark::doNotOptimize(encoded);
+		});
+		double scalar = benchmark::measure([&] {
+			google::base64EncodeScalar(payload.data(), payload.size(), &body[0]);
+			benchmark::doNotOptimize(body);
+		});
+		double simd = benchmark::measure([&] {
+			google::base64Encode(payload.data(), payload.size(), &body[0]);
+			benchmark::doNotOptimize(body);
+		});
+
+		auto mbps = [size](double seconds) { return size / seconds / (1024.0 * 1024.0); };
+		printf("%-10u %12.1f %12.1f %12.1f %11.1fx\n", (unsigned)size, mbps(poco), mbps(scalar), mbps(simd), poco / simd);
+		string input = ofToString(size);
+		report.add("base64", input, "poco", poco, size);
+		report.add("base64", input, "scalar", scalar, size);
+		report.add("base64", input, "simd", simd, size);
+	}
+}
+
+static void benchmarkResize()
+{
+	size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+	printf("[resize] implementation: %s, %u threads\n", google::downscaleGetImplementation(), (unsigned)threads);
+	printf("%-10s %10s %12s %12s %12s %10s\n", "size", "target", "bicubic ms", "box ms", "box mt ms", "speedup");
+
+	// camera frames shrunk into the default 640x480 bounds
+	struct Size { size_t x, y; };
+	for (Size size : { Size{ 1280, 720 }, Size{ 1920, 1080 }, Size{ 3840, 2160 }, Size{ 4000, 3000 } })
+	{
+		ofPixels src;
+		src.allocate(size.x, size.y, OF_IMAGE_COLOR);
+		std::string noise = benchmark::randomBytes(src.size());
+		memcpy(src.getData(), noise.data(), noise.size());
+
+		size_t width, height;
+		google::fitSize(size.x, size.y, 640, 480, width, height);
+		ofPixels dst;
+		dst.allocate(width, height, OF_IMAGE_COLOR);
+
+		// what the worker did before: a single threaded bicubic resizeTo
+		double bicubic = benchmark::measure([&] {
+			src.resizeTo(dst, OF_INTERPOLATE_BICUBIC);
+			benchmark::doNotOptimize(dst);
+		});
+		double box = benchmark::measure([&] {
+			google::downscale(src, dst, 1);
+			benchmark::doNotOptimize(dst);
+		});
+		double boxThreaded = benchmark::measure([&] {
+			google::downscale(src, dst, threads);
+			benchmark::doNotOptimize(dst);
+		});
+
+		string name = ofToString(size.x) + "x" + ofToString(size.y);
+		string target = ofToString(width) + "x" + ofToString(height);
+		printf("%-10s %10s %12.2f %12.2f %12.2f %9.1fx\n", name.c_str(), target.c_str(),
+			bicubic * 1000, box * 1000, boxThreaded * 1000, bicubic / boxThreaded);
+		report.add("resize", name, "bicubic", bicubic, src.size());
+		report.add("resize", name, "box", box, src.size());
+		report.add("resize", name, "box_threaded", boxThreaded, src.size());
+	}
+}
+
+static void benchmarkEncode()
+{
+	printf("[encode]\n");
+	printf("%-10s %8s %14s %14s %14s %10s\n", "size", "format", "ofSaveImage ms", "encoder ms", "bytes", "speedup");
+
+	struct Size { size_t x, y; };
+	for (Size size : { Size{ 640, 480 }, Size{ 1920, 1080 }, Size{ 3840, 2160 } })
+	{
+		ofPixels pixels = makeFrame(size.x, size.y);
+		for (ofImageFormat format : { OF_IMAGE_FORMAT_JPEG, OF_IMAGE_FORMAT_PNG })
+		{
+			// the worker used to save every frame through ofSaveImage into a fresh buffer
+			double saved = benchmark::measure([&] {
+				ofBuffer buffer;
+				ofSaveImage(pixels, buffer, format, OF_IMAGE_QUALITY_HIGH);
+				benchmark::doNotOptimize(buffer);
+			});
+
+			google::EncoderSettings settings;
+			settings.format = format;
+			google::ImageEncoder encoder(settings);
+			std::vector<ofBuffer> spent;
+			size_t bytes = 0;
+			double encoded = benchmark::measure([&] {
+				ofBuffer buffer = encoder.getBuffer();
+				encoder.encode(pixels, buffer);
+				bytes = buffer.size();
+				spent.emplace_back(std::move(buffer));
+				encoder.recycle(spent);
+			});
+
+			string name = ofToString(size.x) + "x" + ofToString(size.y);
+			string type = format == OF_IMAGE_FORMAT_JPEG ? "jpeg" : "png";
+			printf("%-10s %8s %14.2f %14.2f %14u %9.1fx\n", name.c_str(), type.c_str(), saved * 1000, encoded * 1000,
+				(unsigned)bytes, saved / encoded);
+			report.add("encode_" + type, name, "ofSaveImage", saved, pixels.size());
+			report.add("encode_" + type, name, "encoder", encoded, pixels.size());
+		}
+	}
+}
+
+static void benchmarkRequestBody()
+{
+	printf("[request body]\n");
+	printf("%-10s %8s %14s %14s %10s\n", "image", "images", "string ms", "body ms", "speedup");
+
+	const std::string features = R"({"type":"LABEL_DETECTION","maxResults":3},{"type":"FACE_DETECTION","maxResults":3})";
+	for (size_t size : { 64 * 1024, 512 * 1024 })
+	{
+		for (size_t images : { 1, 8 })
+		{
+			std::string jpeg = benchmark::randomBytes(size);
+			NullBuffer sink;
+			std::ostream socket(&sink);
+
+			// the body was assembled as one string, then copied into the request stream
+			double concatenated = benchmark::measure([&] {
+				std::string body = R"({"requests":[)";
+				for (size_t i = 0; i < images; i++)
+				{
+					if (i > 0)
+						body += ",";
+					body += R"({"image":{"content":")" + pocoBase64(jpeg) + R"("},"features":[)" + features + "]}";
+				}
+				body += "]}";
+				socket << body;
+			});
+			double streamed = benchmark::measure([&] {
+				google::RequestBody body;
+				body.appendText(R"({"requests":[)");
+				for (size_t i = 0; i < images; i++)
+				{
+					if (i > 0)
+						body.appendText(",");
+					body.appendText(R"({"image":{"content":")");
+					body.appendBase64(ofBuffer(jpeg.data(), jpeg.size()));
+					body.appendText(R"("},"features":[)" + features + "]}");
+				}
+				body.appendText("]}");
+				body.writeTo(socket);
+			});
+
+			string input = ofToString(size / 1024) + "k";
+			printf("%-10s %8u %14.2f %14.2f %9.1fx\n", input.c_str(), (unsigned)images, concatenated * 1000, streamed * 1000,
+				concatenated / streamed);
+			input += "x" + ofToString(images);
+			report.add("request_body", input, "string", concatenated, (double)size * images);
+			report.add("request_body", input, "request_body", streamed, (double)size * images);
+		}
+	}
+}
+
+static void benchmarkParse()
+{
+	printf("[parse]\n");
+	printf("%-12s %10s %12s %12s %12s %12s %10s\n", "response", "bytes", "ofJson ms", "extract ms", "legacy ms", "stream ms", "speedup");
+
+	struct Input { std::string name; std::string json; };
+	std::vector<Input> inputs = {
+		{ "labels_10", benchmark::makeLabelResponse(10) },
+		{ "faces_50", benchmark::makeFaceResponse(50) },
+		{ "words_500", benchmark::makeTextResponse(500) },
+	};
+	for (auto& input : inputs)
+	{
+		const std::string& json = input.json;
+		double parsed = benchmark::measure([&] {
+			auto document = legacy::parse(json);
+			benchmark::doNotOptimize(document);
+		});
+		ofJson document = legacy::parse(json);
+		double extracted = benchmark::measure([&] {
+			auto responses = legacy::extract(document);
+			benchmark::doNotOptimize(responses);
+		});
+		double total = benchmark::measure([&] {
+			auto document = legacy::parse(json);
+			auto responses = legacy::extract(document);
+			benchmark::doNotOptimize(responses);
+		});
+		double streamed = benchmark::measure([&] {
+			google::CloudVisionResponse response;
+			std::vector<google::CloudVisionResponse*> responses = { &response };
+			StringBuffer buffer(json);
+			std::istream in(&buffer);
+			google::parseAnnotateResponse(in, 200, "OK", responses);
+			benchmark::doNotOptimize(response);
+		});
+
+		printf("%-12s %10u %12.3f %12.3f %12.3f %12.3f %9.1fx\n", input.name.c_str(), (unsigned)json.size(),
+			parsed * 1000, extracted * 1000, total * 1000, streamed * 1000, total / streamed);
+		report.add("parse", input.name, "ofJson_parse", parsed, json.size());
+		report.add("parse", input.name, "legacy_extract", extracted, json.size());
+		report.add("parse", input.name, "legacy", total, json.size());
+		report.add("parse", input.name, "streaming", streamed, json.size());
+	}
+}
+
+// the same answers as the gRPC transport receives them
+static void benchmarkProtobuf()
+{
+	printf("[protobuf]\n");
+	printf("%-12s %10s %10s %12s %12s %10s\n", "response", "json bytes", "pb bytes", "stream ms", "decode ms", "speedup");
+
+	struct Input { std::string name; std::string json; };
+	std::vector<Input> inputs = {
+		{ "labels_10", benchmark::makeLabelResponse(10) },
+		{ "faces_50", benchmark::makeFaceResponse(50) },
+		{ "words_500", benchmark::makeTextResponse(500) },
+	};
+	for (auto& input : inputs)
+	{
+		const std::string& json = input.json;
+		google::CloudVisionResponse original;
+		{
+			StringBuffer buffer(json);
+			std::istream in(&buffer);
+			google::parseAnnotateResponse(in, 200, "OK", { &original });
+		}
+		std::string message = google::encodeAnnotateResponse({ &original });
+
+		double streamed = benchmark::measure([&] {
+			google::CloudVisionResponse response;
+			StringBuffer buffer(json);
+			std::istream in(&buffer);
+			google::parseAnnotateResponse(in, 200, "OK", { &response });
+			benchmark::doNotOptimize(response);
+		});
+		double decoded = benchmark::measure([&] {
+			google::CloudVisionResponse response;
+			google::decodeAnnotateResponse(message.data(), message.size(), 200, "OK", { &response });
+			benchmark::doNotOptimize(response);
+		});
+
+		printf("%-12s %10u %10u %12.3f %12.3f %9.1fx\n", input.name.c_str(), (unsigned)json.size(), (unsigned)message.size(),
+			streamed * 1000, decoded * 1000, streamed / decoded);
+		report.add("protobuf", input.name, "streaming_json", streamed, json.size());
+		report.add("protobuf", input.name, "decode", decoded, message.size());
+	}
+}
+
+//========================================================================
+int main(int argc, char** argv)
+{
+	std::string filter, json, label;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string name = argv[i];
+		if (name == "--filter") filter = argv[i + 1];
+		else if (name == "--json") json = argv[i + 1];
+		else if (name == "--label") label = argv[i + 1];
+	}
+
+	std::vector<std::pair<std::string, void(*)()>> suites = {
+		{ "base64", benchmarkBase64 },
+		{ "resize", benchmarkResize },
+		{ "encode", benchmarkEncode },
+		{ "request_body", benchmarkRequestBody },
+		{ "parse", benchmarkParse },
+		{ "protobuf", benchmarkProtobuf },
+	};
+	for (auto& suite : suites)
+	{
+		if (filter.empty() || suite.first.find(filter) != std::string::npos)
+			suite.second();
+	}
+
+	if (!json.empty() && !report.write(json, label))
+	{
+		printf("could not write %s\n", json.c_str());
+		return 1;
+	}
+	return 0;
+}
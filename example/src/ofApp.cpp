@@ -74,20 +74,22 @@ void ofApp::update(){
 		ofPopMatrix();
 	}
 
-	auto drawBoundingPoly = [](ofVec2f pos, vector<ofVec2f>& vertices)
+	auto drawBoundingPoly = [](ofVec2f pos, google::Span<ofVec2f> vertices)
 	{
+		if (vertices.empty())
+			return;
 		ofPushStyle();
 		ofNoFill();
 		ofPushMatrix();
 		ofTranslate(pos);
 		ofVbo vbo;
-		vbo.setVertexData(&vertices[0].x, 2, vertices.size(), GL_STATIC_DRAW);
+		vbo.setVertexData(&vertices.data()->x, 2, vertices.size(), GL_STATIC_DRAW);
 		vbo.draw(GL_LINE_LOOP, 0, vertices.size());
 		ofPopMatrix();
 		ofPopStyle();
 	};
 
-	auto drawFaceLandmarks = [](ofVec2f pos, vector<google::Landmark> landmarks)
+	auto drawFaceLandmarks = [](ofVec2f pos, google::Span<google::Landmark> landmarks)
 	{
 #if 0
 		vector<ofVec3f> vertices;
@@ -183,13 +185,13 @@ void ofApp::update(){
 				text += ofVAArgsToString("tiltAngle: %f\n", annotation.tiltAngle);
 				text += ofVAArgsToString("detectionConfidence: %f\n", annotation.detectionConfidence);
 				text += ofVAArgsToString("landmarkingConfidence: %f\n", annotation.landmarkingConfidence);
-				text += ofVAArgsToString("joyLikelihood: %s\n", annotation.joyLikelihood.c_str());
-				text += ofVAArgsToString("sorrowLikelihood: %s\n", annotation.sorrowLikelihood.c_str());
-				text += ofVAArgsToString("angerLikelihood: %s\n", annotation.angerLikelihood.c_str());
-				text += ofVAArgsToString("surpriseLikelihood: %s\n", annotation.surpriseLikelihood.c_str());
-				text += ofVAArgsToString("underExposedLikelihood: %s\n", annotation.underExposedLikelihood.c_str());
-				text += ofVAArgsToString("blurredLikelihood: %s\n", annotation.blurredLikelihood.c_str());
-				text += ofVAArgsToString("headwearLikelihood: %s\n", annotation.headwearLikelihood.c_str());
+				text += ofVAArgsToString("joyLikelihood: %s\n", annotation.joyLikelihood().c_str());
+				text += ofVAArgsToString("sorrowLikelihood: %s\n", annotation.sorrowLikelihood().c_str());
+				text += ofVAArgsToString("angerLikelihood: %s\n", annotation.angerLikelihood().c_str());
+				text += ofVAArgsToString("surpriseLikelihood: %s\n", annotation.surpriseLikelihood().c_str());
+				text += ofVAArgsToString("underExposedLikelihood: %s\n", annotation.underExposedLikelihood().c_str());
+				text += ofVAArgsToString("blurredLikelihood: %s\n", annotation.blurredLikelihood().c_str());
+				text += ofVAArgsToString("headwearLikelihood: %s\n", annotation.headwearLikelihood().c_str());
 				drawBoundingPoly(texurePosition, annotation.boundingPoly.vertices);
 				drawBoundingPoly(texurePosition, annotation.fdBoundingPoly.vertices);
 				drawFaceLandmarks(texurePosition, annotation.landmarks);
@@ -0,0 +1,313 @@
+#include "MockVisionServer.h"
+#include "GoogleCloudVision.h"
+#include "GoogleCloudVisionProtobuf.h"
+#include "Poco/Net/HTTPServer.h"
+#include "Poco/Net/HTTPRequestHandler.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/DeflatingStream.h"
+#include "Poco/InflatingStream.h"
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/generic/async_generic_service.h>
+#endif
+
+using namespace Poco;
+using namespace Poco::Net;
+
+namespace loadtest
+{
+	namespace
+	{
+		class AnnotateHandler : public HTTPRequestHandler
+		{
+		public:
+			AnnotateHandler(MockVisionServer& server) : mServer(server) {}
+
+			void handleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override
+			{
+				string wire((std::istreambuf_iterator<char>(request.stream())), std::istreambuf_iterator<char>());
+				string body = wire;
+				if (request.get("Content-Encoding", "") == "gzip")
+				{
+					std::istringstream compressed(wire);
+					InflatingInputStream in(compressed, InflatingStreamBuf::STREAM_GZIP);
+					body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+				}
+
+				string answer, retryAfter;
+				int status = mServer.answer(body, answer, retryAfter);
+				if (mServer.isGzipEnabled() && request.get("Accept-Encoding", "").find("gzip") != string::npos)
+				{
+					std::ostringstream compressed;
+					DeflatingOutputStream out(compressed, DeflatingStreamBuf::STREAM_GZIP);
+					out << answer;
+					out.close();
+					answer = compressed.str();
+					response.set("Content-Encoding", "gzip");
+				}
+				mServer.addTraffic(wire.size(), answer.size());
+
+				response.setStatus(status);
+				if (!retryAfter.empty())
+					response.set("Retry-After", retryAfter);
+				response.setContentType("application/json; charset=UTF-8");
+				response.setKeepAlive(request.getKeepAlive());
+				response.sendBuffer(answer.data(), answer.size());
+			}
+
+		private:
+			MockVisionServer& mServer;
+		};
+
+		class AnnotateHandlerFactory : public HTTPRequestHandlerFactory
+		{
+		public:
+			AnnotateHandlerFactory(MockVisionServer& server) : mServer(server) {}
+
+			HTTPRequestHandler* createRequestHandler(const HTTPServerRequest&) override
+			{
+				return new AnnotateHandler(mServer);
+			}
+
+		private:
+			MockVisionServer& mServer;
+		};
+
+		size_t countImages(const string& request)
+		{
+			size_t count = 0;
+			for (size_t pos = request.find("\"image\""); pos != string::npos; pos = request.find("\"image\"", pos + 7))
+				count++;
+			return count;
+		}
+	}
+
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+	// one call at a time per completion queue and thread, like the HTTP server's thread pool
+	struct MockVisionServer::GrpcServer
+	{
+		grpc::AsyncGenericService service;
+		std::unique_ptr<grpc::Server> server;
+		std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> queues;
+		std::vector<std::thread> threads;
+		int port = 0;
+	};
+
+	void MockVisionServer::serveGrpc(size_t index)
+	{
+		auto queue = mGrpc->queues[index].get();
+		void* tag;
+		bool ok;
+		while (true)
+		{
+			grpc::GenericServerContext context;
+			grpc::GenericServerAsyncReaderWriter stream(&context);
+			mGrpc->service.RequestCall(&context, &stream, queue, queue, this);
+			// not ok once the server shuts down
+			if (!queue->Next(&tag, &ok) || !ok)
+				break;
+			grpc::ByteBuffer message;
+			stream.Read(&message, this);
+			if (!queue->Next(&tag, &ok))
+				break;
+
+			string request, response, error;
+			int status = 400;
+			if (!ok)
+				error = "no request message";
+			else if (context.method() != "/google.cloud.vision.v1.ImageAnnotator/BatchAnnotateImages")
+				error = "unknown method " + context.method();
+			else
+			{
+				std::vector<grpc::Slice> slices;
+				message.Dump(&slices);
+				for (auto& slice : slices)
+					request.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+				status = answerProtobuf(request, response, error);
+			}
+			addTraffic(request.size(), response.size());
+
+			if (status == 200)
+			{
+				grpc::Slice slice(response);
+				grpc::ByteBuffer reply(&slice, 1);
+				stream.WriteAndFinish(reply, grpc::WriteOptions(), grpc::Status::OK, this);
+			}
+			else
+			{
+				auto code = status == 429 ? grpc::StatusCode::RESOURCE_EXHAUSTED
+					: status == 503 ? grpc::StatusCode::UNAVAILABLE : grpc::StatusCode::INVALID_ARGUMENT;
+				stream.Finish(grpc::Status(code, error), this);
+			}
+			if (!queue->Next(&tag, &ok))
+				break;
+		}
+		// whatever is left once the queue is shut down
+		while (queue->Next(&tag, &ok)) {}
+	}
+#else
+	struct MockVisionServer::GrpcServer {};
+#endif
+
+	MockVisionServer::MockVisionServer(const MockSettings& settings)
+		:mSettings(settings)
+		,mRandom(settings.seed)
+	{
+		ServerSocket socket(SocketAddress("127.0.0.1", mSettings.port));
+		HTTPServerParams* params = new HTTPServerParams;
+		params->setMaxThreads((int)std::max<size_t>(mSettings.threads, 1));
+		params->setMaxQueued(1024);
+		params->setKeepAlive(true);
+		mServer.reset(new HTTPServer(new AnnotateHandlerFactory(*this), socket, params));
+		mServer->start();
+
+		if (!mSettings.grpc)
+			return;
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+		mGrpc.reset(new GrpcServer);
+		grpc::ServerBuilder builder;
+		builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &mGrpc->port);
+		builder.RegisterAsyncGenericService(&mGrpc->service);
+		builder.SetMaxReceiveMessageSize(-1);
+		size_t threads = std::max<size_t>(mSettings.threads, 1);
+		for (size_t i = 0; i < threads; i++)
+			mGrpc->queues.emplace_back(builder.AddCompletionQueue());
+		mGrpc->server = builder.BuildAndStart();
+		for (size_t i = 0; i < threads; i++)
+			mGrpc->threads.emplace_back(&MockVisionServer::serveGrpc, this, i);
+#else
+		ofLogError("loadtest") << "the mock serves gRPC only when built with OFX_GOOGLE_CLOUD_VISION_GRPC";
+#endif
+	}
+
+	MockVisionServer::~MockVisionServer()
+	{
+		mServer->stopAll(true);
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+		if (mGrpc)
+		{
+			mGrpc->server->Shutdown();
+			for (auto& queue : mGrpc->queues)
+				queue->Shutdown();
+			for (auto& thread : mGrpc->threads)
+				thread.join();
+		}
+#endif
+	}
+
+	string MockVisionServer::getEndpoint() const
+	{
+		return "http://127.0.0.1:" + ofToString(mServer->port()) + "/v1/";
+	}
+
+	string MockVisionServer::getGrpcTarget() const
+	{
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+		if (mGrpc)
+			return "127.0.0.1:" + ofToString(mGrpc->port);
+#endif
+		return "";
+	}
+
+	int MockVisionServer::simulate(string& retryAfter)
+	{
+		mRequests++;
+		float roll;
+		int64_t delay;
+		{
+			std::unique_lock<std::mutex> lck(mRandomMutex);
+			roll = std::uniform_real_distribution<float>(0, 1)(mRandom);
+			int64_t jitter = (int64_t)mSettings.jitterMillis;
+			delay = (int64_t)mSettings.latencyMillis + std::uniform_int_distribution<int64_t>(-jitter, jitter)(mRandom);
+		}
+		if (delay > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+		if (roll < mSettings.throttleRate)
+		{
+			mThrottled++;
+			retryAfter = ofToString(mSettings.retryAfterSeconds);
+			return 429;
+		}
+		if (roll < mSettings.throttleRate + mSettings.errorRate)
+		{
+			mErrors++;
+			return 503;
+		}
+		return 200;
+	}
+
+	int MockVisionServer::answer(const string& request, string& response, string& retryAfter)
+	{
+		int status = simulate(retryAfter);
+		if (status == 429)
+		{
+			response = R"({"error":{"code":429,"message":"Quota exceeded, injected by the mock server","status":"RESOURCE_EXHAUSTED"}})";
+			return status;
+		}
+		if (status == 503)
+		{
+			response = R"({"error":{"code":503,"message":"The service is currently unavailable, injected by the mock server","status":"UNAVAILABLE"}})";
+			return status;
+		}
+
+		size_t images = std::max<size_t>(countImages(request), 1);
+		mImages += images;
+		string padding(mSettings.padding, 'x');
+		string labels;
+		for (size_t i = 0; i < mSettings.labels; i++)
+		{
+			if (i > 0)
+				labels += ",";
+			labels += R"({"mid":"/m/0mock)" + ofToString(i) + R"(","description":"label )" + ofToString(i) + padding
+				+ R"(","score":)" + ofToString(0.99f - i * 0.01f) + "}";
+		}
+
+		response = R"({"responses":[)";
+		for (size_t i = 0; i < images; i++)
+		{
+			if (i > 0)
+				response += ",";
+			response += R"({"labelAnnotations":[)" + labels + "]}";
+		}
+		response += "]}";
+		return 200;
+	}
+
+	int MockVisionServer::answerProtobuf(const string& request, string& response, string& error)
+	{
+		string retryAfter;
+		int status = simulate(retryAfter);
+		if (status == 429)
+		{
+			error = "Quota exceeded, injected by the mock server";
+			return status;
+		}
+		if (status == 503)
+		{
+			error = "The service is currently unavailable, injected by the mock server";
+			return status;
+		}
+
+		size_t images = std::max<size_t>(google::countImageRequests(request.data(), request.size()), 1);
+		mImages += images;
+		// one canned response, encoded once per image
+		google::CloudVisionResponse labels;
+		labels.arena = make_shared<google::ResponseArena>();
+		string padding(mSettings.padding, 'x');
+		for (size_t i = 0; i < mSettings.labels; i++)
+		{
+			google::LabelAnnotation label;
+			label.mid = labels.arena->store("/m/0mock" + ofToString(i));
+			label.description = labels.arena->store("label " + ofToString(i) + padding);
+			label.score = 0.99f - i * 0.01f;
+			labels.labelAnnotations.push_back(label);
+		}
+		response = google::encodeAnnotateResponse(std::vector<const google::CloudVisionResponse*>(images, &labels));
+		return 200;
+	}
+}
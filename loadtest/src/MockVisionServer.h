@@ -0,0 +1,83 @@
+#pragma once
+
+#include "ofMain.h"
+#include <random>
+
+namespace Poco { namespace Net { class HTTPServer; } }
+
+namespace loadtest
+{
+	struct MockSettings
+	{
+		// 0 picks a free port, see MockVisionServer::getEndpoint()
+		uint16_t port = 0;
+		size_t threads = 16;
+		// every image is answered with this many label annotations
+		size_t labels = 5;
+		// extra bytes in every label description, to make responses larger
+		size_t padding = 0;
+		// time between reading the request and answering it, plus up to +-jitter
+		uint64_t latencyMillis = 50;
+		uint64_t jitterMillis = 10;
+		// share of requests answered with 503 and with 429 (Retry-After: retryAfterSeconds)
+		float errorRate = 0;
+		float throttleRate = 0;
+		int retryAfterSeconds = 1;
+		unsigned seed = 1;
+		// gzip answers to clients that accept it; gzip requests are always decoded
+		bool gzip = false;
+		// also serve BatchAnnotateImages over plain text gRPC, see getGrpcTarget(); needs
+		// OFX_GOOGLE_CLOUD_VISION_GRPC like the client's transport
+		bool grpc = false;
+	};
+
+	// images:annotate on plain HTTP localhost, answering every image in a request with canned labels;
+	// optionally the same over gRPC, both front ends share latency, failures and counters
+	class MockVisionServer
+	{
+	public:
+		MockVisionServer(const MockSettings& settings);
+		~MockVisionServer();
+
+		// http://127.0.0.1:<port>/v1/, for CloudVisionSettings::endpoint
+		string getEndpoint() const;
+		// 127.0.0.1:<port>, for GrpcSettings::target; empty unless MockSettings::grpc is on
+		string getGrpcTarget() const;
+		uint64_t getRequestCount() const { return mRequests; }
+		uint64_t getImageCount() const { return mImages; }
+		uint64_t getErrorCount() const { return mErrors; }
+		uint64_t getThrottleCount() const { return mThrottled; }
+
+		// status and body for a request, runs on the server's threads
+		int answer(const string& request, string& response, string& retryAfter);
+		// the same for a protobuf BatchAnnotateImagesRequest, error is the message of a failure
+		int answerProtobuf(const string& request, string& response, string& error);
+		bool isGzipEnabled() const { return mSettings.gzip; }
+		uint64_t getBytesReceived() const { return mBytesReceived; }
+		uint64_t getBytesSent() const { return mBytesSent; }
+		void addTraffic(uint64_t received, uint64_t sent)
+		{
+			mBytesReceived += received;
+			mBytesSent += sent;
+		}
+
+	private:
+		// waits out the latency and rolls the injected failures, 200 when the request is to be answered
+		int simulate(string& retryAfter);
+
+		struct GrpcServer;
+		void serveGrpc(size_t queue);
+
+		MockSettings mSettings;
+		std::unique_ptr<Poco::Net::HTTPServer> mServer;
+		std::unique_ptr<GrpcServer> mGrpc;
+		std::atomic<uint64_t> mRequests{ 0 };
+		std::atomic<uint64_t> mImages{ 0 };
+		std::atomic<uint64_t> mErrors{ 0 };
+		std::atomic<uint64_t> mThrottled{ 0 };
+		std::atomic<uint64_t> mBytesReceived{ 0 };
+		std::atomic<uint64_t> mBytesSent{ 0 };
+		std::mutex mRandomMutex;
+		std::mt19937 mRandom;
+	};
+}
@@ -0,0 +1,223 @@
+#include "ofMain.h"
+#include "GoogleCloudVision.h"
+#include "MockVisionServer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// drives CloudVision::pushPixels against a MockVisionServer on localhost, no key or network needed:
+//   loadtest --images 500 --workers 4 --batch 4 --latency 50 --jitter 10 --errors 0.01
+// every option is listed in usage()
+
+namespace
+{
+	struct Options
+	{
+		size_t images = 500;
+		size_t corpus = 16;
+		size_t width = 1280;
+		size_t height = 720;
+		size_t encoders = 1;
+		size_t workers = 4;
+		size_t batch = 1;
+		uint64_t linger = 0;
+		bool gzip = false;
+		bool grpc = false;
+		loadtest::MockSettings mock;
+	};
+
+	void usage()
+	{
+		printf("loadtest [--images n] [--corpus n] [--width px] [--height px] [--encoders n] [--workers n]\n"
+			"         [--batch n] [--linger ms] [--latency ms] [--jitter ms] [--errors rate] [--throttle rate]\n"
+			"         [--labels n] [--padding bytes] [--seed n] [--gzip 0|1] [--grpc 0|1]\n");
+	}
+
+	bool parse(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			string name = argv[i];
+			if (i + 1 >= argc)
+				return false;
+			string value = argv[++i];
+			if (name == "--images") options.images = ofToInt(value);
+			else if (name == "--corpus") options.corpus = std::max(ofToInt(value), 1);
+			else if (name == "--width") options.width = ofToInt(value);
+			else if (name == "--height") options.height = ofToInt(value);
+			else if (name == "--encoders") options.encoders = ofToInt(value);
+			else if (name == "--workers") options.workers = ofToInt(value);
+			else if (name == "--batch") options.batch = ofToInt(value);
+			else if (name == "--linger") options.linger = ofToInt(value);
+			else if (name == "--latency") options.mock.latencyMillis = ofToInt(value);
+			else if (name == "--jitter") options.mock.jitterMillis = ofToInt(value);
+			else if (name == "--errors") options.mock.errorRate = ofToFloat(value);
+			else if (name == "--throttle") options.mock.throttleRate = ofToFloat(value);
+			else if (name == "--labels") options.mock.labels = ofToInt(value);
+			else if (name == "--padding") options.mock.padding = ofToInt(value);
+			else if (name == "--seed") options.mock.seed = ofToInt(value);
+			else if (name == "--gzip") options.gzip = options.mock.gzip = ofToInt(value) != 0;
+			else if (name == "--grpc") options.grpc = options.mock.grpc = ofToInt(value) != 0;
+			else return false;
+		}
+		return true;
+	}
+
+	// smooth gradients under noise, so frames compress about as badly as camera images
+	std::vector<ofPixels> makeCorpus(const Options& options)
+	{
+		std::vector<ofPixels> corpus(options.corpus);
+		std::mt19937 rng(options.mock.seed);
+		for (size_t n = 0; n < corpus.size(); n++)
+		{
+			auto& pixels = corpus[n];
+			pixels.allocate(options.width, options.height, OF_IMAGE_COLOR);
+			unsigned char* data = pixels.getData();
+			for (size_t y = 0; y < options.height; y++)
+			{
+				for (size_t x = 0; x < options.width; x++)
+				{
+					unsigned char* p = data + (y * options.width + x) * 3;
+					unsigned noise = rng();
+					p[0] = (unsigned char)((x * 255 / options.width + n * 37 + (noise & 15)) & 0xff);
+					p[1] = (unsigned char)((y * 255 / options.height + n * 59 + ((noise >> 4) & 15)) & 0xff);
+					p[2] = (unsigned char)(((x + y) * 127 / (options.width + options.height) + ((noise >> 8) & 31)) & 0xff);
+				}
+			}
+		}
+		return corpus;
+	}
+
+	// user + system seconds of the whole process
+	double getCpuSeconds()
+	{
+#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+		auto seconds = [](const FILETIME& time) { return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / 1e7; };
+		return seconds(kernel) + seconds(user);
+#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+	}
+
+	double getPeakRssMegabytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#elif defined(__APPLE__)
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss / 1024.0;
+#endif
+	}
+
+	double percentile(std::vector<uint64_t>& sorted, float p)
+	{
+		if (sorted.empty())
+			return 0;
+		size_t index = std::min((size_t)(p * (sorted.size() - 1) + 0.5f), sorted.size() - 1);
+		return sorted[index] / 1000.0;
+	}
+}
+
+//========================================================================
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parse(argc, argv, options))
+	{
+		usage();
+		return 1;
+	}
+
+	printf("[loadtest] generating %u images of %ux%u\n", (unsigned)options.corpus, (unsigned)options.width, (unsigned)options.height);
+	auto corpus = makeCorpus(options);
+	loadtest::MockVisionServer server(options.mock);
+
+	google::CloudVisionSettings settings;
+	settings.endpoint = server.getEndpoint();
+	settings.numEncoders = options.encoders;
+	settings.numWorkers = options.workers;
+	settings.maxBatchSize = options.batch;
+	settings.maxBatchLingerMillis = options.linger;
+	// every image is measured, none may be dropped
+	settings.overflowPolicy = google::OVERFLOW_BLOCK;
+	settings.connections.maxIdlePerHost = options.workers;
+	settings.metrics.enabled = true;
+	settings.compression.compressRequests = options.gzip;
+	settings.compression.acceptGzip = options.gzip;
+	if (options.grpc)
+	{
+		// REST stays the fallback when the addon is built without grpc
+		settings.transport = google::TRANSPORT_GRPC;
+		settings.grpc.target = server.getGrpcTarget();
+		settings.grpc.insecure = true;
+	}
+	auto vision = google::CloudVision::create("loadtest", settings);
+
+	printf("[loadtest] %u images over %s to %s, %u encoders, %u workers, batches of %u\n", (unsigned)options.images,
+		vision->getTransport().getName().c_str(), vision->getTransport().getName() == "grpc" ? settings.grpc.target.c_str() : settings.endpoint.c_str(),
+		(unsigned)options.encoders, (unsigned)options.workers, (unsigned)options.batch);
+
+	double cpuStart = getCpuSeconds();
+	uint64_t start = ofGetElapsedTimeMicros();
+	std::vector<google::CloudVisionRequest> requests;
+	requests.reserve(options.images);
+	for (size_t i = 0; i < options.images; i++)
+		requests.push_back(vision->pushPixels(corpus[i % corpus.size()]));
+
+	std::vector<uint64_t> latencies;
+	std::map<int, size_t> statuses;
+	for (auto& request : requests)
+	{
+		const google::CloudVisionResponse& response = request.future.get();
+		statuses[response.status]++;
+		if (response.status == google::REQUEST_OK)
+			latencies.push_back(response.completeTime - response.submitTime);
+	}
+	double seconds = (ofGetElapsedTimeMicros() - start) / 1e6;
+	double cpu = getCpuSeconds() - cpuStart;
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("\n%-24s %10.1f\n", "images/sec", options.images / seconds);
+	printf("%-24s %10.2f\n", "wall seconds", seconds);
+	printf("%-24s %10.2f (%.0f%% of one core)\n", "cpu seconds", cpu, cpu / seconds * 100);
+	printf("%-24s %10.1f\n", "peak rss MB", getPeakRssMegabytes());
+	printf("%-24s %10.1f %10.1f %10.1f %10.1f\n", "latency ms p50/90/99/max", percentile(latencies, 0.5f),
+		percentile(latencies, 0.9f), percentile(latencies, 0.99f), percentile(latencies, 1));
+	for (auto& it : statuses)
+		printf("%-24s %10u\n", ("status " + ofToString(it.first)).c_str(), (unsigned)it.second);
+	printf("%-24s %10u (%u errors, %u throttled injected)\n", "server requests", (unsigned)server.getRequestCount(),
+		(unsigned)server.getErrorCount(), (unsigned)server.getThrottleCount());
+	printf("%-24s %10.1f %10.1f\n", "wire MB up/down", server.getBytesReceived() / (1024.0 * 1024.0),
+		server.getBytesSent() / (1024.0 * 1024.0));
+
+	// where the time went inside the client
+	auto metrics = vision->getMetrics();
+	printf("\n%-24s %10s %10s %10s\n", "phase", "mean ms", "p50 ms", "p99 ms");
+	for (auto& phase : metrics.phases)
+	{
+		if (phase.count == 0)
+			continue;
+		printf("%-24s %10.2f %10.2f %10.2f\n", phase.name.c_str(), phase.getMeanMicros() / 1000,
+			phase.getPercentile(0.5f) / 1000.0, phase.getPercentile(0.99f) / 1000.0);
+	}
+
+	vision->stop();
+	// failures nobody asked for fail the run
+	bool injected = options.mock.errorRate > 0 || options.mock.throttleRate > 0;
+	return injected || statuses[google::REQUEST_OK] == options.images ? 0 : 2;
+}
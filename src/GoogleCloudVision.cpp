@@ -1,7 +1,7 @@
 #pragma once
 
 #include "GoogleCloudVision.h"
-#include "Poco/Base64Encoder.h"
+#include "GoogleCloudVisionParser.h"
 #include "Poco/Net/HTTPResponse.h"
 #include "Poco/Net/HTTPSClientSession.h"
 #include "Poco/Net/HTTPClientSession.h"
@@ -17,322 +17,942 @@ using namespace Poco::Net;
 
 namespace google
 {
-	CloudVision::CloudVision(string key)
+	const string& toString(Likelihood likelihood)
+	{
+		static const string names[] = { "UNKNOWN", "VERY_UNLIKELY", "UNLIKELY", "POSSIBLE", "LIKELY", "VERY_LIKELY" };
+		return likelihood <= LIKELIHOOD_VERY_LIKELY ? names[likelihood] : names[0];
+	}
+
+	Likelihood toLikelihood(const string& name)
+	{
+		for (int i = LIKELIHOOD_VERY_LIKELY; i > LIKELIHOOD_UNKNOWN; i--)
+		{
+			if (toString((Likelihood)i) == name)
+				return (Likelihood)i;
+		}
+		return LIKELIHOOD_UNKNOWN;
+	}
+
+	CloudVision::CloudVision(string key, const CloudVisionSettings& settings)
 		:GOOGLE_BROWSER_KEY(key)
+		,mSettings(settings)
+		,mSessionPool(settings.connections)
+		,mNextId(1)
+		,pixelQueue(settings.maxQueueSize, settings.overflowPolicy)
+		,mDownloadQueue(settings.maxDownloadQueueSize, settings.overflowPolicy)
+		,mEncodedQueue(std::max<size_t>(settings.numWorkers * settings.maxBatchSize * 2, 4))
+		,mSpentBuffers(64)
+		,mRateController(settings.rateLimit)
+		,mSuppressed(0)
+		,mRetries(0)
+		,mHedges(0)
 	{
+		if (mSettings.maxBatchSize == 0)
+			mSettings.maxBatchSize = 1;
+		if (mSettings.numWorkers == 0)
+			mSettings.numWorkers = 1;
+		if (mSettings.numDownloaders == 0)
+			mSettings.numDownloaders = 1;
+		if (mSettings.numEncoders == 0)
+			mSettings.numEncoders = 1;
+		if (mSettings.rateLimit.enabled)
+			mScheduler.reset(new RequestScheduler<Submission>(mRateController, mSettings.rateLimit.maxQueueSize));
+		if (mSettings.metrics.enabled)
+			mMetrics.reset(new Metrics());
+		TransportContext transport;
+		transport.key = GOOGLE_BROWSER_KEY;
+		transport.endpoint = mSettings.endpoint;
+		transport.compression = mSettings.compression;
+		transport.grpc = mSettings.grpc;
+		transport.sessionPool = &mSessionPool;
+		transport.rateController = &mRateController;
+		transport.metrics = mMetrics.get();
+		mTransport = createTransport(mSettings.transport, transport);
+
 		SharedPtr<PrivateKeyPassphraseHandler> pConsoleHandler = new KeyConsoleHandler(false);
 		SharedPtr<InvalidCertificateHandler> pInvalidCertHandler = new ConsoleCertificateHandler(true);
 		Context::Ptr pContext = new Context(Context::CLIENT_USE, "", Context::VERIFY_NONE);
 		SSLManager::instance().initializeClient(pConsoleHandler, pInvalidCertHandler, pContext);
 
-		startThread();
+		if (mSettings.trace.enabled)
+			mTrace.reset(new TraceRecorder(mSettings.trace));
+		if (mSettings.cache.enabled)
+			mCache.reset(new ResultCache(mSettings.cache));
+		if (mSettings.archive.enabled)
+			mArchive.reset(new ArchiveWriter(mSettings.archive));
+		mFeatures = make_shared<const string>(mTransport->encodeFeatures(mSettings.features));
+		if (mSettings.metrics.prometheusPort)
+			mMetricsServer.reset(new MetricsServer(mSettings.metrics.prometheusPort, [this] { return getMetrics().toPrometheus(); }));
+
+		mRunning = true;
+		for (size_t i = 0; i < mSettings.numWorkers; i++)
+			mWorkers.emplace_back(&CloudVision::threadedFunction, this);
+		for (size_t i = 0; i < mSettings.numEncoders; i++)
+			mEncoders.emplace_back(&CloudVision::encodeFunction, this);
+		if (mSettings.urlMode == URL_DOWNLOAD)
+		{
+			for (size_t i = 0; i < mSettings.numDownloaders; i++)
+				mDownloaders.emplace_back(&CloudVision::downloadFunction, this);
+		}
 	}
 
 	CloudVision::~CloudVision()
 	{
 		stop();
-		waitForThread(false);
+		for (auto& worker : mWorkers)
+		{
+			if (worker.joinable())
+				worker.join();
+		}
+		for (auto& encoder : mEncoders)
+		{
+			if (encoder.joinable())
+				encoder.join();
+		}
+		for (auto& downloader : mDownloaders)
+		{
+			if (downloader.joinable())
+				downloader.join();
+		}
+
+		// whatever is still queued finishes as dropped, so every future gets its value
+		std::vector<Submission> left;
+		pixelQueue.drain(left);
+		mDownloadQueue.drain(left);
+		mEncodedQueue.drain(left);
+		if (mScheduler)
+			mScheduler->drain(left);
+		{
+			std::unique_lock<std::mutex> lck(mGateMutex);
+			for (auto& it : mDuplicates)
+			{
+				for (auto& duplicate : it.second)
+					left.emplace_back(std::move(duplicate));
+			}
+			mDuplicates.clear();
+		}
+		for (auto& submission : left)
+			fail(submission, REQUEST_DROPPED, "stopped");
+		if (!left.empty())
+			deliver(left);
 	}
 
-	void CloudVision::pushURL(const string& url)
+	CloudVisionRequest CloudVision::pushURL(const string& url, CloudVisionCallback callback)
 	{
-		mURL = url;
+		return pushURL(url, RequestOptions(), callback);
 	}
 
-	void CloudVision::pushPixels(const ofPixels& pix)
+	CloudVisionRequest CloudVision::pushURL(const string& url, const RequestOptions& options, CloudVisionCallback callback)
 	{
-		std::unique_lock<std::mutex> lck(mutex);
-		pixelQueue.emplace_back(pix);
+		Submission submission;
+		submission.url = url;
+		submission.callback = callback;
+		applyOptions(submission, options);
+		return push(std::move(submission));
+	}
+
+	CloudVisionRequest CloudVision::pushPixels(const ofPixels& pix, CloudVisionCallback callback)
+	{
+		return pushPixels(pix, RequestOptions(), callback);
+	}
+
+	CloudVisionRequest CloudVision::pushPixels(const ofPixels& pix, const RequestOptions& options, CloudVisionCallback callback)
+	{
+		Submission submission;
+		submission.callback = callback;
+		applyOptions(submission, options);
+		return pushPixels(std::move(submission), pix);
+	}
+
+	void CloudVision::applyOptions(Submission& submission, const RequestOptions& options)
+	{
+		const FeatureSet& features = options.useFeatures ? options.features : mSettings.features;
+		submission.features = options.useFeatures ? make_shared<const string>(mTransport->encodeFeatures(features)) : mFeatures;
+		submission.featureMask = features.getMask();
+		submission.maxResults = features.getMaxResults();
+
+		submission.priority = options.priority;
+		uint64_t deadline = options.deadlineMillis ? options.deadlineMillis : mSettings.retry.deadlineMillis;
+		if (deadline)
+			submission.deadline = ofGetElapsedTimeMicros() + deadline * 1000;
+	}
+
+	CloudVisionRequest CloudVision::pushPixels(Submission&& submission, const ofPixels& pix)
+	{
+		if (!mSettings.frameGate.enabled)
+		{
+			submission.pixels = pix;
+			return push(std::move(submission));
+		}
+
+		// hashed before anything is copied, duplicates never touch the pixels again
+		uint64_t hash = differenceHash(pix);
+		uint64_t now = ofGetElapsedTimeMillis();
+		CloudVisionRequest request = prepare(submission);
+		std::shared_ptr<CloudVisionResponse> previous;
+		{
+			std::unique_lock<std::mutex> lck(mGateMutex);
+			auto& gate = mSettings.frameGate;
+			bool sameFeatures = mGateFeatures == submission.features || (mGateFeatures && *mGateFeatures == *submission.features);
+			bool duplicate = mGateValid && sameFeatures && hammingDistance(hash, mGateHash) <= gate.maxDistance
+				&& (gate.maxStalenessMillis == 0 || now - mGateTime < gate.maxStalenessMillis);
+			if (duplicate)
+			{
+				mSuppressed++;
+				submission.response->duplicateOf = mGateId;
+				if (!mGateResult)
+				{
+					// the original is still in flight, its delivery picks this one up
+					mDuplicates[mGateId].emplace_back(std::move(submission));
+					return request;
+				}
+				previous = mGateResult;
+			}
+			else
+			{
+				mGateValid = true;
+				mGateHash = hash;
+				mGateTime = now;
+				mGateId = request.id;
+				mGateFeatures = submission.features;
+				mGateResult.reset();
+			}
+		}
+
+		if (previous)
+		{
+			copyResult(*previous, *submission.response);
+			std::vector<Submission> finished;
+			finished.emplace_back(std::move(submission));
+			deliver(finished);
+			return request;
+		}
+		submission.pixels = pix;
+		enqueue(pixelQueue, std::move(submission));
+		return request;
+	}
+
+	CloudVisionRequest CloudVision::push(Submission&& submission)
+	{
+		CloudVisionRequest request = prepare(submission);
+		if (submission.url.empty())
+		{
+			enqueue(pixelQueue, std::move(submission));
+		}
+		else if (mSettings.urlMode == URL_PASS_THROUGH)
+		{
+			submission.remote = true;
+			enqueue(pixelQueue, std::move(submission));
+		}
+		else
+		{
+			enqueue(mDownloadQueue, std::move(submission));
+		}
+		return request;
+	}
+
+	CloudVisionRequest CloudVision::prepare(Submission& submission)
+	{
+		CloudVisionRequest request;
+		request.id = mNextId++;
+		request.future = submission.promise.get_future().share();
+		submission.response = make_shared<CloudVisionResponse>();
+		submission.response->id = request.id;
+		submission.response->submitTime = ofGetElapsedTimeMicros();
+		submission.response->features = submission.featureMask;
+		submission.state = make_shared<RequestState>();
+		request.state = submission.state;
+		return request;
+	}
+
+	void CloudVision::enqueue(BoundedQueue<Submission>& queue, Submission&& submission)
+	{
+		submission.queuedTime = ofGetElapsedTimeMicros();
+		std::vector<Submission> dropped;
+		if (!queue.push(std::move(submission), dropped))
+		{
+			// push() leaves the submission alone when it refuses it
+			fail(submission, REQUEST_DROPPED, "submission queue full");
+			dropped.emplace_back(std::move(submission));
+		}
+		for (auto& it : dropped)
+		{
+			if (it.response->status == REQUEST_OK)
+				fail(it, REQUEST_DROPPED, "pushed out of the submission queue");
+		}
+		if (!dropped.empty())
+			deliver(dropped);
 	}
 
 	std::shared_ptr<CloudVisionResponse> CloudVision::getResult()
 	{
+		std::unique_lock<std::mutex> lck(mutex);
 		return mResponse;
 	}
 
-	void CloudVision::stop()
+	std::vector<std::shared_ptr<CloudVisionResponse>> CloudVision::getResults()
 	{
 		std::unique_lock<std::mutex> lck(mutex);
-		stopThread();
-		condition.notify_all();
+		std::vector<std::shared_ptr<CloudVisionResponse>> results(mResults.begin(), mResults.end());
+		mResults.clear();
+		return results;
 	}
 
-	void CloudVision::threadedFunction() 
+	void CloudVision::stop()
+	{
+		mRunning = false;
+		pixelQueue.close();
+		mDownloadQueue.close();
+		mEncodedQueue.close();
+		if (mScheduler)
+			mScheduler->close();
+	}
+
+	size_t CloudVision::getQueueSize() const
 	{
-		while (isThreadRunning())
+		return pixelQueue.size();
+	}
+
+	std::vector<StageStats> CloudVision::getStageStats() const
+	{
+		std::vector<StageStats> stats;
+		if (mSettings.urlMode == URL_DOWNLOAD)
+			stats.push_back(mDownloadStage.getStats("download", mSettings.numDownloaders, mDownloadQueue.size()));
+		stats.push_back(mEncodeStage.getStats("encode", mSettings.numEncoders, pixelQueue.size()));
+		stats.push_back(mRequestStage.getStats("request", mSettings.numWorkers, mScheduler ? mScheduler->size() : mEncodedQueue.size()));
+		return stats;
+	}
+
+	uint64_t CloudVision::getDroppedCount() const
+	{
+		return pixelQueue.getDropCount() + mDownloadQueue.getDropCount();
+	}
+
+	MetricsSnapshot CloudVision::getMetrics() const
+	{
+		MetricsSnapshot snapshot;
+		if (mMetrics)
+			mMetrics->snapshot(snapshot);
+		snapshot.counters.emplace_back("retries", mRetries);
+		snapshot.counters.emplace_back("hedges", mHedges);
+		snapshot.counters.emplace_back("dropped_images", getDroppedCount());
+		snapshot.counters.emplace_back("suppressed_frames", mSuppressed);
+		if (mCache)
 		{
-			if (!mURL.empty())
+			CacheStats cache = mCache->getStats();
+			snapshot.counters.emplace_back("cache_hits", cache.memoryHits + cache.diskHits);
+			snapshot.counters.emplace_back("cache_misses", cache.misses);
+		}
+		snapshot.gauges.emplace_back("download_queue_size", (double)mDownloadQueue.size());
+		snapshot.gauges.emplace_back("submission_queue_size", (double)pixelQueue.size());
+		snapshot.gauges.emplace_back("request_queue_size", (double)(mScheduler ? mScheduler->size() : mEncodedQueue.size()));
+		snapshot.gauges.emplace_back("rate_fraction", mRateController.getRateFraction());
+		snapshot.stages = getStageStats();
+		return snapshot;
+	}
+
+	void CloudVision::downloadFunction()
+	{
+		while (mRunning)
+		{
+			std::vector<Submission> batch;
+			if (!mDownloadQueue.popBatch(batch, 1))
+				break;
+			for (auto& submission : batch)
 			{
-				auto& res = ofLoadURL(mURL);
-				ofImage img;
-				if (img.load(res.data))
+				uint64_t start = ofGetElapsedTimeMicros();
+				record(PHASE_QUEUE_WAIT, start - submission.queuedTime);
+				bool loaded = false;
+				if (!expire(submission, start))
+				{
+					ofLogVerbose("CloudVision") << "downloading " << submission.url;
+					auto res = ofLoadURL(submission.url);
+					loaded = ofLoadImage(submission.pixels, res.data);
+					mDownloadStage.add(ofGetElapsedTimeMicros() - start);
+					if (!loaded)
+						fail(submission, REQUEST_DOWNLOAD_FAILED, "could not load " + submission.url);
+				}
+				if (!loaded)
 				{
-					printf("[Cloud Vision] get image from %s\n", mURL.c_str());
-					pushPixels(img.getPixels());
+					std::vector<Submission> failed;
+					failed.emplace_back(std::move(submission));
+					deliver(failed);
+					continue;
 				}
-				mURL = "";
+				enqueue(pixelQueue, std::move(submission));
 			}
+		}
+	}
 
-			if (pixelQueue.size() == 0)
-				continue;
-
-			// check img size
-			size_t img_width, img_height;
-			if (pixelQueue.front().getWidth() > 640 || pixelQueue.front().getHeight() > 480)
+	void CloudVision::encodeFunction()
+	{
+		ImageEncoder encoder(mSettings.encoder);
+		std::vector<ofBuffer> spent;
+		while (mRunning)
+		{
+			std::vector<Submission> batch;
+			if (!pixelQueue.popBatch(batch, 1))
+				break;
+			for (auto& submission : batch)
 			{
-				float w = 640;
-				float h = (float)pixelQueue.front().getHeight() * w / pixelQueue.front().getWidth();
-				if (h > 480)
+				uint64_t start = ofGetElapsedTimeMicros();
+				// one buffer the request stage is done with for every image taken
+				ofBuffer buffer;
+				if (mSpentBuffers.tryPop(buffer))
 				{
-					h = 480;
-					w = (float)pixelQueue.front().getWidth() * h / pixelQueue.front().getHeight();
+					spent.emplace_back(std::move(buffer));
+					encoder.recycle(spent);
 				}
-				ofPixels dst;
-				dst.allocate(w, h, OF_IMAGE_COLOR);
-				pixelQueue.front().resizeTo(dst, OF_INTERPOLATE_BICUBIC);
-				std::swap(pixelQueue.front(), dst);
+				record(PHASE_QUEUE_WAIT, start - submission.queuedTime);
+				bool send = !expire(submission, start) && prepareImage(encoder, submission);
+				mEncodeStage.add(ofGetElapsedTimeMicros() - start);
+
+				if (send)
+				{
+					// waits while every worker is busy, which holds back this stage in turn;
+					// the push only moves the submission when it succeeds
+					if (schedule(std::move(submission)))
+						continue;
+					fail(submission, REQUEST_DROPPED, "stopped");
+				}
+				std::vector<Submission> finished;
+				finished.emplace_back(std::move(submission));
+				deliver(finished);
 			}
-			img_width = pixelQueue.front().getWidth();
-			img_height = pixelQueue.front().getHeight();
+		}
+	}
+
+	bool CloudVision::schedule(Submission&& submission)
+	{
+		submission.queuedTime = ofGetElapsedTimeMicros();
+		if (mScheduler)
+		{
+			Priority priority = submission.priority;
+			return mScheduler->push(std::move(submission), priority);
+		}
+		return mEncodedQueue.push(std::move(submission));
+	}
+
+	bool CloudVision::prepareImage(ImageEncoder& encoder, Submission& submission)
+	{
+		if (submission.remote)
+			return true;
 
-			mResponse.reset();
+		auto& pixels = submission.pixels;
+		size_t width, height;
+		fitSize(pixels.getWidth(), pixels.getHeight(), mSettings.maxImageWidth, mSettings.maxImageHeight, width, height);
+		if (width != pixels.getWidth() || height != pixels.getHeight())
+		{
+			uint64_t start = ofGetElapsedTimeMicros();
+			ofPixels dst;
+			// same channel order, the encoder needs to know about BGR(A)
+			dst.allocate(width, height, pixels.getPixelFormat());
+			downscale(pixels, dst, mSettings.resizeThreads);
+			std::swap(pixels, dst);
+			record(PHASE_RESIZE, ofGetElapsedTimeMicros() - start);
+		}
+		auto& res = *submission.response;
+		res.width = pixels.getWidth();
+		res.height = pixels.getHeight();
+
+		uint64_t encodeStart = ofGetElapsedTimeMicros();
+		submission.image = encoder.getBuffer();
+		bool encoded = encoder.encode(pixels, submission.image);
+		record(PHASE_ENCODE, ofGetElapsedTimeMicros() - encodeStart);
+		// the pixels are not needed anymore once encoded
+		pixels.clear();
+		if (!encoded)
+		{
+			fail(submission, REQUEST_FAILED, "could not encode the image");
+			return false;
+		}
+		res.payloadBytes = submission.image.size();
 
-			ofBuffer buffer;
+		if (mCache)
+		{
+			submission.cacheKey = ResultCache::makeKey(submission.image, *submission.features);
+			auto cached = mCache->find(submission.cacheKey);
+			if (cached)
 			{
-				std::unique_lock<std::mutex> lck(mutex);
-				ofSaveImage(pixelQueue.front(), buffer);
-				pixelQueue.pop_front();
+				copyResult(*cached, res);
+				res.width = width;
+				res.height = height;
+				res.cacheHit = true;
+				return false;
 			}
-			string img_encoded = toBase64(buffer);
-			
-			map<string, size_t> types;
-			types["LABEL_DETECTION"] = 3;
-			types["TEXT_DETECTION"] = 3;
-			types["FACE_DETECTION"] = 3;
-			types["LANDMARK_DETECTION"] = 3;
-			types["LOGO_DETECTION"] = 3;
-#if 1
-			string json_string = R"({"requests":[{"image":{"content":")" + img_encoded;
-			json_string += ofVAArgsToString(R"("},"features":[)");
-			for (auto& it = types.begin(); it != types.end();)
+		}
+		return true;
+	}
+
+	void CloudVision::threadedFunction() 
+	{
+		std::vector<ofBuffer> images;
+		while (mRunning)
+		{
+			std::vector<Submission> batch;
+			auto linger = std::chrono::milliseconds(mSettings.maxBatchLingerMillis);
+			bool popped = mScheduler ? mScheduler->popBatch(batch, mSettings.maxBatchSize, linger)
+				: mEncodedQueue.popBatch(batch, mSettings.maxBatchSize, linger);
+			if (!popped)
+				break;
+			uint64_t start = ofGetElapsedTimeMicros();
+
+			// whatever was cancelled or timed out while queued is not sent
+			std::vector<Submission> expired;
+			for (size_t i = 0; i < batch.size();)
 			{
-				json_string += ofVAArgsToString(R"({"type":"%s","maxResults":%u})", it->first.c_str(), it->second);
-				it++;
-				if (it != types.end())
-					json_string += ",";
+				if (expire(batch[i], start))
+				{
+					expired.emplace_back(std::move(batch[i]));
+					batch.erase(batch.begin() + i);
+				}
+				else
+				{
+					i++;
+				}
 			}
-			json_string += ofVAArgsToString(R"(]}]})");
-#else
-			string json_string = 
-R"({
-	"requests":[
-		{
-			"image":{
-				"content":")" + img_encoded + R"(")" + 
-R"(
-			},
-			"features":[)";
-			for (auto& it = types.begin(); it != types.end();)
+			if (!expired.empty())
+				deliver(expired);
+			if (batch.empty())
+				continue;
+
+			// cancel() reaches the request through the states from here on, the
+			// earliest deadline of the batch bounds all of its attempts
+			auto inFlight = make_shared<InFlightRequest>(batch.size());
+			uint64_t deadline = 0;
+			for (auto& submission : batch)
 			{
-				json_string += ofVAArgsToString(
-R"(
-				{
-					"type":"%s",
-					"maxResults":%u
-				})", it->first.c_str(), it->second);
-				it++;
-				if (it != types.end())
-					json_string += ",";
+				std::unique_lock<std::mutex> lck(submission.state->mutex);
+				submission.state->inFlight = inFlight;
+				if (submission.state->cancelled)
+					inFlight->cancelImage();
+				if (submission.deadline && (deadline == 0 || submission.deadline < deadline))
+					deadline = submission.deadline;
 			}
-			json_string += ofVAArgsToString(
-R"(
-			]
-		}
-	]
-})");
-#endif
-			ofBufferToFile("request.json", ofBuffer(json_string));
 
+			for (auto& submission : batch)
+				record(PHASE_QUEUE_WAIT, start - submission.queuedTime);
+			RequestBody body = buildRequest(batch);
+			record(PHASE_BASE64, ofGetElapsedTimeMicros() - start);
+			string dumpExtension = mTransport->isBinary() ? ".pb" : ".json";
+			if (mSettings.dumpFiles)
+				ofBufferToFile("request" + dumpExtension, ofBuffer(body.toString()));
+
+			std::vector<CloudVisionResponse*> responses;
+			size_t maxResults = 0;
+			for (auto& submission : batch)
+			{
+				responses.push_back(submission.response.get());
+				maxResults = std::max(maxResults, submission.maxResults);
+			}
 
-			string url = GOOGLE_VISION_API + "images:annotate";
-			url += ofVAArgsToString("?key=%s", GOOGLE_BROWSER_KEY.c_str());
-			auto& response = postData(url, ofBuffer(json_string), "application/json");
-			printf("[ Google Cloud Vision ]\nstatus: %i\nerror: %s\n", response.status, response.error.c_str());
-			ofBufferToFile("result.json", response.data);
+			// parse straight off the socket unless the raw body is wanted as well, or
+			// hedged attempts might both be reading one
+			bool keepBody = mSettings.dumpFiles || (mTrace && mSettings.trace.recordResponses) || mSettings.retry.hedge;
+			bool parsed = false;
+			ResponseHandler parse = [&](ofHttpResponse& response, std::istream& stream)
+			{
+				uint64_t parseStart = ofGetElapsedTimeMicros();
+				for (auto res : responses)
+					res->httpStatus = response.status;
+				mTransport->parseResponse(stream, response, responses, maxResults);
+				parsed = true;
+				record(PHASE_PARSE, ofGetElapsedTimeMicros() - parseStart);
+			};
 
+			bool reused = false;
+			size_t attempts = 0;
+			uint64_t sendTime = ofGetSystemTimeMicros();
+			auto response = send(body, *inFlight, deadline, reused, attempts, keepBody ? ResponseHandler() : parse);
+			uint64_t latency = ofGetSystemTimeMicros() - sendTime;
+			ofLogVerbose("CloudVision") << "status " << response.status << " " << response.error << ", " << batch.size() << " images, "
+				<< attempts << " attempts, " << (reused ? "reused" : "new") << " connection";
+			if (mSettings.dumpFiles)
+				ofBufferToFile("result" + dumpExtension, response.data);
+
+			for (auto res : responses)
+			{
+				res->connectionReused = reused;
+				res->attempts = attempts;
+			}
+			if (!parsed)
+			{
+				MemoryBuffer buffer(response.data.getData(), response.data.size());
+				std::istream in(&buffer);
+				parse(response, in);
+			}
 
-			auto getVertices = [](const ofJson& json, vector<ofVec2f>& container) 
+			uint64_t now = ofGetElapsedTimeMicros();
+			for (auto& submission : batch)
 			{
-				for (auto& vt : json["vertices"])
 				{
-					float x = vt.value("x", 0.0f);
-					float y = vt.value("y", 0.0f);
-					container.emplace_back(x, y);
+					std::unique_lock<std::mutex> lck(submission.state->mutex);
+					submission.state->inFlight.reset();
 				}
-			};
+				if (submission.state->cancelled)
+					fail(submission, REQUEST_CANCELLED, "cancelled");
+				else if (submission.response->status != REQUEST_OK && submission.deadline && now >= submission.deadline)
+					fail(submission, REQUEST_TIMED_OUT, "deadline passed: " + submission.response->error);
+			}
 
-			auto getLocations = [](const ofJson& json, vector<latLng>& container)
+			if (mTrace)
 			{
-				if (json.find("locations") == json.end())
-					return;
-				for (auto& vt : json["locations"])
-				{
-					latLng ll;
-					ll.latitude = vt["latLng"].value("latitude", 0.0);
-					ll.longitude = vt["latLng"].value("longitude", 0.0);
-					container.emplace_back(ll);
-				}
-			};
+				TraceEntry entry;
+				entry.timestamp = sendTime;
+				entry.latencyMicros = latency;
+				entry.httpStatus = response.status;
+				entry.connectionReused = reused;
+				entry.requestBytes = body.size();
+				for (auto& submission : batch)
+					entry.ids.push_back(submission.response->id);
+				// replay() reads json, binary answers are not kept
+				if (mSettings.trace.recordResponses && !mTransport->isBinary())
+					entry.response = response.data.getText();
+				mTrace->record(std::move(entry));
+			}
 
-			auto getLandmarks = [](const ofJson& json, vector<Landmark>& container)
+			// the encoders reuse the image buffers, as many as fit
+			body.takeImages(images);
+			for (auto& image : images)
 			{
-				for (auto& landmark : json["landmarks"])
-				{
-					Landmark lm;
-					lm.type = landmark.value("type", "");
-					float x = landmark["position"].value("x", 0.0f);
-					float y = landmark["position"].value("y", 0.0f);
-					float z = landmark["position"].value("z", 0.0f);
-					lm.position.set(x, y, z);
-					container.emplace_back(lm);
-				}
-			};
+				if (!mSpentBuffers.tryPush(std::move(image)))
+					break;
+			}
+			images.clear();
 
-			auto& documrnt = ofJson::parse(response.data.getText());
-			for (auto& jsonResponse : documrnt["responses"])
+			size_t failed = 0;
+			for (auto& submission : batch)
 			{
-				CloudVisionResponse res;
-				res.width = img_width;
-				res.height = img_height;
-				for (auto& jsonLabel : jsonResponse["labelAnnotations"])
-				{
-					LabelAnnotation label;
-					label.mid = jsonLabel.value("mid", "");
-					label.description = jsonLabel.value("description", "");
-					label.score = jsonLabel.value("score", 0.0f);
-					res.labelAnnotations.emplace_back(label);
-				}
-				for (auto& jsonText : jsonResponse["textAnnotations"])
-				{
-					TextAnnotation text;
-					text.locale = jsonText.value("locale", "");
-					text.description = jsonText.value("description", "");
-					getVertices(jsonText["boundingPoly"], text.boundingPoly.vertices);
-					res.textAnnotations.emplace_back(text);
-				}
-				for (auto& jsonLogo : jsonResponse["logoAnnotations"])
-				{
-					LogoAnnotation logo;
-					logo.mid = jsonLogo.value("mid", "");
-					logo.description = jsonLogo.value("description", "");
-					logo.score = jsonLogo.value("score", 0.0f);
-					getVertices(jsonLogo["boundingPoly"], logo.boundingPoly.vertices);
-					res.logoAnnotations.emplace_back(logo);
-				}
-				for (auto& jsonLandmark : jsonResponse["landmarkAnnotations"])
-				{
-					LandmarkAnnotation landmark;
-					landmark.mid = jsonLandmark.value("mid", "");
-					landmark.description = jsonLandmark.value("description", "");
-					landmark.score = jsonLandmark.value("score", 0.0f);
-					getVertices(jsonLandmark["boundingPoly"], landmark.boundingPoly.vertices);
-					getLocations(jsonLandmark, landmark.locations);
-					res.landmarkAnnotations.emplace_back(landmark);
-				}
-				for (auto& jsonFace : jsonResponse["faceAnnotations"])
-				{
-					FaceAnnotation face;
-					getVertices(jsonFace["boundingPoly"], face.boundingPoly.vertices);
-					getVertices(jsonFace["fdBoundingPoly"], face.fdBoundingPoly.vertices);
-					getLandmarks(jsonFace, face.landmarks);
-					face.rollAngle = jsonFace.value("rollAngle", 0.0f);
-					face.panAngle = jsonFace.value("panAngle", 0.0f);
-					face.tiltAngle = jsonFace.value("tiltAngle", 0.0f);
-					face.detectionConfidence = jsonFace.value("detectionConfidence", 0.0f);
-					face.landmarkingConfidence = jsonFace.value("landmarkingConfidence", 0.0f);
-					face.joyLikelihood = jsonFace.value("joyLikelihood", "");
-					face.sorrowLikelihood = jsonFace.value("sorrowLikelihood", "");
-					face.angerLikelihood = jsonFace.value("angerLikelihood", "");
-					face.surpriseLikelihood = jsonFace.value("surpriseLikelihood", "");
-					face.underExposedLikelihood = jsonFace.value("underExposedLikelihood", "");
-					face.blurredLikelihood = jsonFace.value("blurredLikelihood", "");
-					face.headwearLikelihood = jsonFace.value("headwearLikelihood", "");
-					res.faceAnnotations.emplace_back(face);
-				}
-				mResponse = make_shared<CloudVisionResponse>(res);
+				if (submission.response->status != REQUEST_OK)
+					failed++;
+				else if (mCache && !submission.remote)
+					mCache->insert(submission.cacheKey, make_shared<CloudVisionResponse>(*submission.response));
 			}
+			count(COUNTER_IMAGES, batch.size());
+			count(COUNTER_FAILED_IMAGES, failed);
+			deliver(batch);
+			mRequestStage.add(ofGetElapsedTimeMicros() - start, batch.size());
 		}
 	}
 
-	std::string CloudVision::toBase64(const std::string &source)
+	void CloudVision::parseResponses(const ofHttpResponse& response, const std::vector<CloudVisionResponse*>& responses, size_t expectedResults)
 	{
-		std::istringstream in(source);
-		std::ostringstream out;
-		Poco::Base64Encoder b64out(out);
+		for (auto res : responses)
+			res->httpStatus = response.status;
+		MemoryBuffer buffer(response.data.getData(), response.data.size());
+		std::istream in(&buffer);
+		parseAnnotateResponse(in, response.status, response.error, responses, expectedResults);
+	}
 
-		std::copy(std::istreambuf_iterator<char>(in),
-			std::istreambuf_iterator<char>(),
-			std::ostreambuf_iterator<char>(b64out));
-		b64out.close(); // always call this at the end!
+	size_t CloudVision::replay(const string& file, CloudVisionCallback callback)
+	{
+		size_t count = 0;
+		TraceRecorder::read(file, [&](const TraceEntry& entry)
+		{
+			ofHttpResponse response;
+			response.status = entry.httpStatus;
+			response.data.set(entry.response.data(), entry.response.size());
 
-		return out.str();
+			std::vector<CloudVisionResponse> results(std::max<size_t>(entry.ids.size(), 1));
+			std::vector<CloudVisionResponse*> responses;
+			for (size_t i = 0; i < results.size(); i++)
+			{
+				results[i].id = i < entry.ids.size() ? entry.ids[i] : 0;
+				results[i].connectionReused = entry.connectionReused;
+				results[i].submitTime = entry.timestamp;
+				results[i].completeTime = entry.timestamp + entry.latencyMicros;
+				responses.push_back(&results[i]);
+			}
+			parseResponses(response, responses);
+			for (auto& res : results)
+			{
+				if (callback)
+					callback(res);
+				count++;
+			}
+		});
+		return count;
 	}
 
-	ofHttpResponse CloudVision::postData(string url, const ofBuffer& data, string contentType)
+	void CloudVision::fail(Submission& submission, RequestStatus status, const string& error)
 	{
-		ofHttpResponse response;
-		try {
-			URI uri(url.c_str());
-			std::string path(uri.getPathAndQuery());
-			if (path.empty()) path = "/";
+		submission.response->status = status;
+		submission.response->error = error;
+	}
 
-			HTTPRequest req(HTTPRequest::HTTP_POST, path, HTTPMessage::HTTP_1_1);
+	bool CloudVision::expire(Submission& submission, uint64_t now)
+	{
+		if (submission.state && submission.state->cancelled)
+		{
+			fail(submission, REQUEST_CANCELLED, "cancelled");
+			return true;
+		}
+		if (submission.deadline && now >= submission.deadline)
+		{
+			fail(submission, REQUEST_TIMED_OUT, "deadline passed before the request was sent");
+			return true;
+		}
+		return false;
+	}
 
-			if (contentType != "") {
-				req.setContentType(contentType);
-			}
+	void CloudVision::copyResult(const CloudVisionResponse& from, CloudVisionResponse& to)
+	{
+		to.status = from.status;
+		to.httpStatus = from.httpStatus;
+		to.error = from.error;
+		to.width = from.width;
+		to.height = from.height;
+		to.arena = from.arena;
+		to.labelAnnotations = from.labelAnnotations;
+		to.textAnnotations = from.textAnnotations;
+		to.logoAnnotations = from.logoAnnotations;
+		to.landmarkAnnotations = from.landmarkAnnotations;
+		to.faceAnnotations = from.faceAnnotations;
+	}
 
-			req.setContentLength(data.size());
-
-			HTTPResponse res;
-			shared_ptr<HTTPSession> session;
-			istream * rs;
-			if (uri.getScheme() == "https") {
-				HTTPSClientSession * httpsSession = new HTTPSClientSession(uri.getHost(), uri.getPort());//,context);
-				httpsSession->setTimeout(Poco::Timespan(20, 0));
-				httpsSession->sendRequest(req) << data;
-				rs = &httpsSession->receiveResponse(res);
-				session = shared_ptr<HTTPSession>(httpsSession);
+	void CloudVision::takeDuplicates(const std::vector<Submission>& finished, std::vector<Submission>& duplicates)
+	{
+		std::unique_lock<std::mutex> lck(mGateMutex);
+		for (auto& submission : finished)
+		{
+			auto& res = submission.response;
+			if (mGateValid && res->id == mGateId)
+			{
+				// after a failure the next frame is sent whatever it looks like
+				if (res->status == REQUEST_OK)
+					mGateResult = res;
+				else
+					mGateValid = false;
 			}
-			else {
-				HTTPClientSession * httpSession = new HTTPClientSession(uri.getHost(), uri.getPort());
-				httpSession->setTimeout(Poco::Timespan(20, 0));
-				httpSession->sendRequest(req) << data;
-				rs = &httpSession->receiveResponse(res);
-				session = shared_ptr<HTTPSession>(httpSession);
+
+			auto it = mDuplicates.find(res->id);
+			if (it == mDuplicates.end())
+				continue;
+			for (auto& duplicate : it->second)
+			{
+				copyResult(*res, *duplicate.response);
+				duplicates.emplace_back(std::move(duplicate));
 			}
+			mDuplicates.erase(it);
+		}
+	}
+
+	void CloudVision::deliver(std::vector<Submission>& finished)
+	{
+		std::vector<Submission> duplicates;
+		if (mSettings.frameGate.enabled)
+			takeDuplicates(finished, duplicates);
 
-			response.status = res.getStatus();
-			response.data.set(*rs);
-			response.error = res.getReason();
+		uint64_t now = ofGetElapsedTimeMicros();
+		for (auto& submission : finished)
+		{
+			submission.response->completeTime = now;
+			record(PHASE_TOTAL, now - submission.response->submitTime);
+			submission.promise.set_value(*submission.response);
+			if (mArchive && (submission.response->status == REQUEST_OK || mSettings.archive.failures))
+				mArchive->append(*submission.response);
+		}
+
+		std::vector<Submission> ready;
+		{
+			std::unique_lock<std::mutex> lck(mutex);
+			if (mSettings.delivery == DELIVERY_AS_COMPLETED)
+			{
+				for (auto& submission : finished)
+					ready.emplace_back(std::move(submission));
+			}
+			else
+			{
+				for (auto& submission : finished)
+				{
+					size_t id = submission.response->id;
+					mFinished.emplace(id, std::move(submission));
+				}
+				// release the longest run of consecutive ids starting at the next one expected
+				auto it = mFinished.begin();
+				while (it != mFinished.end() && it->first == mNextDeliveryId)
+				{
+					ready.emplace_back(std::move(it->second));
+					mNextDeliveryId++;
+					it = mFinished.erase(it);
+				}
+			}
 
-			if (response.status >= 300 && response.status<400) {
-				Poco::URI uri(req.getURI());
-				uri.resolve(res.get("Location"));
+			for (auto& submission : ready)
+			{
+				mResults.emplace_back(submission.response);
+				if (submission.response->status == REQUEST_OK)
+					mResponse = submission.response;
 			}
 		}
-		catch (Exception& exc) {
 
-			ofLogError("CloudVision") << "CloudVision error postData --";
-			
-			// for now print error, need to broadcast a response
-			ofLogError("CloudVision") << exc.displayText();
-			response.status = -1;
-			response.error = exc.displayText();
+		for (auto& submission : ready)
+		{
+			if (submission.callback)
+				submission.callback(*submission.response);
+		}
+
+		if (!duplicates.empty())
+			deliver(duplicates);
+	}
+
+	RequestBody CloudVision::buildRequest(std::vector<Submission>& batch)
+	{
+		std::vector<AnnotateImage> images(batch.size());
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			if (batch[i].remote)
+				images[i].uri = batch[i].url;
+			else
+				images[i].content = std::move(batch[i].image);
+			images[i].features = batch[i].features;
+		}
+		return mTransport->buildRequest(images);
+	}
+
+	ofHttpResponse CloudVision::send(const RequestBody& body, InFlightRequest& inFlight, uint64_t deadline,
+		bool& connectionReused, size_t& attempts, ResponseHandler handler)
+	{
+		auto& retry = mSettings.retry;
+		ofHttpResponse response;
+		// a retryable answer is only parsed when no further attempt follows it
+		bool last = false;
+		ResponseHandler finalHandler;
+		if (handler)
+		{
+			finalHandler = [&](ofHttpResponse& res, std::istream& stream)
+			{
+				if (last || !isRetryable(res.status))
+					handler(res, stream);
+			};
+		}
+
+		for (size_t n = 0;; n++)
+		{
+			uint64_t timeout = 0;
+			if (deadline)
+			{
+				uint64_t now = ofGetElapsedTimeMicros();
+				if (now >= deadline)
+				{
+					response.status = -1;
+					response.error = "deadline exceeded";
+					break;
+				}
+				timeout = (deadline - now + 999) / 1000;
+			}
 
+			last = n >= retry.maxRetries;
+			response = sendAttempt(body, inFlight, timeout, connectionReused, attempts, finalHandler);
+			if (last || !isRetryable(response.status) || inFlight.isAborted())
+				break;
+
+			// a Retry-After from the service outranks the backoff
+			uint64_t backoff = std::max(getBackoffMillis(retry, n), mRateController.getPauseMicros(ofGetElapsedTimeMicros()) / 1000);
+			if (deadline && ofGetElapsedTimeMicros() + backoff * 1000 >= deadline)
+				break;
+			ofLogVerbose("CloudVision") << "status " << response.status << ", retrying in " << backoff << "ms";
+			mRetries++;
+			if (!inFlight.sleep(backoff))
+				break;
+			if (mSettings.rateLimit.enabled)
+				mRateController.charge(inFlight.getImageCount(), ofGetElapsedTimeMicros());
 		}
 		return response;
 	}
 
-	
+	ofHttpResponse CloudVision::sendAttempt(const RequestBody& body, InFlightRequest& inFlight, uint64_t timeoutMillis,
+		bool& connectionReused, size_t& attempts, ResponseHandler handler)
+	{
+		auto& retry = mSettings.retry;
+		uint64_t hedgeAfter = retry.hedge ? mLatency.getPercentile(retry.hedgePercentile, retry.hedgeMinSamples) : 0;
+		if (hedgeAfter == 0)
+		{
+			auto abort = inFlight.addAttempt();
+			attempts++;
+			uint64_t start = ofGetElapsedTimeMicros();
+			auto response = mTransport->post(body, &connectionReused, handler, abort.get(), timeoutMillis);
+			if (response.status == 200)
+				mLatency.add(ofGetElapsedTimeMicros() - start);
+			return response;
+		}
+
+		// the first attempt gets hedgeAfter to answer before a second copy races it, the first
+		// answer that is not retryable wins (or the last one) and the other attempt is aborted
+		struct Race
+		{
+			std::mutex mutex;
+			std::condition_variable finished;
+			ofHttpResponse responses[2];
+			bool reused[2] = { false, false };
+			int launched = 1;
+			int done = 0;
+			int winner = -1;
+		} race;
+		std::shared_ptr<AbortHandle> aborts[2];
+		auto run = [&](int i)
+		{
+			bool reused = false;
+			uint64_t start = ofGetElapsedTimeMicros();
+			auto response = mTransport->post(body, &reused, nullptr, aborts[i].get(), timeoutMillis);
+			if (response.status == 200)
+				mLatency.add(ofGetElapsedTimeMicros() - start);
+
+			std::unique_lock<std::mutex> lck(race.mutex);
+			race.responses[i] = std::move(response);
+			race.reused[i] = reused;
+			race.done++;
+			if (race.winner < 0 && (!isRetryable(race.responses[i].status) || race.done == race.launched))
+				race.winner = i;
+			race.finished.notify_all();
+		};
+
+		std::future<void> runs[2];
+		aborts[0] = inFlight.addAttempt();
+		attempts++;
+		runs[0] = std::async(std::launch::async, run, 0);
+
+		bool hedge = false;
+		{
+			std::unique_lock<std::mutex> lck(race.mutex);
+			if (!race.finished.wait_for(lck, std::chrono::microseconds(hedgeAfter), [&] { return race.winner >= 0; }) && !inFlight.isAborted())
+			{
+				race.launched = 2;
+				hedge = true;
+			}
+		}
+		if (hedge)
+		{
+			mHedges++;
+			if (mSettings.rateLimit.enabled)
+				mRateController.charge(inFlight.getImageCount(), ofGetElapsedTimeMicros());
+			aborts[1] = inFlight.addAttempt();
+			attempts++;
+			runs[1] = std::async(std::launch::async, run, 1);
+		}
+
+		int winner;
+		{
+			std::unique_lock<std::mutex> lck(race.mutex);
+			race.finished.wait(lck, [&] { return race.winner >= 0; });
+			winner = race.winner;
+		}
+		if (hedge)
+			aborts[1 - winner]->abort();
+		for (auto& it : runs)
+		{
+			if (it.valid())
+				it.wait();
+		}
+
+		connectionReused = race.reused[winner];
+		auto& response = race.responses[winner];
+		if (handler)
+		{
+			MemoryBuffer buffer(response.data.getData(), response.data.size());
+			std::istream in(&buffer);
+			handler(response, in);
+		}
+		return std::move(response);
+	}
 }
\ No newline at end of file
@@ -1,7 +1,28 @@
+#pragma once
+
 #include "ofMain.h"
+#include "GoogleCloudVisionArchive.h"
+#include "GoogleCloudVisionArena.h"
+#include "GoogleCloudVisionCache.h"
+#include "GoogleCloudVisionEncoder.h"
+#include "GoogleCloudVisionFeatures.h"
+#include "GoogleCloudVisionFrameGate.h"
+#include "GoogleCloudVisionMetrics.h"
+#include "GoogleCloudVisionQueue.h"
+#include "GoogleCloudVisionResize.h"
+#include "GoogleCloudVisionRequestBody.h"
+#include "GoogleCloudVisionRetry.h"
+#include "GoogleCloudVisionScheduler.h"
+#include "GoogleCloudVisionSessionPool.h"
+#include "GoogleCloudVisionStage.h"
+#include "GoogleCloudVisionTrace.h"
+#include "GoogleCloudVisionTransport.h"
 
 namespace google
 {
+	// strings and geometry of the annotations live in the response's arena (or the global
+	// string pool) and are only viewed from here, so annotations are small and trivially copyable
+
 	struct latLng
 	{
 		double latitude;
@@ -10,74 +31,133 @@ namespace google
 
 	struct Landmark
 	{
-		string type;
+		StringRef type;
 		ofVec3f position;
 	};
 
+	struct BoundingPoly
+	{
+		Span<ofVec2f> vertices;
+	};
+
+	enum Likelihood : uint8_t
+	{
+		LIKELIHOOD_UNKNOWN,
+		LIKELIHOOD_VERY_UNLIKELY,
+		LIKELIHOOD_UNLIKELY,
+		LIKELIHOOD_POSSIBLE,
+		LIKELIHOOD_LIKELY,
+		LIKELIHOOD_VERY_LIKELY
+	};
+
+	// the API's spelling, "VERY_LIKELY" etc.
+	const string& toString(Likelihood likelihood);
+	Likelihood toLikelihood(const string& name);
+
 	struct LabelAnnotation
 	{
-		string mid;
-		string description;
+		StringRef mid;
+		StringRef description;
 		float score;
 	};
 
 	struct TextAnnotation
 	{
-		string locale;
-		string description;
-		struct {
-			std::vector<ofVec2f> vertices;
-		} boundingPoly;
+		StringRef locale;
+		StringRef description;
+		BoundingPoly boundingPoly;
 	};
 
 	struct LogoAnnotation
 	{
-		string mid;
-		string description;
+		StringRef mid;
+		StringRef description;
 		float score;
-		struct {
-			std::vector<ofVec2f> vertices;
-		} boundingPoly;
+		BoundingPoly boundingPoly;
 	};
 
 	struct LandmarkAnnotation
 	{
-		string mid;
-		string description;
+		StringRef mid;
+		StringRef description;
 		float score;
-		struct {
-			std::vector<ofVec2f> vertices;
-		} boundingPoly;
-		std::vector<latLng> locations;
+		BoundingPoly boundingPoly;
+		Span<latLng> locations;
 	};
 
 	struct FaceAnnotation
 	{
-		struct {
-			std::vector<ofVec2f> vertices;
-		} boundingPoly;
-		struct {
-			std::vector<ofVec2f> vertices;
-		} fdBoundingPoly;
-		std::vector<Landmark> landmarks;
+		BoundingPoly boundingPoly;
+		BoundingPoly fdBoundingPoly;
+		Span<Landmark> landmarks;
 		float rollAngle;
 		float panAngle;
 		float tiltAngle;
 		float detectionConfidence;
 		float landmarkingConfidence;
-		string joyLikelihood;
-		string sorrowLikelihood;
-		string angerLikelihood;
-		string surpriseLikelihood;
-		string underExposedLikelihood;
-		string blurredLikelihood;
-		string headwearLikelihood;
+		Likelihood joy;
+		Likelihood sorrow;
+		Likelihood anger;
+		Likelihood surprise;
+		Likelihood underExposed;
+		Likelihood blurred;
+		Likelihood headwear;
+
+		const string& joyLikelihood() const { return toString(joy); }
+		const string& sorrowLikelihood() const { return toString(sorrow); }
+		const string& angerLikelihood() const { return toString(anger); }
+		const string& surpriseLikelihood() const { return toString(surprise); }
+		const string& underExposedLikelihood() const { return toString(underExposed); }
+		const string& blurredLikelihood() const { return toString(blurred); }
+		const string& headwearLikelihood() const { return toString(headwear); }
+	};
+
+	enum RequestStatus
+	{
+		REQUEST_OK,
+		// pushed out of the submission queue by its overflow policy
+		REQUEST_DROPPED,
+		// the image behind pushURL could not be downloaded or decoded
+		REQUEST_DOWNLOAD_FAILED,
+		// no usable HTTP response, see httpStatus and error
+		REQUEST_FAILED,
+		// the service answered this image with an error object
+		REQUEST_API_ERROR,
+		// the response body was not valid JSON
+		REQUEST_PARSE_FAILED,
+		// CloudVisionRequest::cancel() was called before the result was delivered
+		REQUEST_CANCELLED,
+		// not finished by its deadline, see RetrySettings::deadlineMillis
+		REQUEST_TIMED_OUT,
+		// the service kept answering 429, over quota
+		REQUEST_THROTTLED
 	};
 
 	struct CloudVisionResponse
 	{
+		size_t id = 0;
+		RequestStatus status = REQUEST_OK;
+		int httpStatus = 0;
+		string error;
+		// ofGetElapsedTimeMicros() when the image was pushed and when its response was complete
+		uint64_t submitTime = 0;
+		uint64_t completeTime = 0;
 		size_t width = 0;
 		size_t height = 0;
+		// size of the encoded image, before base64
+		size_t payloadBytes = 0;
+		// FEATURE_* mask that was requested, the other annotation vectors stay empty
+		uint32_t features = FEATURE_ALL;
+		// the request went out on a pooled keep-alive connection
+		bool connectionReused = false;
+		// HTTP requests sent for the batch this image was in, retries and hedges included
+		size_t attempts = 0;
+		// answered from the result cache without a request
+		bool cacheHit = false;
+		// id of the earlier frame whose result this is, when the frame gate suppressed it
+		size_t duplicateOf = 0;
+		// owns what the annotations below point to, shared by copies of the response
+		std::shared_ptr<ResponseArena> arena;
 		std::vector<LabelAnnotation> labelAnnotations;
 		std::vector<TextAnnotation> textAnnotations;
 		std::vector<LogoAnnotation> logoAnnotations;
@@ -86,34 +166,293 @@ namespace google
 	};
 
 
+	enum DeliveryOrder
+	{
+		// results are handed out in the order their images were pushed
+		DELIVERY_IN_ORDER,
+		// results are handed out as soon as their request finishes
+		DELIVERY_AS_COMPLETED
+	};
+
+	enum UrlMode
+	{
+		// pushURL() images are downloaded and decoded here, then resized and encoded like pushed pixels
+		URL_DOWNLOAD,
+		// the url is sent as image.source.imageUri and the service fetches the image itself
+		URL_PASS_THROUGH
+	};
+
+	struct CloudVisionSettings
+	{
+		// images go through up to three stages, each with its own threads: download (pushURL()
+		// in URL_DOWNLOAD mode, numDownloaders), encode (resize, encode and cache lookup,
+		// numEncoders) and request (upload, response and parse, numWorkers)
+		size_t numEncoders = 1;
+		// number of requests that may be in flight at the same time
+		size_t numWorkers = 1;
+		// order of getResults() when several requests are in flight
+		DeliveryOrder delivery = DELIVERY_IN_ORDER;
+		// images waiting for an encoder, pushes beyond that follow overflowPolicy
+		size_t maxQueueSize = 16;
+		OverflowPolicy overflowPolicy = OVERFLOW_DROP_OLDEST;
+		// up to this many queued images are sent together in one images:annotate call
+		size_t maxBatchSize = 1;
+		// how long the oldest queued image may wait for a batch to fill up, 0 sends right away
+		uint64_t maxBatchLingerMillis = 0;
+		UrlMode urlMode = URL_DOWNLOAD;
+		// images downloaded at the same time in URL_DOWNLOAD mode, separate from numWorkers
+		size_t numDownloaders = 2;
+		// urls waiting for a downloader, pushes beyond that follow overflowPolicy
+		size_t maxDownloadQueueSize = 16;
+		// larger images are shrunk to fit before they are encoded, keeping their aspect ratio
+		size_t maxImageWidth = 640;
+		size_t maxImageHeight = 480;
+		// threads each worker splits the rows of a downscale across, the worker included
+		size_t resizeThreads = 1;
+		// format and quality images are sent in, see EncoderSettings
+		EncoderSettings encoder;
+		// what is requested for images pushed without a FeatureSet of their own
+		FeatureSet features;
+		// REST (json) or gRPC (protobuf), see TransportType
+		TransportType transport = TRANSPORT_REST;
+		// base url of the API for REST, images:annotate is appended; http:// works for local mock servers
+		string endpoint = "https://vision.googleapis.com/v1/";
+		// where TRANSPORT_GRPC connects to, see GrpcSettings
+		GrpcSettings grpc;
+		// gzip request bodies and responses over REST, see CompressionSettings
+		CompressionSettings compression;
+		// keep-alive connections to the endpoint, see SessionPoolSettings
+		SessionPoolSettings connections;
+		// retries, deadlines and hedged requests, see RetrySettings
+		RetrySettings retry;
+		// client-side request and image budget with priorities, see RateLimitSettings
+		RateLimitSettings rateLimit;
+		// request/response trace written in the background, see TraceSettings
+		TraceSettings trace;
+		// results of identical images and features are reused, see CacheSettings; urls in
+		// URL_PASS_THROUGH mode are never cached, the image behind a url may change
+		CacheSettings cache;
+		// near-duplicate frames passed to pushPixels() reuse the previous result, see FrameGateSettings
+		FrameGateSettings frameGate;
+		// latency histograms per phase and an optional Prometheus endpoint, see MetricsSettings
+		MetricsSettings metrics;
+		// finished responses appended to an indexed binary archive, see ArchiveSettings
+		ArchiveSettings archive;
+		// write every request and response to request.json/result.json (.pb over gRPC), slow, debugging only
+		bool dumpFiles = false;
+	};
+
+
+	// runs on a worker thread, in the order chosen by CloudVisionSettings::delivery
+	typedef std::function<void(const CloudVisionResponse&)> CloudVisionCallback;
+
+	struct CloudVisionRequest
+	{
+		size_t id = 0;
+		// becomes ready when the request finishes, whatever its status
+		std::shared_future<CloudVisionResponse> future;
+		std::shared_ptr<RequestState> state;
+
+		// the request finishes with REQUEST_CANCELLED; if it is in flight already its
+		// connection is aborted once every image sent with it has been cancelled
+		void cancel()
+		{
+			if (state)
+				state->cancel();
+		}
+	};
+
+	// per push overrides of the CloudVisionSettings
+	struct RequestOptions
+	{
+		RequestOptions() {}
+		RequestOptions(const FeatureSet& features) : features(features), useFeatures(true) {}
+
+		FeatureSet features;
+		// false requests CloudVisionSettings::features
+		bool useFeatures = false;
+		// 0 uses RetrySettings::deadlineMillis
+		uint64_t deadlineMillis = 0;
+		// order in which the rate limiter lets queued images go, see RateLimitSettings
+		Priority priority = PRIORITY_NORMAL;
+	};
+
 	typedef std::shared_ptr<class CloudVision> CloudVisionRef;
 
-	class CloudVision : private ofThread
+	class CloudVision
 	{
 	public:
-		static CloudVisionRef create(string key)
+		static CloudVisionRef create(string key, const CloudVisionSettings& settings = CloudVisionSettings())
 		{
-			return CloudVisionRef(new CloudVision(key));
+			return CloudVisionRef(new CloudVision(key, settings));
 		}
 		~CloudVision();
-		void pushPixels(const ofPixels& pix);
-		void pushURL(const string& url);
+		CloudVisionRequest pushPixels(const ofPixels& pix, CloudVisionCallback callback = nullptr);
+		CloudVisionRequest pushURL(const string& url, CloudVisionCallback callback = nullptr);
+		// the same with features or a deadline other than the CloudVisionSettings, a FeatureSet converts
+		CloudVisionRequest pushPixels(const ofPixels& pix, const RequestOptions& options, CloudVisionCallback callback = nullptr);
+		CloudVisionRequest pushURL(const string& url, const RequestOptions& options, CloudVisionCallback callback = nullptr);
+		// the latest successful response
 		std::shared_ptr<CloudVisionResponse> getResult();
+		// all responses finished since the last call, failed ones included, ordered by CloudVisionSettings::delivery
+		std::vector<std::shared_ptr<CloudVisionResponse>> getResults();
 		void stop();
 
+		size_t getQueueSize() const;
+		size_t getDownloadQueueSize() const { return mDownloadQueue.size(); }
+		// per pipeline stage, in the order images go through them
+		std::vector<StageStats> getStageStats() const;
+		// counters, queue depths and stage stats, plus the phase histograms when CloudVisionSettings::metrics is enabled
+		MetricsSnapshot getMetrics() const;
+		// images dropped by the overflow policy so far
+		uint64_t getDroppedCount() const;
+		// frames answered with a previous result by the frame gate so far
+		uint64_t getSuppressedCount() const { return mSuppressed; }
+		// requests sent again after a retryable failure, and second copies sent by hedging
+		uint64_t getRetryCount() const { return mRetries; }
+		uint64_t getHedgeCount() const { return mHedges; }
+		// request and image budgets, adapted to 429s even when rate limiting is disabled
+		const RateController& getRateController() const { return mRateController; }
+
+		SessionPool& getSessionPool() { return mSessionPool; }
+		Transport& getTransport() { return *mTransport; }
+		// null unless CloudVisionSettings::trace is enabled
+		TraceRecorder* getTraceRecorder() { return mTrace.get(); }
+		// null unless CloudVisionSettings::cache is enabled
+		ResultCache* getCache() { return mCache.get(); }
+		// null unless CloudVisionSettings::archive is enabled
+		ArchiveWriter* getArchive() { return mArchive.get(); }
+
+		// feeds the responses recorded in a trace file through the response parser,
+		// callback gets every image response; returns how many there were
+		static size_t replay(const string& file, CloudVisionCallback callback);
+
 	protected:
-		CloudVision(string key);
+		struct Submission
+		{
+			ofPixels pixels;
+			// downloaded before it is queued for a worker, unless remote is set
+			string url;
+			// sent as image.source.imageUri without being downloaded
+			bool remote = false;
+			// the encoded image, from the encode stage on
+			ofBuffer image;
+			// filled in by the worker, handed out once the submission is finished
+			std::shared_ptr<CloudVisionResponse> response;
+			std::promise<CloudVisionResponse> promise;
+			CloudVisionCallback callback;
+			// the features as the transport encodes them, shared by every submission using the instance's features
+			std::shared_ptr<const string> features;
+			uint32_t featureMask = FEATURE_ALL;
+			size_t maxResults = 3;
+			ResultCache::Key cacheKey;
+			std::shared_ptr<RequestState> state;
+			// ofGetElapsedTimeMicros() by which it has to be finished, 0 for none
+			uint64_t deadline = 0;
+			Priority priority = PRIORITY_NORMAL;
+			// when it was last queued, for the queue wait metric
+			uint64_t queuedTime = 0;
+		};
+
+		CloudVision(string key, const CloudVisionSettings& settings);
+		// the request stage
 		void threadedFunction();
-		ofHttpResponse postData(string url, const ofBuffer& data, string contentType);
-		std::string toBase64(const std::string &source);
+		void downloadFunction();
+		void encodeFunction();
+		// resizes, encodes and looks up the image; false when the submission is finished already
+		bool prepareImage(ImageEncoder& encoder, Submission& submission);
+		CloudVisionRequest push(Submission&& submission);
+		// hands an encoded submission to the request stage, through the scheduler when rate limited
+		bool schedule(Submission&& submission);
+		// assigns the id, response and future of a new submission
+		CloudVisionRequest prepare(Submission& submission);
+		void enqueue(BoundedQueue<Submission>& queue, Submission&& submission);
+		// copies status and annotations of another image's response
+		static void copyResult(const CloudVisionResponse& from, CloudVisionResponse& to);
+		// moves the duplicates waiting for any of the finished frames to duplicates, with their results filled in
+		void takeDuplicates(const std::vector<Submission>& finished, std::vector<Submission>& duplicates);
+		static void fail(Submission& submission, RequestStatus status, const string& error);
+		void record(MetricPhase phase, uint64_t micros)
+		{
+			if (mMetrics)
+				mMetrics->record(phase, micros);
+		}
+		void count(MetricCounter counter, uint64_t value = 1)
+		{
+			if (mMetrics)
+				mMetrics->add(counter, value);
+		}
+		// fails a submission that was cancelled or is past its deadline, true if it did
+		static bool expire(Submission& submission, uint64_t now);
+		// fulfils the futures, then hands the responses to callbacks and getResult()/getResults()
+		void deliver(std::vector<Submission>& finished);
+		void applyOptions(Submission& submission, const RequestOptions& options);
+		CloudVisionRequest pushPixels(Submission&& submission, const ofPixels& pix);
+		// moves the images, or the urls of remote submissions, into the transport's body along with their features
+		RequestBody buildRequest(std::vector<Submission>& batch);
+		// fills responses from a buffered images:annotate json answer, setting status and error on each
+		static void parseResponses(const ofHttpResponse& response, const std::vector<CloudVisionResponse*>& responses, size_t expectedResults = 0);
+		typedef Transport::ResponseHandler ResponseHandler;
+		// posts the body until it gets a response that is not retryable, runs out of retries
+		// or time, or the request is aborted; handler only sees the final response
+		ofHttpResponse send(const RequestBody& body, InFlightRequest& inFlight, uint64_t deadline,
+			bool& connectionReused, size_t& attempts, ResponseHandler handler);
+		// one attempt, hedged with a second copy when that is enabled and the first one is slow
+		ofHttpResponse sendAttempt(const RequestBody& body, InFlightRequest& inFlight, uint64_t timeoutMillis,
+			bool& connectionReused, size_t& attempts, ResponseHandler handler);
 
 	private:
-		const string GOOGLE_VISION_API = "https://vision.googleapis.com/v1/";
 		string GOOGLE_BROWSER_KEY = "";
+		CloudVisionSettings mSettings;
+		SessionPool mSessionPool;
+		std::unique_ptr<TraceRecorder> mTrace;
+		std::unique_ptr<ResultCache> mCache;
+		std::unique_ptr<ArchiveWriter> mArchive;
+		std::shared_ptr<const string> mFeatures;
 		
-		std::condition_variable condition;
-		string mURL = "";
-		std::deque<ofPixels> pixelQueue;
+		std::vector<std::thread> mWorkers;
+		std::vector<std::thread> mDownloaders;
+		std::vector<std::thread> mEncoders;
+		std::atomic<bool> mRunning;
+		std::mutex mutex;
+		std::atomic<size_t> mNextId;
+		BoundedQueue<Submission> pixelQueue;
+		BoundedQueue<Submission> mDownloadQueue;
+		// between the encode and the request stage
+		StageQueue<Submission> mEncodedQueue;
+		// image buffers on their way back from the request stage to the encoders
+		StageQueue<ofBuffer> mSpentBuffers;
+		RateController mRateController;
+		// replaces mEncodedQueue when CloudVisionSettings::rateLimit is enabled
+		std::unique_ptr<RequestScheduler<Submission>> mScheduler;
+		StageCounter mDownloadStage;
+		StageCounter mEncodeStage;
+		StageCounter mRequestStage;
+		// finished out of order, waiting for earlier ids when delivering in order
+		std::map<size_t, Submission> mFinished;
+		size_t mNextDeliveryId = 1;
+		std::deque<std::shared_ptr<CloudVisionResponse>> mResults;
 		std::shared_ptr<CloudVisionResponse> mResponse;
+
+		// the last frame sent by pushPixels() and the duplicates waiting for frames still in flight
+		std::mutex mGateMutex;
+		bool mGateValid = false;
+		uint64_t mGateHash = 0;
+		uint64_t mGateTime = 0;
+		size_t mGateId = 0;
+		std::shared_ptr<const string> mGateFeatures;
+		std::shared_ptr<CloudVisionResponse> mGateResult;
+		std::map<size_t, std::vector<Submission>> mDuplicates;
+		std::atomic<uint64_t> mSuppressed;
+
+		// successful request latencies, for the hedging threshold
+		LatencyTracker mLatency;
+		std::atomic<uint64_t> mRetries;
+		std::atomic<uint64_t> mHedges;
+
+		std::unique_ptr<Metrics> mMetrics;
+		std::unique_ptr<Transport> mTransport;
+		// last, so it stops serving before anything it reports on goes away
+		std::unique_ptr<MetricsServer> mMetricsServer;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,645 @@
+#include "GoogleCloudVisionArchive.h"
+#include "GoogleCloudVision.h"
+#include "GoogleCloudVisionProtobuf.h"
+#include "Poco/File.h"
+#include "Poco/SharedMemory.h"
+
+namespace google
+{
+	namespace
+	{
+		// layout of the files, separate from the version of the records in them
+		const uint32_t ARCHIVE_VERSION = 1;
+		const char* DATA_MAGIC = "CVARDATA";
+		const char* INDEX_MAGIC = "CVARINDX";
+		const char* POSTINGS_MAGIC = "CVARPOST";
+		const char* SORTED_MAGIC = "CVARSORT";
+		const string INDEX_EXTENSION = ".index";
+		const string POSTINGS_EXTENSION = ".postings";
+		const string SORTED_EXTENSION = ".sorted";
+		// unsorted postings below this are scanned rather than merged into the sorted ones
+		const uint64_t MIN_UNSORTED = 4096;
+		const uint64_t HEADER_SIZE = sizeof(ArchiveHeader);
+
+		bool checkHeader(const ArchiveHeader& header, const char* magic, uint32_t entrySize)
+		{
+			return memcmp(header.magic, magic, sizeof(header.magic)) == 0
+				&& header.version == ARCHIVE_VERSION && header.entrySize == entrySize;
+		}
+
+		// writes the header of a new or empty file, checks the one of an existing file
+		bool prepareFile(const string& fileName, const char* magic, uint32_t entrySize, uint64_t& size)
+		{
+			size = 0;
+			try
+			{
+				Poco::File file(fileName);
+				if (file.exists())
+					size = file.getSize();
+			}
+			catch (Poco::Exception& exc)
+			{
+				ofLogError("ArchiveWriter") << exc.displayText();
+				return false;
+			}
+
+			if (size < HEADER_SIZE)
+			{
+				ArchiveHeader header;
+				memcpy(header.magic, magic, sizeof(header.magic));
+				header.version = ARCHIVE_VERSION;
+				header.entrySize = entrySize;
+				std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				if (!out)
+				{
+					ofLogError("ArchiveWriter") << "could not write " << fileName;
+					return false;
+				}
+				size = HEADER_SIZE;
+				return true;
+			}
+
+			ArchiveHeader header;
+			std::ifstream in(fileName, std::ios::binary);
+			if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || !checkHeader(header, magic, entrySize))
+			{
+				ofLogError("ArchiveWriter") << fileName << " is not an archive of this version";
+				return false;
+			}
+			return true;
+		}
+
+		template<typename T>
+		bool readEntry(std::ifstream& in, size_t index, T& entry)
+		{
+			in.clear();
+			in.seekg(HEADER_SIZE + index * sizeof(T));
+			return (bool)in.read(reinterpret_cast<char*>(&entry), sizeof(T));
+		}
+
+		void truncate(const string& fileName, uint64_t size, uint64_t currentSize)
+		{
+			if (size == currentSize)
+				return;
+			ofLogWarning("ArchiveWriter") << "cutting off " << (currentSize - size) << " bytes of an unfinished write at the end of " << fileName;
+			try
+			{
+				Poco::File(fileName).setSize(size);
+			}
+			catch (Poco::Exception& exc)
+			{
+				ofLogError("ArchiveWriter") << exc.displayText();
+			}
+		}
+
+		bool isBefore(const ArchivePosting& a, const ArchivePosting& b)
+		{
+			return a.key < b.key || (a.key == b.key && a.frame < b.frame);
+		}
+
+		template<typename T>
+		void appendEntry(string& out, const T& entry)
+		{
+			out.append(reinterpret_cast<const char*>(&entry), sizeof(T));
+		}
+
+		// maps one file and checks its header, data and size are what follows the header
+		bool mapFile(const string& fileName, const char* magic, uint32_t entrySize,
+			std::unique_ptr<Poco::SharedMemory>& memory, const char*& data, size_t& size)
+		{
+			try
+			{
+				Poco::File file(fileName);
+				// mapping an empty file fails, one without a header is not an archive anyway
+				if (!file.exists() || file.getSize() < HEADER_SIZE)
+				{
+					ofLogError("ArchiveReader") << fileName << " does not exist or is empty";
+					return false;
+				}
+				memory.reset(new Poco::SharedMemory(file, Poco::SharedMemory::AM_READ));
+			}
+			catch (Poco::Exception& exc)
+			{
+				ofLogError("ArchiveReader") << exc.displayText();
+				return false;
+			}
+
+			auto header = reinterpret_cast<const ArchiveHeader*>(memory->begin());
+			if (!checkHeader(*header, magic, entrySize))
+			{
+				ofLogError("ArchiveReader") << fileName << " is not an archive of this version";
+				memory.reset();
+				return false;
+			}
+			data = memory->begin() + HEADER_SIZE;
+			size = memory->end() - data;
+			return true;
+		}
+	}
+
+	// fields 1-14 are the scalars of CloudVisionResponse in declaration order, 15 the
+	// AnnotateImageResponse with the annotations; numbers are never reused
+	string encodeResponse(const CloudVisionResponse& res)
+	{
+		string out(1, (char)RESPONSE_FORMAT_VERSION);
+		ProtoWriter w(out);
+		if (res.id)
+			w.writeInt(1, res.id);
+		if (res.status != REQUEST_OK)
+			w.writeInt(2, res.status);
+		if (res.httpStatus)
+			w.writeInt(3, res.httpStatus);
+		if (!res.error.empty())
+			w.writeBytes(4, res.error);
+		if (res.submitTime)
+			w.writeInt(5, res.submitTime);
+		if (res.completeTime)
+			w.writeInt(6, res.completeTime);
+		if (res.width)
+			w.writeInt(7, res.width);
+		if (res.height)
+			w.writeInt(8, res.height);
+		if (res.payloadBytes)
+			w.writeInt(9, res.payloadBytes);
+		// FEATURE_ALL is the default of the struct, not 0
+		w.writeInt(10, res.features);
+		if (res.connectionReused)
+			w.writeInt(11, 1);
+		if (res.attempts)
+			w.writeInt(12, res.attempts);
+		if (res.cacheHit)
+			w.writeInt(13, 1);
+		if (res.duplicateOf)
+			w.writeInt(14, res.duplicateOf);
+
+		string annotations;
+		encodeImageResponse(annotations, res);
+		if (!annotations.empty())
+			w.writeBytes(15, annotations);
+		return out;
+	}
+
+	bool decodeResponse(const char* data, size_t size, CloudVisionResponse& response)
+	{
+		if (size == 0 || (uint8_t)data[0] > RESPONSE_FORMAT_VERSION)
+			return false;
+
+		CloudVisionResponse res;
+		res.features = 0;
+		const char* annotations = nullptr;
+		size_t annotationsSize = 0;
+		ProtoReader r(data + 1, size - 1);
+		while (r.next())
+		{
+			switch (r.getField())
+			{
+			case 1: res.id = (size_t)r.readVarint(); break;
+			case 2: res.status = (RequestStatus)r.readInt(); break;
+			case 3: res.httpStatus = r.readInt(); break;
+			case 4:
+			{
+				const char* error;
+				size_t errorSize;
+				if (r.readBytes(error, errorSize))
+					res.error.assign(error, errorSize);
+				break;
+			}
+			case 5: res.submitTime = r.readVarint(); break;
+			case 6: res.completeTime = r.readVarint(); break;
+			case 7: res.width = (size_t)r.readVarint(); break;
+			case 8: res.height = (size_t)r.readVarint(); break;
+			case 9: res.payloadBytes = (size_t)r.readVarint(); break;
+			case 10: res.features = (uint32_t)r.readVarint(); break;
+			case 11: res.connectionReused = r.readVarint() != 0; break;
+			case 12: res.attempts = (size_t)r.readVarint(); break;
+			case 13: res.cacheHit = r.readVarint() != 0; break;
+			case 14: res.duplicateOf = (size_t)r.readVarint(); break;
+			// decoded last, once the feature mask is known
+			case 15: r.readBytes(annotations, annotationsSize); break;
+			default: r.skip(); break;
+			}
+		}
+		if (r.failed())
+			return false;
+
+		res.arena = make_shared<ResponseArena>();
+		if (annotations)
+		{
+			// an API error in the annotations would overwrite what was recorded
+			RequestStatus status = res.status;
+			string error = res.error;
+			if (!decodeImageResponse(annotations, annotationsSize, res))
+				return false;
+			res.status = status;
+			res.error = error;
+		}
+		response = std::move(res);
+		return true;
+	}
+
+	ArchiveWriter::ArchiveWriter(const ArchiveSettings& settings)
+		:mSettings(settings)
+	{
+		mFileName = ofToDataPath(mSettings.path, true);
+		mOpen = open();
+		if (!mOpen)
+		{
+			ofLogError("ArchiveWriter") << "archive " << mFileName << " disabled";
+			return;
+		}
+		mWrittenFrames = mFrames;
+		mFlushTarget = mFrames;
+		mWriter = std::thread(&ArchiveWriter::writerFunction, this);
+	}
+
+	ArchiveWriter::~ArchiveWriter()
+	{
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mRunning = false;
+			mCondition.notify_all();
+		}
+		if (mWriter.joinable())
+			mWriter.join();
+	}
+
+	bool ArchiveWriter::open()
+	{
+		string indexName = mFileName + INDEX_EXTENSION;
+		string postingsName = mFileName + POSTINGS_EXTENSION;
+		string sortedName = mFileName + SORTED_EXTENSION;
+		uint64_t dataSize, indexSize, postingsSize, sortedSize;
+		if (!prepareFile(mFileName, DATA_MAGIC, 0, dataSize)
+			|| !prepareFile(indexName, INDEX_MAGIC, sizeof(ArchiveFrame), indexSize)
+			|| !prepareFile(postingsName, POSTINGS_MAGIC, sizeof(ArchivePosting), postingsSize)
+			|| !prepareFile(sortedName, SORTED_MAGIC, sizeof(ArchivePosting), sortedSize))
+			return false;
+
+		// the index is written last, so its complete entries whose records made it to the
+		// data file are what survived; records and postings beyond them are cut off
+		size_t frames = (size_t)((indexSize - HEADER_SIZE) / sizeof(ArchiveFrame));
+		mDataSize = HEADER_SIZE;
+		{
+			std::ifstream index(indexName, std::ios::binary);
+			ArchiveFrame frame;
+			for (; frames > 0; frames--)
+			{
+				if (readEntry(index, frames - 1, frame) && frame.offset + frame.size <= dataSize)
+				{
+					mDataSize = frame.offset + frame.size;
+					break;
+				}
+			}
+		}
+		size_t postings = (size_t)((postingsSize - HEADER_SIZE) / sizeof(ArchivePosting));
+		{
+			std::ifstream in(postingsName, std::ios::binary);
+			ArchivePosting posting;
+			for (; postings > 0; postings--)
+			{
+				if (readEntry(in, postings - 1, posting) && posting.frame < frames)
+					break;
+			}
+		}
+		truncate(mFileName, mDataSize, dataSize);
+		truncate(indexName, HEADER_SIZE + frames * sizeof(ArchiveFrame), indexSize);
+		truncate(postingsName, HEADER_SIZE + postings * sizeof(ArchivePosting), postingsSize);
+		mFrames = frames;
+		mPostingCount = postings;
+		// the sorted postings are replaced as a whole, they only go out of step with the
+		// others when those lost their tail; they are rebuilt then
+		mSortedCount = (sortedSize - HEADER_SIZE) / sizeof(ArchivePosting);
+		if (mSortedCount > mPostingCount || HEADER_SIZE + mSortedCount * sizeof(ArchivePosting) != sortedSize)
+		{
+			truncate(sortedName, HEADER_SIZE, sortedSize);
+			mSortedCount = 0;
+		}
+		mSortBase = mSortedCount;
+
+		mData.open(mFileName, std::ios::binary | std::ios::app);
+		mIndex.open(indexName, std::ios::binary | std::ios::app);
+		mPostings.open(postingsName, std::ios::binary | std::ios::app);
+		if (!mData || !mIndex || !mPostings)
+		{
+			ofLogError("ArchiveWriter") << "could not open " << mFileName << " for appending";
+			return false;
+		}
+		return true;
+	}
+
+	bool ArchiveWriter::append(const CloudVisionResponse& res)
+	{
+		if (!mOpen)
+			return false;
+
+		string record = encodeResponse(res);
+		ArchiveFrame frame = ArchiveFrame();
+		frame.id = res.id;
+		frame.time = ofGetSystemTimeMicros();
+		frame.size = (uint32_t)record.size();
+		frame.status = res.status;
+		frame.features = res.features;
+		frame.width = (uint32_t)res.width;
+		frame.height = (uint32_t)res.height;
+		frame.annotations = (uint32_t)(res.labelAnnotations.size() + res.textAnnotations.size() + res.logoAnnotations.size()
+			+ res.landmarkAnnotations.size() + res.faceAnnotations.size());
+
+		// text is free form and faces have no description, neither is worth an index
+		std::vector<ArchivePosting> postings;
+		postings.reserve(res.labelAnnotations.size() + res.logoAnnotations.size() + res.landmarkAnnotations.size());
+		auto post = [&](Feature feature, const StringRef& description, float score)
+		{
+			ArchivePosting posting;
+			posting.key = ArchiveReader::getPostingKey(feature, description.data(), description.size());
+			posting.score = score;
+			postings.push_back(posting);
+		};
+		for (auto& label : res.labelAnnotations)
+			post(FEATURE_LABEL, label.description, label.score);
+		for (auto& logo : res.logoAnnotations)
+			post(FEATURE_LOGO, logo.description, logo.score);
+		for (auto& landmark : res.landmarkAnnotations)
+			post(FEATURE_LANDMARK, landmark.description, landmark.score);
+
+		// only the copy into the pending buffers happens under the lock, the disk is left to the writer thread
+		std::unique_lock<std::mutex> lck(mMutex);
+		frame.offset = mDataSize;
+		mDataSize += record.size();
+		mPendingData += record;
+		for (auto& posting : postings)
+		{
+			posting.frame = (uint32_t)mFrames;
+			appendEntry(mPendingPostings, posting);
+		}
+		appendEntry(mPendingIndex, frame);
+		mFrames++;
+		if (mPendingData.size() + mPendingPostings.size() + mPendingIndex.size() >= mSettings.bufferSize)
+			mCondition.notify_all();
+		return true;
+	}
+
+	void ArchiveWriter::flush()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mFlushTarget = mFrames;
+		mCondition.notify_all();
+		mCondition.wait(lck, [this] { return mWrittenFrames >= mFlushTarget || !mOpen || !mWriter.joinable(); });
+	}
+
+	size_t ArchiveWriter::getFrameCount() const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		return mFrames;
+	}
+
+	void ArchiveWriter::writerFunction()
+	{
+		string data, postings, index;
+		std::unique_lock<std::mutex> lck(mMutex);
+		while (true)
+		{
+			mCondition.wait_for(lck, std::chrono::milliseconds(mSettings.flushMillis), [this]
+			{
+				return !mRunning || mWrittenFrames < mFlushTarget
+					|| mPendingData.size() + mPendingPostings.size() + mPendingIndex.size() >= mSettings.bufferSize;
+			});
+			if (mWrittenFrames == mFrames)
+			{
+				if (!mRunning)
+					break;
+				continue;
+			}
+
+			// swap the buffers out and write them without holding the lock
+			data.swap(mPendingData);
+			postings.swap(mPendingPostings);
+			index.swap(mPendingIndex);
+			size_t frames = mFrames;
+			lck.unlock();
+			write(data, postings, index);
+			data.clear();
+			postings.clear();
+			index.clear();
+			if (mOpen && mPostingCount - mSortBase >= std::max(MIN_UNSORTED, mPostingCount / 3))
+				sortPostings();
+			lck.lock();
+			mWrittenFrames = frames;
+			mCondition.notify_all();
+		}
+		lck.unlock();
+		if (mOpen && mPostingCount > mSortedCount)
+			sortPostings();
+		mData.close();
+		mIndex.close();
+		mPostings.close();
+	}
+
+	void ArchiveWriter::write(const string& data, const string& postings, const string& index)
+	{
+		if (!mOpen)
+			return;
+		// an index entry only ever points at records and postings that are on disk already
+		mData.write(data.data(), data.size());
+		mData.flush();
+		mPostings.write(postings.data(), postings.size());
+		mPostings.flush();
+		mIndex.write(index.data(), index.size());
+		mIndex.flush();
+		if (!mData || !mPostings || !mIndex)
+		{
+			ofLogError("ArchiveWriter") << "could not write to " << mFileName << ", archive disabled";
+			mOpen = false;
+			return;
+		}
+		mPostingCount += postings.size() / sizeof(ArchivePosting);
+	}
+
+	void ArchiveWriter::sortPostings()
+	{
+		string postingsName = mFileName + POSTINGS_EXTENSION;
+		string sortedName = mFileName + SORTED_EXTENSION;
+		string tempName = sortedName + ".tmp";
+
+		// the new postings are sorted in memory and merged with the sorted file as it is streamed
+		std::vector<ArchivePosting> fresh((size_t)(mPostingCount - mSortedCount));
+		std::ifstream in(postingsName, std::ios::binary);
+		in.seekg(HEADER_SIZE + mSortedCount * sizeof(ArchivePosting));
+		if (!in.read(reinterpret_cast<char*>(fresh.data()), fresh.size() * sizeof(ArchivePosting)))
+		{
+			ofLogError("ArchiveWriter") << "could not read " << postingsName;
+			return;
+		}
+		std::sort(fresh.begin(), fresh.end(), isBefore);
+
+		{
+			std::ifstream sorted(sortedName, std::ios::binary);
+			sorted.seekg(HEADER_SIZE);
+			std::ofstream out(tempName, std::ios::binary | std::ios::trunc);
+			ArchiveHeader header;
+			memcpy(header.magic, SORTED_MAGIC, sizeof(header.magic));
+			header.version = ARCHIVE_VERSION;
+			header.entrySize = sizeof(ArchivePosting);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			const size_t CHUNK = 4096;
+			std::vector<ArchivePosting> old(CHUNK), merged;
+			merged.reserve(CHUNK * 2);
+			uint64_t remaining = mSortedCount;
+			auto first = fresh.begin();
+			while (remaining > 0)
+			{
+				size_t count = (size_t)std::min<uint64_t>(remaining, CHUNK);
+				if (!sorted.read(reinterpret_cast<char*>(old.data()), count * sizeof(ArchivePosting)))
+					break;
+				remaining -= count;
+				// everything fresh that sorts before the end of this chunk goes out with it
+				auto last = remaining > 0 ? std::upper_bound(first, fresh.end(), old[count - 1], isBefore) : fresh.end();
+				merged.clear();
+				std::merge(old.begin(), old.begin() + count, first, last, std::back_inserter(merged), isBefore);
+				out.write(reinterpret_cast<const char*>(merged.data()), merged.size() * sizeof(ArchivePosting));
+				first = last;
+			}
+			if (remaining > 0)
+			{
+				ofLogError("ArchiveWriter") << "could not read " << sortedName;
+				return;
+			}
+			out.write(reinterpret_cast<const char*>(fresh.data() + (first - fresh.begin())), (fresh.end() - first) * sizeof(ArchivePosting));
+			if (!out)
+			{
+				ofLogError("ArchiveWriter") << "could not write " << tempName;
+				return;
+			}
+		}
+
+		// readers that have the old file mapped keep their view of it, except on windows where
+		// the file cannot be replaced while it is mapped
+		bool replaced = false;
+		try
+		{
+			Poco::File(tempName).renameTo(sortedName);
+			replaced = true;
+		}
+		catch (Poco::Exception& exc)
+		{
+			ofLogError("ArchiveWriter") << "could not replace " << sortedName << ": " << exc.displayText();
+		}
+		if (!replaced)
+		{
+			// the old sorted file still covers the postings it had, everything after them is
+			// found by the tail scan; tried again once as many new postings came in
+			try
+			{
+				Poco::File(tempName).remove();
+			}
+			catch (Poco::Exception&)
+			{
+			}
+			mSortBase = mPostingCount;
+			return;
+		}
+		mSortedCount = mPostingCount;
+		mSortBase = mSortedCount;
+	}
+
+	ArchiveReader::ArchiveReader()
+	{
+	}
+
+	ArchiveReader::~ArchiveReader()
+	{
+	}
+
+	bool ArchiveReader::open(const string& path)
+	{
+		close();
+		string fileName = ofToDataPath(path, true);
+		// mapped in the reverse order of writing, so everything the index refers to is there
+		const char* index;
+		const char* postings;
+		size_t indexSize, postingsSize;
+		if (!mapFile(fileName + INDEX_EXTENSION, INDEX_MAGIC, sizeof(ArchiveFrame), mIndexMemory, index, indexSize)
+			|| !mapFile(fileName + POSTINGS_EXTENSION, POSTINGS_MAGIC, sizeof(ArchivePosting), mPostingsMemory, postings, postingsSize)
+			|| !mapFile(fileName, DATA_MAGIC, 0, mDataMemory, mData, mDataSize))
+		{
+			close();
+			return false;
+		}
+
+		mFrames = Span<ArchiveFrame>(reinterpret_cast<const ArchiveFrame*>(index), indexSize / sizeof(ArchiveFrame));
+		// postings of frames whose index entries were not written yet
+		size_t count = postingsSize / sizeof(ArchivePosting);
+		auto begin = reinterpret_cast<const ArchivePosting*>(postings);
+		while (count > 0 && begin[count - 1].frame >= mFrames.size())
+			count--;
+		mPostings = Span<ArchivePosting>(begin, count);
+
+		// without the sorted postings every query scans, which is slow but still right
+		const char* sorted;
+		size_t sortedSize;
+		string sortedName = fileName + SORTED_EXTENSION;
+		if (Poco::File(sortedName).exists() && mapFile(sortedName, SORTED_MAGIC, sizeof(ArchivePosting), mSortedMemory, sorted, sortedSize))
+		{
+			size_t sortedCount = sortedSize / sizeof(ArchivePosting);
+			if (sortedCount <= mPostings.size())
+				mSorted = Span<ArchivePosting>(reinterpret_cast<const ArchivePosting*>(sorted), sortedCount);
+			else
+				mSortedMemory.reset();
+		}
+		return true;
+	}
+
+	void ArchiveReader::close()
+	{
+		mFrames = Span<ArchiveFrame>();
+		mPostings = Span<ArchivePosting>();
+		mSorted = Span<ArchivePosting>();
+		mData = nullptr;
+		mDataSize = 0;
+		mDataMemory.reset();
+		mIndexMemory.reset();
+		mPostingsMemory.reset();
+		mSortedMemory.reset();
+	}
+
+	bool ArchiveReader::read(size_t frame, CloudVisionResponse& response) const
+	{
+		if (frame >= mFrames.size())
+			return false;
+		auto& entry = mFrames[frame];
+		if (entry.offset < HEADER_SIZE || entry.offset - HEADER_SIZE + entry.size > mDataSize)
+			return false;
+		return decodeResponse(mData + (entry.offset - HEADER_SIZE), entry.size, response);
+	}
+
+	std::vector<size_t> ArchiveReader::find(Feature feature, const string& description, float minScore) const
+	{
+		// a 64 bit key makes collisions negligible
+		uint64_t key = getPostingKey(feature, description);
+		std::vector<size_t> frames;
+		auto add = [&](const ArchivePosting& posting)
+		{
+			if (posting.score >= minScore && (frames.empty() || frames.back() != posting.frame))
+				frames.push_back(posting.frame);
+		};
+
+		// ordered by frame within a key, and every frame in them comes before the ones after them
+		ArchivePosting first = ArchivePosting();
+		first.key = key;
+		auto it = std::lower_bound(mSorted.begin(), mSorted.end(), first, isBefore);
+		for (; it != mSorted.end() && it->key == key; it++)
+			add(*it);
+		for (size_t i = mSorted.size(); i < mPostings.size(); i++)
+		{
+			if (mPostings[i].key == key)
+				add(mPostings[i]);
+		}
+		return frames;
+	}
+
+	uint64_t ArchiveReader::getPostingKey(Feature feature, const char* description, size_t size)
+	{
+		return hash64(description, size, feature);
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "ofMain.h"
+#include "GoogleCloudVisionArena.h"
+#include "GoogleCloudVisionFeatures.h"
+
+namespace Poco
+{
+	class SharedMemory;
+}
+
+namespace google
+{
+	struct CloudVisionResponse;
+
+	// bumped whenever encodeResponse() changes in a way older readers would get wrong;
+	// new fields alone do not need it, unknown fields are skipped
+	const uint8_t RESPONSE_FORMAT_VERSION = 1;
+
+	// a CloudVisionResponse as a version byte followed by its fields in the protocol buffers
+	// wire format, the annotations in the same form as an AnnotateImageResponse
+	string encodeResponse(const CloudVisionResponse& response);
+	// false for a newer version or malformed data; the annotations get an arena of their own
+	bool decodeResponse(const char* data, size_t size, CloudVisionResponse& response);
+
+	struct ArchiveSettings
+	{
+		bool enabled = false;
+		// records go to <path>, the frame index to <path>.index and the label, logo and landmark
+		// postings to <path>.postings, with a copy sorted by key in <path>.sorted; relative to
+		// the data path, existing files are appended to
+		string path = "cloudvision.cva";
+		// archive failed responses as well, not only successful ones
+		bool failures = false;
+		// bytes collected before the writer thread is woken, flush() writes them right away
+		size_t bufferSize = 256 * 1024;
+		// the longest anything waits to be written when less than bufferSize comes in
+		uint64_t flushMillis = 1000;
+	};
+
+	// every archive file starts with this, followed by entries of entrySize bytes
+	// (records of any size in the data file, entrySize 0); values are in the byte order of
+	// the machine, little endian on everything the addon builds for
+	struct ArchiveHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t entrySize;
+	};
+
+	// one archived response in <path>.index, fixed size so the index can be used in place
+	struct ArchiveFrame
+	{
+		// where its record is in the data file
+		uint64_t offset;
+		// CloudVisionResponse::id, unique within one CloudVision instance only
+		uint64_t id;
+		// ofGetSystemTimeMicros() when it was archived
+		uint64_t time;
+		uint32_t size;
+		uint32_t status;
+		// FEATURE_* mask that was requested
+		uint32_t features;
+		uint32_t width;
+		uint32_t height;
+		// number of annotations of every kind
+		uint32_t annotations;
+	};
+
+	// one label, logo or landmark of a frame in <path>.postings, in frame order; <path>.sorted
+	// holds the first postings ordered by key, then frame, for binary search
+	struct ArchivePosting
+	{
+		// ArchiveReader::getPostingKey() of its feature and description
+		uint64_t key;
+		uint32_t frame;
+		float score;
+	};
+
+	static_assert(sizeof(ArchiveHeader) == 16, "ArchiveHeader is part of the file format");
+	static_assert(sizeof(ArchiveFrame) == 48, "ArchiveFrame is part of the file format");
+	static_assert(sizeof(ArchivePosting) == 16, "ArchivePosting is part of the file format");
+
+	// appends responses to an archive from any thread: they are encoded by the caller and
+	// collected, a background thread writes records, postings and index entries in that
+	// order, so a crash leaves at most a torn tail that the next open cuts off. Postings
+	// are merged into <path>.sorted once the unsorted ones make up a third of them, and
+	// all of them when the writer is destroyed. On windows a merge fails while a reader has
+	// <path>.sorted open; it is tried again later and queries scan more in the meantime, so
+	// readers that stay open should be closed before the writer is destroyed
+	class ArchiveWriter
+	{
+	public:
+		ArchiveWriter(const ArchiveSettings& settings);
+		~ArchiveWriter();
+
+		// false when the files could not be opened or written, or belong to another format
+		bool isOpen() const { return mOpen; }
+		// false when the archive is not open
+		bool append(const CloudVisionResponse& response);
+		// blocks until everything appended so far is on disk
+		void flush();
+		// frames archived so far, written or not
+		size_t getFrameCount() const;
+
+	private:
+		bool open();
+		void writerFunction();
+		void write(const string& data, const string& postings, const string& index);
+		// merges the postings not yet in <path>.sorted into it, leaves mSortedCount alone
+		// when the file could not be replaced
+		void sortPostings();
+
+		ArchiveSettings mSettings;
+		string mFileName;
+		std::atomic<bool> mOpen{ false };
+		mutable std::mutex mMutex;
+		std::condition_variable mCondition;
+		// size of the data file and number of frames, including what is still pending
+		uint64_t mDataSize = 0;
+		size_t mFrames = 0;
+		size_t mWrittenFrames = 0;
+		size_t mFlushTarget = 0;
+		bool mRunning = true;
+		string mPendingData;
+		string mPendingIndex;
+		string mPendingPostings;
+		// only used by the writer thread
+		std::ofstream mData;
+		std::ofstream mIndex;
+		std::ofstream mPostings;
+		uint64_t mPostingCount = 0;
+		uint64_t mSortedCount = 0;
+		// the next merge waits for enough postings after this, mSortedCount unless a merge failed
+		uint64_t mSortBase = 0;
+		std::thread mWriter;
+	};
+
+	// a read-only view of an archive through memory mapped files: frames and postings are
+	// used in place and only the records asked for are decoded. Sees the archive as it was
+	// when it was opened, open() again to pick up what was appended since; on windows an open
+	// reader keeps the writer from replacing <path>.sorted, see ArchiveWriter
+	class ArchiveReader
+	{
+	public:
+		ArchiveReader();
+		~ArchiveReader();
+
+		// path as in ArchiveSettings
+		bool open(const string& path);
+		void close();
+
+		Span<ArchiveFrame> getFrames() const { return mFrames; }
+		// every posting in frame order; the first getSortedPostings().size() of them are also
+		// in the sorted ones
+		Span<ArchivePosting> getPostings() const { return mPostings; }
+		Span<ArchivePosting> getSortedPostings() const { return mSorted; }
+		size_t size() const { return mFrames.size(); }
+		// decodes the record of one frame
+		bool read(size_t frame, CloudVisionResponse& response) const;
+		// frames with a label, logo or landmark of that description scoring at least minScore,
+		// in order; a binary search in the sorted postings and a scan of the ones after them
+		std::vector<size_t> find(Feature feature, const string& description, float minScore = 0) const;
+
+		static uint64_t getPostingKey(Feature feature, const char* description, size_t size);
+		static uint64_t getPostingKey(Feature feature, const string& description)
+		{
+			return getPostingKey(feature, description.data(), description.size());
+		}
+
+	private:
+		std::unique_ptr<Poco::SharedMemory> mDataMemory;
+		std::unique_ptr<Poco::SharedMemory> mIndexMemory;
+		std::unique_ptr<Poco::SharedMemory> mPostingsMemory;
+		std::unique_ptr<Poco::SharedMemory> mSortedMemory;
+		const char* mData = nullptr;
+		size_t mDataSize = 0;
+		Span<ArchiveFrame> mFrames;
+		Span<ArchivePosting> mPostings;
+		Span<ArchivePosting> mSorted;
+	};
+}
@@ -0,0 +1,87 @@
+#include "GoogleCloudVisionArena.h"
+#include <unordered_set>
+
+namespace google
+{
+	namespace
+	{
+		const size_t FIRST_BLOCK_SIZE = 4 * 1024;
+		const size_t MAX_BLOCK_SIZE = 256 * 1024;
+
+		struct StringRefHash
+		{
+			size_t operator()(const StringRef& text) const
+			{
+				// FNV-1a
+				uint64_t hash = 14695981039346656037ULL;
+				for (size_t i = 0; i < text.size(); i++)
+				{
+					hash ^= (unsigned char)text.data()[i];
+					hash *= 1099511628211ULL;
+				}
+				return (size_t)hash;
+			}
+		};
+
+		class StringPool
+		{
+		public:
+			StringRef intern(const char* data, size_t size)
+			{
+				// the lookup key points at the caller's characters, nothing is allocated for hits
+				StringRef key(data, size);
+				std::unique_lock<std::mutex> lck(mMutex);
+				auto it = mStrings.find(key);
+				if (it != mStrings.end())
+					return *it;
+				StringRef stored = mStorage.store(data, size);
+				mStrings.insert(stored);
+				return stored;
+			}
+
+		private:
+			std::mutex mMutex;
+			ResponseArena mStorage;
+			std::unordered_set<StringRef, StringRefHash> mStrings;
+		};
+	}
+
+	StringRef internString(const char* data, size_t size)
+	{
+		if (size == 0)
+			return StringRef();
+		// never destroyed, interned strings may be referenced from static destructors
+		static StringPool* pool = new StringPool();
+		return pool->intern(data, size);
+	}
+
+	StringRef ResponseArena::store(const char* data, size_t size)
+	{
+		if (size == 0)
+			return StringRef();
+		char* copy = static_cast<char*>(allocate(size + 1, 1));
+		memcpy(copy, data, size);
+		copy[size] = 0;
+		return StringRef(copy, size);
+	}
+
+	void* ResponseArena::allocate(size_t size, size_t alignment)
+	{
+		size_t padding = (alignment - (reinterpret_cast<uintptr_t>(mCursor) & (alignment - 1))) & (alignment - 1);
+		if (mCursor == nullptr || padding + size > mRemaining)
+		{
+			// blocks grow with the arena so large responses need few of them
+			size_t blockSize = std::min(std::max(FIRST_BLOCK_SIZE, mCapacity), MAX_BLOCK_SIZE);
+			blockSize = std::max(blockSize, size + alignment);
+			mBlocks.emplace_back(new char[blockSize]);
+			mCursor = mBlocks.back().get();
+			mRemaining = blockSize;
+			mCapacity += blockSize;
+			padding = (alignment - (reinterpret_cast<uintptr_t>(mCursor) & (alignment - 1))) & (alignment - 1);
+		}
+		char* data = mCursor + padding;
+		mCursor += padding + size;
+		mRemaining -= padding + size;
+		return data;
+	}
+}
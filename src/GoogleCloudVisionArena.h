@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	// read-only view of elements owned by a ResponseArena
+	template<typename T>
+	class Span
+	{
+	public:
+		Span() {}
+		Span(const T* data, size_t size) : mData(data), mSize(size) {}
+
+		const T* begin() const { return mData; }
+		const T* end() const { return mData + mSize; }
+		const T* data() const { return mData; }
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+		const T& operator[](size_t i) const { return mData[i]; }
+		const T& front() const { return mData[0]; }
+		const T& back() const { return mData[mSize - 1]; }
+
+	private:
+		const T* mData = nullptr;
+		size_t mSize = 0;
+	};
+
+	// null terminated string owned by a ResponseArena or by the global string pool
+	class StringRef
+	{
+	public:
+		StringRef() {}
+		StringRef(const char* data, size_t size) : mData(data), mSize(size) {}
+
+		const char* c_str() const { return mData; }
+		const char* data() const { return mData; }
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+		string str() const { return string(mData, mSize); }
+		operator string() const { return str(); }
+
+		bool operator==(const StringRef& other) const
+		{
+			return mData == other.mData || (mSize == other.mSize && memcmp(mData, other.mData, mSize) == 0);
+		}
+		bool operator!=(const StringRef& other) const { return !(*this == other); }
+		bool operator==(const string& other) const { return *this == StringRef(other.c_str(), other.size()); }
+		bool operator!=(const string& other) const { return !(*this == other); }
+
+	private:
+		const char* mData = "";
+		size_t mSize = 0;
+	};
+
+	// one shared copy per distinct string for the whole process, for small vocabularies
+	// like mids, label descriptions, locales and landmark types; never shrinks
+	StringRef internString(const char* data, size_t size);
+	inline StringRef internString(const string& text) { return internString(text.data(), text.size()); }
+
+	// bump allocator holding the geometry and free text of one response, so a response
+	// is a handful of allocations no matter how many annotations it has; everything it
+	// hands out stays put until the arena is destroyed
+	class ResponseArena
+	{
+	public:
+		ResponseArena() {}
+		ResponseArena(const ResponseArena&) = delete;
+		ResponseArena& operator=(const ResponseArena&) = delete;
+
+		// only for trivially copyable element types
+		template<typename T>
+		Span<T> store(const std::vector<T>& elements)
+		{
+			if (elements.empty())
+				return Span<T>();
+			void* data = allocate(sizeof(T) * elements.size(), alignof(T));
+			memcpy(data, elements.data(), sizeof(T) * elements.size());
+			return Span<T>(static_cast<const T*>(data), elements.size());
+		}
+
+		StringRef store(const char* data, size_t size);
+		StringRef store(const string& text) { return store(text.data(), text.size()); }
+		// bytes held, used or not
+		size_t capacity() const { return mCapacity; }
+
+	private:
+		void* allocate(size_t size, size_t alignment);
+
+		std::vector<std::unique_ptr<char[]>> mBlocks;
+		char* mCursor = nullptr;
+		size_t mRemaining = 0;
+		size_t mCapacity = 0;
+	};
+}
@@ -0,0 +1,203 @@
+#include "GoogleCloudVisionBase64.h"
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CLOUD_VISION_BASE64_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CLOUD_VISION_TARGET(isa)
+#else
+#include <cpuid.h>
+#define CLOUD_VISION_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace google
+{
+	namespace
+	{
+		const char* ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		// 3 bytes -> 4 chars for whatever the vector loops left over, padding the tail
+		size_t encodeTail(const uint8_t* src, size_t size, char* dst)
+		{
+			char* out = dst;
+			size_t i = 0;
+			for (; i + 3 <= size; i += 3)
+			{
+				uint32_t v = (uint32_t(src[i]) << 16) | (uint32_t(src[i + 1]) << 8) | src[i + 2];
+				out[0] = ALPHABET[(v >> 18) & 0x3f];
+				out[1] = ALPHABET[(v >> 12) & 0x3f];
+				out[2] = ALPHABET[(v >> 6) & 0x3f];
+				out[3] = ALPHABET[v & 0x3f];
+				out += 4;
+			}
+			size_t rest = size - i;
+			if (rest > 0)
+			{
+				uint32_t v = uint32_t(src[i]) << 16;
+				if (rest == 2)
+					v |= uint32_t(src[i + 1]) << 8;
+				out[0] = ALPHABET[(v >> 18) & 0x3f];
+				out[1] = ALPHABET[(v >> 12) & 0x3f];
+				out[2] = rest == 2 ? ALPHABET[(v >> 6) & 0x3f] : '=';
+				out[3] = '=';
+				out += 4;
+			}
+			return out - dst;
+		}
+
+#ifdef CLOUD_VISION_BASE64_X86
+		// vectorised encoding after Mula & Lemire, "Faster Base64 Encoding and Decoding using AVX2 Instructions":
+		// every 12 input bytes are spread over 16 lanes, split into 6 bit indices with two multiplies,
+		// and the indices are turned into ascii with one byte shuffle used as a 16 entry offset table
+		CLOUD_VISION_TARGET("ssse3")
+		inline __m128i encodeBlock(__m128i in)
+		{
+			in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+			const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+			const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+			const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+			const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+			const __m128i indices = _mm_or_si128(t1, t3);
+
+			const __m128i offsets = _mm_setr_epi8(
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+			__m128i lookup = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+			const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+			lookup = _mm_or_si128(lookup, _mm_and_si128(upper, _mm_set1_epi8(13)));
+			return _mm_add_epi8(_mm_shuffle_epi8(offsets, lookup), indices);
+		}
+
+		CLOUD_VISION_TARGET("ssse3")
+		size_t encodeSSSE3(const uint8_t* src, size_t size, char* dst)
+		{
+			char* out = dst;
+			// loads are 16 bytes wide but only 12 are consumed
+			while (size >= 16)
+			{
+				__m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), encodeBlock(in));
+				src += 12;
+				size -= 12;
+				out += 16;
+			}
+			return (out - dst) + encodeTail(src, size, out);
+		}
+
+		CLOUD_VISION_TARGET("avx2")
+		size_t encodeAVX2(const uint8_t* src, size_t size, char* dst)
+		{
+			char* out = dst;
+			const __m256i shuffle = _mm256_set_epi8(
+				10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+				10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+			const __m256i offsets = _mm256_setr_epi8(
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+			// two 12 byte groups per iteration, one per 128 bit lane
+			while (size >= 28)
+			{
+				__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+				__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12));
+				__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+				in = _mm256_shuffle_epi8(in, shuffle);
+				const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+				const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+				const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+				const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+				const __m256i indices = _mm256_or_si256(t1, t3);
+
+				__m256i lookup = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+				const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+				lookup = _mm256_or_si256(lookup, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+				const __m256i result = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, lookup), indices);
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), result);
+				src += 24;
+				size -= 24;
+				out += 32;
+			}
+			return (out - dst) + encodeSSSE3(src, size, out);
+		}
+
+		enum Implementation { SCALAR, SSSE3, AVX2 };
+
+		Implementation detect()
+		{
+			int info[4] = { 0, 0, 0, 0 };
+			int extended[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+			__cpuid(info, 1);
+			__cpuidex(extended, 7, 0);
+#else
+			__cpuid(1, info[0], info[1], info[2], info[3]);
+			if (__get_cpuid_max(0, nullptr) >= 7)
+				__cpuid_count(7, 0, extended[0], extended[1], extended[2], extended[3]);
+#endif
+			bool ssse3 = (info[2] & (1 << 9)) != 0;
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx2 = (extended[1] & (1 << 5)) != 0;
+			if (avx2 && osxsave)
+			{
+				// the os has to save the ymm registers too
+#ifdef _MSC_VER
+				unsigned long long xcr0 = _xgetbv(0);
+#else
+				uint32_t eax, edx;
+				__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+				unsigned long long xcr0 = (uint64_t(edx) << 32) | eax;
+#endif
+				if ((xcr0 & 0x6) == 0x6)
+					return AVX2;
+			}
+			return ssse3 ? SSSE3 : SCALAR;
+		}
+
+		const Implementation IMPLEMENTATION = detect();
+#endif
+	}
+
+	size_t base64Encode(const void* src, size_t size, char* dst)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(src);
+#ifdef CLOUD_VISION_BASE64_X86
+		switch (IMPLEMENTATION)
+		{
+		case AVX2:
+			return encodeAVX2(bytes, size, dst);
+		case SSSE3:
+			return encodeSSSE3(bytes, size, dst);
+		default:
+			break;
+		}
+#endif
+		return encodeTail(bytes, size, dst);
+	}
+
+	size_t base64EncodeScalar(const void* src, size_t size, char* dst)
+	{
+		return encodeTail(static_cast<const uint8_t*>(src), size, dst);
+	}
+
+	const char* base64GetImplementation()
+	{
+#ifdef CLOUD_VISION_BASE64_X86
+		switch (IMPLEMENTATION)
+		{
+		case AVX2:
+			return "avx2";
+		case SSSE3:
+			return "ssse3";
+		default:
+			break;
+		}
+#endif
+		return "scalar";
+	}
+}
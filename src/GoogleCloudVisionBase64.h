@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+namespace google
+{
+	// characters produced for size input bytes, padding included
+	inline size_t base64EncodedSize(size_t size)
+	{
+		return (size + 2) / 3 * 4;
+	}
+
+	// encodes size bytes into dst without line breaks, dst must hold base64EncodedSize(size) chars;
+	// picks the AVX2 or SSSE3 path when the cpu has it, returns the number of chars written
+	size_t base64Encode(const void* src, size_t size, char* dst);
+
+	// the portable path base64Encode falls back to
+	size_t base64EncodeScalar(const void* src, size_t size, char* dst);
+
+	// "avx2", "ssse3" or "scalar"
+	const char* base64GetImplementation();
+}
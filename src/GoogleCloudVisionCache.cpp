@@ -0,0 +1,417 @@
+#include "GoogleCloudVisionCache.h"
+#include "GoogleCloudVision.h"
+#include "GoogleCloudVisionParser.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/File.h"
+
+namespace google
+{
+	namespace
+	{
+		const uint64_t PRIME1 = 11400714785074694791ULL;
+		const uint64_t PRIME2 = 14029467366897019727ULL;
+		const uint64_t PRIME3 = 1609587929392839161ULL;
+		const uint64_t PRIME4 = 9650029242287828579ULL;
+		const uint64_t PRIME5 = 2870177450012600261ULL;
+
+		inline uint64_t rotl(uint64_t x, int r)
+		{
+			return (x << r) | (x >> (64 - r));
+		}
+
+		inline uint64_t read64(const uint8_t* p)
+		{
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint32_t read32(const uint8_t* p)
+		{
+			uint32_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint64_t round(uint64_t acc, uint64_t input)
+		{
+			acc += input * PRIME2;
+			acc = rotl(acc, 31);
+			return acc * PRIME1;
+		}
+
+		inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+		{
+			acc ^= round(0, val);
+			return acc * PRIME1 + PRIME4;
+		}
+
+		const string EXTENSION = ".json";
+		const string TEMP_EXTENSION = ".tmp";
+	}
+
+	uint64_t hash64(const void* data, size_t size, uint64_t seed)
+	{
+		// reads are little endian, as on every platform openFrameworks runs on
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		const uint8_t* end = p + size;
+		uint64_t h;
+
+		if (size >= 32)
+		{
+			uint64_t v1 = seed + PRIME1 + PRIME2;
+			uint64_t v2 = seed + PRIME2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - PRIME1;
+			const uint8_t* limit = end - 32;
+			do
+			{
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+				p += 32;
+			} while (p <= limit);
+
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = mergeRound(h, v1);
+			h = mergeRound(h, v2);
+			h = mergeRound(h, v3);
+			h = mergeRound(h, v4);
+		}
+		else
+		{
+			h = seed + PRIME5;
+		}
+
+		h += (uint64_t)size;
+		for (; p + 8 <= end; p += 8)
+		{
+			h ^= round(0, read64(p));
+			h = rotl(h, 27) * PRIME1 + PRIME4;
+		}
+		if (p + 4 <= end)
+		{
+			h ^= (uint64_t)read32(p) * PRIME1;
+			h = rotl(h, 23) * PRIME2 + PRIME3;
+			p += 4;
+		}
+		for (; p < end; p++)
+		{
+			h ^= (*p) * PRIME5;
+			h = rotl(h, 11) * PRIME1;
+		}
+
+		h ^= h >> 33;
+		h *= PRIME2;
+		h ^= h >> 29;
+		h *= PRIME3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	ResultCache::ResultCache(const CacheSettings& settings)
+		:mSettings(settings)
+	{
+		if (!mSettings.diskPath.empty())
+		{
+			mDirectory = ofToDataPath(mSettings.diskPath, true);
+			try
+			{
+				Poco::File(mDirectory).createDirectories();
+				scanDisk();
+			}
+			catch (Poco::Exception& exc)
+			{
+				ofLogError("ResultCache") << "disk cache disabled: " << exc.displayText();
+				mDirectory.clear();
+			}
+		}
+	}
+
+	ResultCache::Key ResultCache::makeKey(const ofBuffer& payload, const string& features)
+	{
+		Key key;
+		key.hash = hash64(payload.getData(), payload.size(), hash64(features.data(), features.size()));
+		key.size = payload.size();
+		return key;
+	}
+
+	std::shared_ptr<const CloudVisionResponse> ResultCache::find(const Key& key)
+	{
+		uint64_t time = now();
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			auto it = mIndex.find(key);
+			if (it != mIndex.end())
+			{
+				if (!isExpired(it->second->insertedTime, time))
+				{
+					mEntries.splice(mEntries.begin(), mEntries, it->second);
+					mStats.memoryHits++;
+					return it->second->response;
+				}
+				mEntries.erase(it->second);
+				mIndex.erase(it);
+			}
+
+			auto disk = mDiskIndex.find(key);
+			if (disk == mDiskIndex.end())
+			{
+				mStats.misses++;
+				return nullptr;
+			}
+			if (isExpired(disk->second.modifiedTime, time))
+			{
+				mDiskIndex.erase(disk);
+				mStats.misses++;
+				removeDisk(key);
+				return nullptr;
+			}
+		}
+
+		// the file is read and parsed without holding the lock
+		uint64_t insertedTime = 0;
+		auto response = loadDisk(key, insertedTime);
+
+		std::unique_lock<std::mutex> lck(mMutex);
+		if (!response)
+		{
+			mDiskIndex.erase(key);
+			mStats.misses++;
+			return nullptr;
+		}
+		insertMemory(key, response, insertedTime);
+		mStats.diskHits++;
+		return response;
+	}
+
+	void ResultCache::insert(const Key& key, const std::shared_ptr<const CloudVisionResponse>& response)
+	{
+		uint64_t time = now();
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			insertMemory(key, response, time);
+			mStats.insertions++;
+		}
+		if (!mDirectory.empty())
+			storeDisk(key, *response, time);
+	}
+
+	void ResultCache::clear()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mEntries.clear();
+		mIndex.clear();
+		for (auto& it : mDiskIndex)
+			removeDisk(it.first);
+		mDiskIndex.clear();
+	}
+
+	CacheStats ResultCache::getStats() const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		CacheStats stats = mStats;
+		stats.memoryEntries = mEntries.size();
+		stats.diskEntries = mDiskIndex.size();
+		stats.diskBytes = 0;
+		for (auto& it : mDiskIndex)
+			stats.diskBytes += it.second.size;
+		return stats;
+	}
+
+	bool ResultCache::isExpired(uint64_t insertedTime, uint64_t now) const
+	{
+		return mSettings.ttlSeconds > 0 && now > insertedTime + mSettings.ttlSeconds;
+	}
+
+	void ResultCache::insertMemory(const Key& key, const std::shared_ptr<const CloudVisionResponse>& response, uint64_t insertedTime)
+	{
+		if (mSettings.maxEntries == 0)
+			return;
+		auto it = mIndex.find(key);
+		if (it != mIndex.end())
+		{
+			mEntries.erase(it->second);
+			mIndex.erase(it);
+		}
+		Entry entry;
+		entry.key = key;
+		entry.response = response;
+		entry.insertedTime = insertedTime;
+		mEntries.push_front(entry);
+		mIndex[key] = mEntries.begin();
+		while (mEntries.size() > mSettings.maxEntries)
+		{
+			mIndex.erase(mEntries.back().key);
+			mEntries.pop_back();
+			mStats.evictions++;
+		}
+	}
+
+	std::shared_ptr<const CloudVisionResponse> ResultCache::loadDisk(const Key& key, uint64_t& insertedTime)
+	{
+		std::ifstream in(getFileName(key), std::ios::binary);
+		if (!in)
+			return nullptr;
+		uint64_t time = 0;
+		in >> time;
+		if (!in)
+			return nullptr;
+
+		auto response = make_shared<CloudVisionResponse>();
+		std::vector<CloudVisionResponse*> responses = { response.get() };
+		parseAnnotateResponse(in, 200, "", responses);
+		if (response->status != REQUEST_OK)
+		{
+			ofLogWarning("ResultCache") << "ignoring unreadable entry " << getFileName(key) << ": " << response->error;
+			return nullptr;
+		}
+		insertedTime = time;
+		return response;
+	}
+
+	void ResultCache::storeDisk(const Key& key, const CloudVisionResponse& response, uint64_t now)
+	{
+		// the insertion time leads the file, followed by the response in the API's own format
+		// so reading it back goes through the regular parser. Every store writes a file of its
+		// own and renames it into place, so threads storing the same key never tear it
+		string fileName = getFileName(key);
+		string tempName = fileName + "." + ofToString(mNextTemp++) + TEMP_EXTENSION;
+		uint64_t size = 0;
+		{
+			std::ofstream out(tempName, std::ios::binary | std::ios::trunc);
+			out << now << "\n";
+			std::vector<const CloudVisionResponse*> responses = { &response };
+			writeAnnotateResponse(out, responses);
+			if (!out)
+			{
+				ofLogError("ResultCache") << "could not write " << tempName;
+				out.close();
+				removeFile(tempName);
+				return;
+			}
+			size = out.tellp();
+		}
+		try
+		{
+			Poco::File(tempName).renameTo(fileName);
+		}
+		catch (Poco::Exception& exc)
+		{
+			ofLogError("ResultCache") << "could not store " << fileName << ": " << exc.displayText();
+			removeFile(tempName);
+			return;
+		}
+
+		std::vector<Key> evicted;
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			DiskEntry entry;
+			entry.size = size;
+			entry.modifiedTime = now;
+			mDiskIndex[key] = entry;
+			evicted = evictDisk();
+		}
+		for (auto& it : evicted)
+			removeDisk(it);
+	}
+
+	std::vector<ResultCache::Key> ResultCache::evictDisk()
+	{
+		std::vector<Key> evicted;
+		uint64_t total = 0;
+		for (auto& it : mDiskIndex)
+			total += it.second.size;
+		if (total <= mSettings.maxDiskBytes)
+			return evicted;
+
+		// one sorted pass, oldest first, until the rest fits
+		std::vector<std::pair<uint64_t, Key>> entries;
+		entries.reserve(mDiskIndex.size());
+		for (auto& it : mDiskIndex)
+			entries.emplace_back(it.second.modifiedTime, it.first);
+		std::sort(entries.begin(), entries.end(), [](const std::pair<uint64_t, Key>& a, const std::pair<uint64_t, Key>& b)
+		{
+			return a.first < b.first;
+		});
+		for (auto& it : entries)
+		{
+			if (total <= mSettings.maxDiskBytes)
+				break;
+			auto found = mDiskIndex.find(it.second);
+			total -= found->second.size;
+			evicted.push_back(it.second);
+			mDiskIndex.erase(found);
+			mStats.evictions++;
+		}
+		return evicted;
+	}
+
+	void ResultCache::removeDisk(const Key& key)
+	{
+		removeFile(getFileName(key));
+	}
+
+	void ResultCache::removeFile(const string& fileName)
+	{
+		try
+		{
+			Poco::File(fileName).remove();
+		}
+		catch (Poco::Exception&)
+		{
+		}
+	}
+
+	void ResultCache::scanDisk()
+	{
+		// file names are <hash><size> in hex, the insertion time is the first line
+		std::vector<string> stale;
+		for (Poco::DirectoryIterator it(mDirectory), end; it != end; ++it)
+		{
+			const string& name = it.name();
+			// left behind by a store that was interrupted
+			if (name.size() > TEMP_EXTENSION.size() && name.compare(name.size() - TEMP_EXTENSION.size(), string::npos, TEMP_EXTENSION) == 0)
+			{
+				stale.push_back(it->path());
+				continue;
+			}
+			if (name.size() != 32 + EXTENSION.size() || name.compare(32, string::npos, EXTENSION) != 0)
+				continue;
+			Key key;
+			key.hash = strtoull(name.substr(0, 16).c_str(), nullptr, 16);
+			key.size = strtoull(name.substr(16, 16).c_str(), nullptr, 16);
+
+			std::ifstream in(it->path(), std::ios::binary);
+			DiskEntry entry;
+			in >> entry.modifiedTime;
+			entry.size = it->getSize();
+			if (in)
+				mDiskIndex[key] = entry;
+		}
+		for (auto& fileName : stale)
+			removeFile(fileName);
+
+		// a smaller maxDiskBytes than last time applies right away
+		std::vector<Key> evicted;
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			evicted = evictDisk();
+		}
+		for (auto& key : evicted)
+			removeDisk(key);
+	}
+
+	string ResultCache::getFileName(const Key& key) const
+	{
+		char name[33];
+		snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)key.hash, (unsigned long long)key.size);
+		return ofFilePath::join(mDirectory, name + EXTENSION);
+	}
+
+	uint64_t ResultCache::now()
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct CloudVisionResponse;
+
+	// XXH64 of size bytes
+	uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+	struct CacheSettings
+	{
+		bool enabled = false;
+		// responses kept in memory, least recently used go first
+		size_t maxEntries = 1024;
+		// entries older than this are ignored and removed, 0 keeps them forever
+		uint64_t ttlSeconds = 24 * 60 * 60;
+		// directory of the persistent tier, relative to the data path; empty keeps the cache in memory only
+		string diskPath = "";
+		// also enforced on what is found on disk at startup
+		uint64_t maxDiskBytes = 256 * 1024 * 1024;
+	};
+
+	struct CacheStats
+	{
+		uint64_t memoryHits = 0;
+		uint64_t diskHits = 0;
+		uint64_t misses = 0;
+		uint64_t insertions = 0;
+		uint64_t evictions = 0;
+		size_t memoryEntries = 0;
+		size_t diskEntries = 0;
+		uint64_t diskBytes = 0;
+	};
+
+	// results keyed by the encoded image bytes and the requested features, in an in-memory
+	// LRU tier backed by an optional directory of one file per entry that survives restarts
+	class ResultCache
+	{
+	public:
+		struct Key
+		{
+			uint64_t hash = 0;
+			uint64_t size = 0;
+			bool operator==(const Key& other) const { return hash == other.hash && size == other.size; }
+		};
+
+		ResultCache(const CacheSettings& settings);
+
+		static Key makeKey(const ofBuffer& payload, const string& features);
+		// null on a miss
+		std::shared_ptr<const CloudVisionResponse> find(const Key& key);
+		// only successful responses should be inserted
+		void insert(const Key& key, const std::shared_ptr<const CloudVisionResponse>& response);
+		void clear();
+		CacheStats getStats() const;
+
+	private:
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const { return (size_t)(key.hash ^ (key.size * 0x9e3779b97f4a7c15ULL)); }
+		};
+
+		struct Entry
+		{
+			Key key;
+			std::shared_ptr<const CloudVisionResponse> response;
+			uint64_t insertedTime = 0;
+		};
+
+		struct DiskEntry
+		{
+			uint64_t size = 0;
+			uint64_t modifiedTime = 0;
+		};
+
+		bool isExpired(uint64_t insertedTime, uint64_t now) const;
+		void insertMemory(const Key& key, const std::shared_ptr<const CloudVisionResponse>& response, uint64_t insertedTime);
+		std::shared_ptr<const CloudVisionResponse> loadDisk(const Key& key, uint64_t& insertedTime);
+		void storeDisk(const Key& key, const CloudVisionResponse& response, uint64_t now);
+		// drops the oldest disk entries from the index until the rest fits maxDiskBytes and
+		// returns them for removeDisk(); called with mMutex held
+		std::vector<Key> evictDisk();
+		void removeDisk(const Key& key);
+		static void removeFile(const string& fileName);
+		void scanDisk();
+		string getFileName(const Key& key) const;
+		static uint64_t now();
+
+		CacheSettings mSettings;
+		string mDirectory;
+		std::list<Entry> mEntries;
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> mIndex;
+		std::unordered_map<Key, DiskEntry, KeyHash> mDiskIndex;
+		CacheStats mStats;
+		mutable std::mutex mMutex;
+		// numbers the temporary files entries are written to before they are renamed into place
+		std::atomic<uint64_t> mNextTemp{ 0 };
+	};
+}
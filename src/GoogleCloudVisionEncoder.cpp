@@ -0,0 +1,130 @@
+#include "GoogleCloudVisionEncoder.h"
+#include "FreeImage.h"
+
+namespace google
+{
+	namespace
+	{
+		// spare buffers kept per encoder, about one batch worth
+		const size_t MAX_FREE_BUFFERS = 16;
+	}
+
+	ImageEncoder::ImageEncoder(const EncoderSettings& settings)
+		:mSettings(settings)
+	{
+		mSettings.quality = std::max(1, std::min(mSettings.quality, 100));
+		if (mSettings.format == OF_IMAGE_FORMAT_WEBP && !FreeImage_FIFSupportsWriting(FIF_WEBP))
+		{
+			ofLogWarning("CloudVision") << "WebP encoding is not available, using JPEG";
+			mSettings.format = OF_IMAGE_FORMAT_JPEG;
+		}
+		else if (mSettings.format != OF_IMAGE_FORMAT_JPEG && mSettings.format != OF_IMAGE_FORMAT_PNG && mSettings.format != OF_IMAGE_FORMAT_WEBP)
+		{
+			ofLogWarning("CloudVision") << "unsupported image format " << mSettings.format << ", using JPEG";
+			mSettings.format = OF_IMAGE_FORMAT_JPEG;
+		}
+		mMemory = FreeImage_OpenMemory();
+	}
+
+	ImageEncoder::~ImageEncoder()
+	{
+		if (mBitmap)
+			FreeImage_Unload(mBitmap);
+		if (mMemory)
+			FreeImage_CloseMemory(mMemory);
+	}
+
+	bool ImageEncoder::prepareBitmap(size_t width, size_t height, unsigned bpp)
+	{
+		if (mBitmap && FreeImage_GetWidth(mBitmap) == width && FreeImage_GetHeight(mBitmap) == height && FreeImage_GetBPP(mBitmap) == bpp)
+			return true;
+		if (mBitmap)
+			FreeImage_Unload(mBitmap);
+		mBitmap = FreeImage_Allocate((int)width, (int)height, (int)bpp);
+		return mBitmap != nullptr;
+	}
+
+	bool ImageEncoder::encode(const ofPixels& pixels, ofBuffer& out)
+	{
+		size_t width = pixels.getWidth();
+		size_t height = pixels.getHeight();
+		size_t channels = pixels.getNumChannels();
+		if (width == 0 || height == 0 || (channels != 1 && channels != 3 && channels != 4) || !mMemory)
+			return false;
+
+		// JPEG has no alpha, it is dropped while copying
+		size_t outChannels = channels == 4 && mSettings.format == OF_IMAGE_FORMAT_JPEG ? 3 : channels;
+		if (!prepareBitmap(width, height, (unsigned)outChannels * 8))
+			return false;
+
+		// FreeImage rows are bottom up and, on little endian machines, in BGR(A) order;
+		// the input is RGB(A) unless a grabber delivered BGR(A)
+		ofPixelFormat pixelFormat = pixels.getPixelFormat();
+		size_t red = pixelFormat == OF_PIXELS_BGR || pixelFormat == OF_PIXELS_BGRA ? 2 : 0;
+		const unsigned char* src = pixels.getData();
+		size_t stride = pixels.getBytesStride();
+		for (size_t y = 0; y < height; y++)
+		{
+			const unsigned char* in = src + y * stride;
+			BYTE* row = FreeImage_GetScanLine(mBitmap, (int)(height - 1 - y));
+			if (channels == 1)
+			{
+				memcpy(row, in, width);
+				continue;
+			}
+			for (size_t x = 0; x < width; x++, in += channels, row += outChannels)
+			{
+				row[FI_RGBA_RED] = in[red];
+				row[1] = in[1];
+				row[FI_RGBA_BLUE] = in[2 - red];
+				if (outChannels == 4)
+					row[3] = in[3];
+			}
+		}
+
+		FREE_IMAGE_FORMAT format = FIF_JPEG;
+		int flags = mSettings.quality;
+		if (mSettings.format == OF_IMAGE_FORMAT_PNG)
+		{
+			format = FIF_PNG;
+			flags = 0;
+		}
+		else if (mSettings.format == OF_IMAGE_FORMAT_WEBP)
+		{
+			format = FIF_WEBP;
+		}
+
+		// the memory stream keeps its capacity, only the bytes up to the write position are new
+		FreeImage_SeekMemory(mMemory, 0, SEEK_SET);
+		if (!FreeImage_SaveToMemory(format, mBitmap, mMemory, flags))
+			return false;
+		long size = FreeImage_TellMemory(mMemory);
+		BYTE* data = nullptr;
+		DWORD capacity = 0;
+		if (size <= 0 || !FreeImage_AcquireMemory(mMemory, &data, &capacity))
+			return false;
+		out.set((const char*)data, (size_t)size);
+		return true;
+	}
+
+	ofBuffer ImageEncoder::getBuffer()
+	{
+		if (mFreeBuffers.empty())
+			return ofBuffer();
+		ofBuffer buffer = std::move(mFreeBuffers.back());
+		mFreeBuffers.pop_back();
+		return buffer;
+	}
+
+	void ImageEncoder::recycle(std::vector<ofBuffer>& buffers)
+	{
+		for (auto& buffer : buffers)
+		{
+			if (mFreeBuffers.size() >= MAX_FREE_BUFFERS)
+				break;
+			buffer.clear();
+			mFreeBuffers.emplace_back(std::move(buffer));
+		}
+		buffers.clear();
+	}
+}
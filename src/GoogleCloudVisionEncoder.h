@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ofMain.h"
+
+struct FIBITMAP;
+struct FIMEMORY;
+
+namespace google
+{
+	struct EncoderSettings
+	{
+		// OF_IMAGE_FORMAT_JPEG, OF_IMAGE_FORMAT_PNG or OF_IMAGE_FORMAT_WEBP; WebP falls back
+		// to JPEG when FreeImage was built without it
+		ofImageFormat format = OF_IMAGE_FORMAT_JPEG;
+		// 1-100 for JPEG and WebP, ignored for PNG
+		int quality = 90;
+	};
+
+	// encodes pixels with FreeImage, keeping the bitmap, the memory stream and spent output
+	// buffers between frames so a steady stream of same sized frames allocates nothing;
+	// not thread safe, every worker has its own
+	class ImageEncoder
+	{
+	public:
+		ImageEncoder(const EncoderSettings& settings);
+		~ImageEncoder();
+		ImageEncoder(const ImageEncoder&) = delete;
+		ImageEncoder& operator=(const ImageEncoder&) = delete;
+
+		// fills out, which should come from getBuffer(); false when encoding failed
+		bool encode(const ofPixels& pixels, ofBuffer& out);
+		// an empty buffer, reusing the storage of a recycled one when there is one
+		ofBuffer getBuffer();
+		// hands buffers back once their contents have been sent
+		void recycle(std::vector<ofBuffer>& buffers);
+
+		ofImageFormat getFormat() const { return mSettings.format; }
+
+	private:
+		bool prepareBitmap(size_t width, size_t height, unsigned bpp);
+
+		EncoderSettings mSettings;
+		FIBITMAP* mBitmap = nullptr;
+		FIMEMORY* mMemory = nullptr;
+		std::vector<ofBuffer> mFreeBuffers;
+	};
+}
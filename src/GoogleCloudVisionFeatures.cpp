@@ -0,0 +1,128 @@
+#include "GoogleCloudVisionFeatures.h"
+#include "GoogleCloudVisionParser.h"
+#include "GoogleCloudVisionProtobuf.h"
+
+namespace google
+{
+	namespace
+	{
+		const Feature FEATURES[NUM_FEATURES] = { FEATURE_LABEL, FEATURE_TEXT, FEATURE_FACE, FEATURE_LANDMARK, FEATURE_LOGO };
+	}
+
+	const char* getFeatureType(Feature feature)
+	{
+		switch (feature)
+		{
+		case FEATURE_LABEL: return "LABEL_DETECTION";
+		case FEATURE_TEXT: return "TEXT_DETECTION";
+		case FEATURE_FACE: return "FACE_DETECTION";
+		case FEATURE_LANDMARK: return "LANDMARK_DETECTION";
+		case FEATURE_LOGO: return "LOGO_DETECTION";
+		default: return "TYPE_UNSPECIFIED";
+		}
+	}
+
+	int getFeatureTypeValue(Feature feature)
+	{
+		// Feature.Type in the protobuf api
+		switch (feature)
+		{
+		case FEATURE_FACE: return 1;
+		case FEATURE_LANDMARK: return 2;
+		case FEATURE_LOGO: return 3;
+		case FEATURE_LABEL: return 4;
+		case FEATURE_TEXT: return 5;
+		default: return 0;
+		}
+	}
+
+	FeatureSet::FeatureSet()
+	{
+
+	}
+
+	size_t FeatureSet::getIndex(Feature feature)
+	{
+		for (size_t i = 0; i < NUM_FEATURES; i++)
+		{
+			if (FEATURES[i] == feature)
+				return i;
+		}
+		return NUM_FEATURES;
+	}
+
+	FeatureSet& FeatureSet::add(Feature feature, size_t maxResults, const string& model)
+	{
+		size_t index = getIndex(feature);
+		if (index == NUM_FEATURES)
+		{
+			ofLogError("CloudVision") << "FeatureSet::add takes a single feature";
+			return *this;
+		}
+		mMask |= feature;
+		mOptions[index].maxResults = maxResults;
+		mOptions[index].model = model;
+		return *this;
+	}
+
+	FeatureSet& FeatureSet::remove(Feature feature)
+	{
+		mMask &= ~(uint32_t)feature;
+		return *this;
+	}
+
+	size_t FeatureSet::getMaxResults(Feature feature) const
+	{
+		size_t index = getIndex(feature);
+		return index < NUM_FEATURES && has(feature) ? mOptions[index].maxResults : 0;
+	}
+
+	size_t FeatureSet::getMaxResults() const
+	{
+		size_t maxResults = 0;
+		for (size_t i = 0; i < NUM_FEATURES; i++)
+		{
+			if (has(FEATURES[i]))
+				maxResults = std::max(maxResults, mOptions[i].maxResults);
+		}
+		return maxResults;
+	}
+
+	string FeatureSet::toJson() const
+	{
+		string json;
+		for (size_t i = 0; i < NUM_FEATURES; i++)
+		{
+			if (!has(FEATURES[i]))
+				continue;
+			if (!json.empty())
+				json += ",";
+			json += ofVAArgsToString(R"({"type":"%s","maxResults":%u)", getFeatureType(FEATURES[i]), (unsigned)mOptions[i].maxResults);
+			if (!mOptions[i].model.empty())
+				json += R"(,"model":)" + toJsonString(mOptions[i].model);
+			json += "}";
+		}
+		return json;
+	}
+
+	string FeatureSet::toProtobuf() const
+	{
+		// Feature { type = 1, max_results = 2, model = 3 }
+		string out;
+		ProtoWriter writer(out);
+		for (size_t i = 0; i < NUM_FEATURES; i++)
+		{
+			if (!has(FEATURES[i]))
+				continue;
+			writer.writeMessage(2, [&](ProtoWriter& feature)
+			{
+				feature.writeInt(1, getFeatureTypeValue(FEATURES[i]));
+				if (mOptions[i].maxResults)
+					feature.writeInt(2, (int64_t)mOptions[i].maxResults);
+				if (!mOptions[i].model.empty())
+					feature.writeBytes(3, mOptions[i].model);
+			});
+		}
+		return out;
+	}
+}
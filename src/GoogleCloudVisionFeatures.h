@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	// one bit per annotation type the addon maps, combined into a feature mask
+	enum Feature : uint32_t
+	{
+		FEATURE_LABEL = 1 << 0,
+		FEATURE_TEXT = 1 << 1,
+		FEATURE_FACE = 1 << 2,
+		FEATURE_LANDMARK = 1 << 3,
+		FEATURE_LOGO = 1 << 4,
+		FEATURE_ALL = (1 << 5) - 1
+	};
+
+	const size_t NUM_FEATURES = 5;
+
+	// "LABEL_DETECTION" etc.
+	const char* getFeatureType(Feature feature);
+	// the Feature.Type number for the protobuf api, FACE_DETECTION = 1 etc.
+	int getFeatureTypeValue(Feature feature);
+
+	// compile time view of a mask, lets serializers and parsers drop whole sections
+	template<uint32_t Mask>
+	struct FeatureMask
+	{
+		static constexpr bool has(Feature feature) { return (Mask & feature) != 0; }
+	};
+
+	// the features requested for an image: which annotations, how many of each and,
+	// optionally, the model version ("builtin/stable", "builtin/latest")
+	class FeatureSet
+	{
+	public:
+		// all five features with 3 results each, what every request used to ask for
+		FeatureSet();
+
+		static FeatureSet none() { FeatureSet features; features.mMask = 0; return features; }
+
+		FeatureSet& add(Feature feature, size_t maxResults = 3, const string& model = "");
+		FeatureSet& remove(Feature feature);
+
+		uint32_t getMask() const { return mMask; }
+		bool has(Feature feature) const { return (mMask & feature) != 0; }
+		size_t getMaxResults(Feature feature) const;
+		// the largest maxResults of the selected features
+		size_t getMaxResults() const;
+		// the features[] array of an AnnotateImageRequest, without the brackets
+		string toJson() const;
+		// the same as repeated AnnotateImageRequest.features, protobuf encoded
+		string toProtobuf() const;
+
+	private:
+		struct Options
+		{
+			size_t maxResults = 3;
+			string model;
+		};
+
+		static size_t getIndex(Feature feature);
+
+		uint32_t mMask = FEATURE_ALL;
+		Options mOptions[NUM_FEATURES];
+	};
+}
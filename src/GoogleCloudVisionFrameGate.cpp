@@ -0,0 +1,64 @@
+#include "GoogleCloudVisionFrameGate.h"
+
+namespace google
+{
+	namespace
+	{
+		const size_t GRID_WIDTH = 9;
+		const size_t GRID_HEIGHT = 8;
+		// samples per cell and axis, at most
+		const size_t CELL_SAMPLES = 8;
+	}
+
+	uint64_t differenceHash(const ofPixels& pixels)
+	{
+		size_t width = pixels.getWidth();
+		size_t height = pixels.getHeight();
+		size_t channels = pixels.getNumChannels();
+		if (width == 0 || height == 0 || channels == 0)
+			return 0;
+		size_t stride = pixels.getBytesStride();
+		const unsigned char* data = pixels.getData();
+
+		uint32_t cells[GRID_HEIGHT][GRID_WIDTH];
+		for (size_t cy = 0; cy < GRID_HEIGHT; cy++)
+		{
+			size_t y0 = cy * height / GRID_HEIGHT;
+			size_t y1 = std::max((cy + 1) * height / GRID_HEIGHT, y0 + 1);
+			size_t stepY = std::max<size_t>((y1 - y0) / CELL_SAMPLES, 1);
+			for (size_t cx = 0; cx < GRID_WIDTH; cx++)
+			{
+				size_t x0 = cx * width / GRID_WIDTH;
+				size_t x1 = std::max((cx + 1) * width / GRID_WIDTH, x0 + 1);
+				size_t stepX = std::max<size_t>((x1 - x0) / CELL_SAMPLES, 1);
+
+				uint32_t sum = 0;
+				uint32_t count = 0;
+				for (size_t y = y0; y < y1; y += stepY)
+				{
+					const unsigned char* row = data + y * stride;
+					for (size_t x = x0; x < x1; x += stepX)
+					{
+						const unsigned char* p = row + x * channels;
+						// integer Rec. 601 luma, grey images are used as they are
+						sum += channels >= 3 ? (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8 : p[0];
+						count++;
+					}
+				}
+				cells[cy][cx] = sum / count;
+			}
+		}
+
+		uint64_t hash = 0;
+		for (size_t cy = 0; cy < GRID_HEIGHT; cy++)
+		{
+			for (size_t cx = 0; cx + 1 < GRID_WIDTH; cx++)
+			{
+				hash <<= 1;
+				if (cells[cy][cx] > cells[cy][cx + 1])
+					hash |= 1;
+			}
+		}
+		return hash;
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct FrameGateSettings
+	{
+		// pushPixels() compares every frame to the last one actually sent
+		bool enabled = false;
+		// frames whose hash differs from it in at most this many of the 64 bits are duplicates
+		int maxDistance = 4;
+		// duplicates of a frame older than this are sent anyway, 0 never forces a refresh
+		uint64_t maxStalenessMillis = 5000;
+	};
+
+	// 64 bit difference hash: brightness of a 9x8 grid of cells, one bit per pair of
+	// horizontal neighbours; cells are averaged from a sparse sample so the cost hardly
+	// depends on the frame size
+	uint64_t differenceHash(const ofPixels& pixels);
+
+	inline int hammingDistance(uint64_t a, uint64_t b)
+	{
+		uint64_t x = a ^ b;
+		int count = 0;
+		for (; x; count++)
+			x &= x - 1;
+		return count;
+	}
+}
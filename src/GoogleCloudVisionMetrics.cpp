@@ -0,0 +1,222 @@
+#include "GoogleCloudVisionMetrics.h"
+#include "Poco/Net/HTTPServer.h"
+#include "Poco/Net/HTTPRequestHandler.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/Net/ServerSocket.h"
+
+using namespace Poco;
+using namespace Poco::Net;
+
+namespace google
+{
+	namespace
+	{
+		const char* PHASE_NAMES[NUM_PHASES] = {
+			"queue_wait", "resize", "encode", "base64", "connect", "upload", "server", "download", "parse", "total"
+		};
+
+		const char* COUNTER_NAMES[NUM_COUNTERS] = {
+			"requests", "images", "failed_images", "connections", "bytes_sent", "bytes_received"
+		};
+
+		class MetricsHandler : public HTTPRequestHandler
+		{
+		public:
+			MetricsHandler(const MetricsServer::Provider& provider) : mProvider(provider) {}
+
+			void handleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override
+			{
+				if (request.getURI() != "/metrics")
+				{
+					response.setStatusAndReason(HTTPResponse::HTTP_NOT_FOUND);
+					response.send();
+					return;
+				}
+				string text = mProvider();
+				response.setContentType("text/plain; version=0.0.4");
+				response.sendBuffer(text.data(), text.size());
+			}
+
+		private:
+			MetricsServer::Provider mProvider;
+		};
+
+		class MetricsHandlerFactory : public HTTPRequestHandlerFactory
+		{
+		public:
+			MetricsHandlerFactory(const MetricsServer::Provider& provider) : mProvider(provider) {}
+
+			HTTPRequestHandler* createRequestHandler(const HTTPServerRequest&) override
+			{
+				return new MetricsHandler(mProvider);
+			}
+
+		private:
+			MetricsServer::Provider mProvider;
+		};
+
+		void appendSample(string& out, const string& name, const string& labels, double value)
+		{
+			out += name;
+			if (!labels.empty())
+				out += "{" + labels + "}";
+			// counts stay exact, fractions get microsecond resolution
+			if (value >= 0 && value == std::floor(value) && value < 1e18)
+				out += " " + ofToString((uint64_t)value) + "\n";
+			else
+				out += " " + ofToString(value, 6) + "\n";
+		}
+	}
+
+	const char* getPhaseName(MetricPhase phase)
+	{
+		return phase < NUM_PHASES ? PHASE_NAMES[phase] : "";
+	}
+
+	const char* getCounterName(MetricCounter counter)
+	{
+		return counter < NUM_COUNTERS ? COUNTER_NAMES[counter] : "";
+	}
+
+	uint64_t HistogramSnapshot::getPercentile(float percentile) const
+	{
+		if (count == 0)
+			return 0;
+		uint64_t rank = (uint64_t)std::ceil(ofClamp(percentile, 0.0f, 1.0f) * count);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < buckets.size(); i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank && seen > 0)
+				return getBucketBound(i);
+		}
+		return getBucketBound(NUM_BUCKETS - 1);
+	}
+
+	string MetricsSnapshot::toPrometheus() const
+	{
+		string out;
+		for (auto& phase : phases)
+		{
+			string name = "cloudvision_" + phase.name + "_seconds";
+			out += "# TYPE " + name + " histogram\n";
+			uint64_t cumulative = 0;
+			for (size_t i = 0; i + 1 < phase.buckets.size(); i++)
+			{
+				cumulative += phase.buckets[i];
+				appendSample(out, name + "_bucket", "le=\"" + ofToString(HistogramSnapshot::getBucketBound(i) / 1e6, 6) + "\"", (double)cumulative);
+			}
+			appendSample(out, name + "_bucket", "le=\"+Inf\"", (double)phase.count);
+			appendSample(out, name + "_sum", "", phase.sumMicros / 1e6);
+			appendSample(out, name + "_count", "", (double)phase.count);
+		}
+		for (auto& counter : counters)
+		{
+			string name = "cloudvision_" + counter.first + "_total";
+			out += "# TYPE " + name + " counter\n";
+			appendSample(out, name, "", (double)counter.second);
+		}
+		for (auto& gauge : gauges)
+		{
+			string name = "cloudvision_" + gauge.first;
+			out += "# TYPE " + name + " gauge\n";
+			appendSample(out, name, "", gauge.second);
+		}
+		if (!stages.empty())
+		{
+			out += "# TYPE cloudvision_stage_items_total counter\n";
+			for (auto& stage : stages)
+				appendSample(out, "cloudvision_stage_items_total", "stage=\"" + stage.name + "\"", (double)stage.items);
+			out += "# TYPE cloudvision_stage_queued gauge\n";
+			for (auto& stage : stages)
+				appendSample(out, "cloudvision_stage_queued", "stage=\"" + stage.name + "\"", (double)stage.queued);
+			out += "# TYPE cloudvision_stage_utilization gauge\n";
+			for (auto& stage : stages)
+				appendSample(out, "cloudvision_stage_utilization", "stage=\"" + stage.name + "\"", stage.utilization);
+		}
+		return out;
+	}
+
+	LatencyHistogram::LatencyHistogram()
+	{
+		for (auto& bucket : mBuckets)
+			bucket = 0;
+	}
+
+	void LatencyHistogram::record(uint64_t micros)
+	{
+		size_t bucket = 0;
+		while (bucket + 1 < HistogramSnapshot::NUM_BUCKETS && micros > HistogramSnapshot::getBucketBound(bucket))
+			bucket++;
+		mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+		mCount.fetch_add(1, std::memory_order_relaxed);
+		mSum.fetch_add(micros, std::memory_order_relaxed);
+	}
+
+	HistogramSnapshot LatencyHistogram::snapshot() const
+	{
+		// the buckets are read one by one, count is their sum so the snapshot stays consistent
+		HistogramSnapshot snapshot;
+		snapshot.buckets.resize(HistogramSnapshot::NUM_BUCKETS);
+		for (size_t i = 0; i < HistogramSnapshot::NUM_BUCKETS; i++)
+		{
+			snapshot.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+			snapshot.count += snapshot.buckets[i];
+		}
+		snapshot.sumMicros = mSum.load(std::memory_order_relaxed);
+		return snapshot;
+	}
+
+	Metrics::Metrics()
+	{
+		for (auto& counter : mCounters)
+			counter = 0;
+	}
+
+	void Metrics::snapshot(MetricsSnapshot& snapshot) const
+	{
+		for (size_t i = 0; i < NUM_PHASES; i++)
+		{
+			snapshot.phases.push_back(mPhases[i].snapshot());
+			snapshot.phases.back().name = getPhaseName((MetricPhase)i);
+		}
+		for (size_t i = 0; i < NUM_COUNTERS; i++)
+			snapshot.counters.emplace_back(getCounterName((MetricCounter)i), mCounters[i].load(std::memory_order_relaxed));
+	}
+
+	MetricsServer::MetricsServer(uint16_t port, Provider provider)
+	{
+		try {
+			ServerSocket socket(SocketAddress("127.0.0.1", port));
+			HTTPServerParams* params = new HTTPServerParams;
+			params->setMaxThreads(1);
+			mServer.reset(new HTTPServer(new MetricsHandlerFactory(provider), socket, params));
+			mServer->start();
+		}
+		catch (Exception& exc) {
+			ofLogError("CloudVision") << "could not serve metrics on port " << port << ": " << exc.displayText();
+		}
+	}
+
+	MetricsServer::~MetricsServer()
+	{
+		if (mServer)
+			mServer->stopAll(true);
+	}
+
+	CountingStreamBuffer::int_type CountingStreamBuffer::underflow()
+	{
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+		mSource.read(mBuffer, sizeof(mBuffer));
+		std::streamsize count = mSource.gcount();
+		if (count <= 0)
+			return traits_type::eof();
+		mCount += count;
+		setg(mBuffer, mBuffer, mBuffer + count);
+		return traits_type::to_int_type(*gptr());
+	}
+}
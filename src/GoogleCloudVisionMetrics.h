@@ -0,0 +1,137 @@
+#pragma once
+
+#include "ofMain.h"
+#include "GoogleCloudVisionStage.h"
+
+namespace Poco { namespace Net { class HTTPServer; } }
+
+namespace google
+{
+	struct MetricsSettings
+	{
+		// latency histograms and transfer counters, nothing is measured while disabled
+		bool enabled = false;
+		// serves the metrics in Prometheus text format on 127.0.0.1:port/metrics, 0 for no server
+		uint16_t prometheusPort = 0;
+	};
+
+	enum MetricPhase
+	{
+		// waiting in the queues in front of the encode and request stages
+		PHASE_QUEUE_WAIT,
+		PHASE_RESIZE,
+		PHASE_ENCODE,
+		// building the request body, mostly base64
+		PHASE_BASE64,
+		// TCP connect and TLS handshake of new connections; Poco does both in the first
+		// send, so they are measured together with the request headers
+		PHASE_CONNECT,
+		PHASE_UPLOAD,
+		// from the end of the upload to the response headers
+		PHASE_SERVER,
+		// reading a buffered response body, a streamed one is read while it is parsed
+		PHASE_DOWNLOAD,
+		PHASE_PARSE,
+		// push to delivery
+		PHASE_TOTAL,
+		NUM_PHASES
+	};
+
+	enum MetricCounter
+	{
+		COUNTER_REQUESTS,
+		COUNTER_IMAGES,
+		COUNTER_FAILED_IMAGES,
+		COUNTER_CONNECTIONS,
+		COUNTER_BYTES_SENT,
+		COUNTER_BYTES_RECEIVED,
+		NUM_COUNTERS
+	};
+
+	const char* getPhaseName(MetricPhase phase);
+	const char* getCounterName(MetricCounter counter);
+
+	struct HistogramSnapshot
+	{
+		// bucket i counts samples up to getBucketBound(i) microseconds, the last one the rest
+		static const size_t NUM_BUCKETS = 28;
+		static uint64_t getBucketBound(size_t bucket) { return (uint64_t)1 << bucket; }
+
+		string name;
+		uint64_t count = 0;
+		uint64_t sumMicros = 0;
+		std::vector<uint64_t> buckets;
+
+		double getMeanMicros() const { return count ? (double)sumMicros / count : 0; }
+		// upper bound of the bucket the percentile falls in
+		uint64_t getPercentile(float percentile) const;
+	};
+
+	struct MetricsSnapshot
+	{
+		// empty unless MetricsSettings::enabled
+		std::vector<HistogramSnapshot> phases;
+		std::vector<std::pair<string, uint64_t>> counters;
+		std::vector<std::pair<string, double>> gauges;
+		std::vector<StageStats> stages;
+
+		string toPrometheus() const;
+	};
+
+	// power of two buckets of atomics, recording is a few relaxed increments
+	class LatencyHistogram
+	{
+	public:
+		LatencyHistogram();
+		void record(uint64_t micros);
+		HistogramSnapshot snapshot() const;
+
+	private:
+		std::atomic<uint64_t> mBuckets[HistogramSnapshot::NUM_BUCKETS];
+		std::atomic<uint64_t> mCount{ 0 };
+		std::atomic<uint64_t> mSum{ 0 };
+	};
+
+	class Metrics
+	{
+	public:
+		Metrics();
+		void record(MetricPhase phase, uint64_t micros) { mPhases[phase].record(micros); }
+		void add(MetricCounter counter, uint64_t value = 1) { mCounters[counter].fetch_add(value, std::memory_order_relaxed); }
+		// phases and counters
+		void snapshot(MetricsSnapshot& snapshot) const;
+
+	private:
+		LatencyHistogram mPhases[NUM_PHASES];
+		std::atomic<uint64_t> mCounters[NUM_COUNTERS];
+	};
+
+	// answers GET /metrics with the text the provider returns, on its own thread
+	class MetricsServer
+	{
+	public:
+		typedef std::function<string()> Provider;
+
+		MetricsServer(uint16_t port, Provider provider);
+		~MetricsServer();
+
+	private:
+		std::unique_ptr<Poco::Net::HTTPServer> mServer;
+	};
+
+	// counts what is read through it from another stream
+	class CountingStreamBuffer : public std::streambuf
+	{
+	public:
+		CountingStreamBuffer(std::istream& source) : mSource(source) {}
+		uint64_t getCount() const { return mCount; }
+
+	protected:
+		int_type underflow() override;
+
+	private:
+		std::istream& mSource;
+		char mBuffer[4096];
+		uint64_t mCount = 0;
+	};
+}
@@ -0,0 +1,958 @@
+#include "GoogleCloudVisionParser.h"
+#include "GoogleCloudVision.h"
+
+namespace google
+{
+	JsonReader::JsonReader(std::istream& in)
+		:mIn(in)
+	{
+
+	}
+
+	int JsonReader::get()
+	{
+		if (mPos == mEnd)
+		{
+			if (!mIn.good())
+				return -1;
+			mIn.read(mBuffer, sizeof(mBuffer));
+			mOffset += mEnd;
+			mEnd = (size_t)mIn.gcount();
+			mPos = 0;
+			if (mEnd == 0)
+				return -1;
+		}
+		return (unsigned char)mBuffer[mPos++];
+	}
+
+	int JsonReader::peekChar()
+	{
+		int c = get();
+		if (c >= 0)
+			mPos--;
+		return c;
+	}
+
+	int JsonReader::next()
+	{
+		while (true)
+		{
+			int c = peekChar();
+			if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+				return c;
+			mPos++;
+		}
+	}
+
+	bool JsonReader::expect(char c)
+	{
+		if (mFailed)
+			return false;
+		if (next() != c)
+			return fail(string("expected '") + c + "'");
+		mPos++;
+		return true;
+	}
+
+	bool JsonReader::fail(const string& error)
+	{
+		if (!mFailed)
+		{
+			mFailed = true;
+			mError = error + " at offset " + ofToString(mOffset + mPos);
+		}
+		return false;
+	}
+
+	JsonReader::Type JsonReader::peek()
+	{
+		if (mFailed)
+			return TYPE_NONE;
+		int c = next();
+		switch (c)
+		{
+		case '{': return TYPE_OBJECT;
+		case '[': return TYPE_ARRAY;
+		case '"': return TYPE_STRING;
+		case 't': case 'f': return TYPE_BOOLEAN;
+		case 'n': return TYPE_NULL;
+		case -1: return TYPE_NONE;
+		default:
+			if (c == '-' || (c >= '0' && c <= '9'))
+				return TYPE_NUMBER;
+			fail("unexpected character");
+			return TYPE_NONE;
+		}
+	}
+
+	bool JsonReader::enterObject()
+	{
+		if (!expect('{'))
+			return false;
+		mFirst.push_back(true);
+		return true;
+	}
+
+	bool JsonReader::nextMember(string& key)
+	{
+		if (mFailed || mFirst.empty())
+			return false;
+		int c = next();
+		if (c == '}')
+		{
+			mPos++;
+			mFirst.pop_back();
+			return false;
+		}
+		if (mFirst.back())
+			mFirst.back() = false;
+		else if (!expect(','))
+			return false;
+		return readString(key) && expect(':');
+	}
+
+	bool JsonReader::enterArray()
+	{
+		if (!expect('['))
+			return false;
+		mFirst.push_back(true);
+		return true;
+	}
+
+	bool JsonReader::nextElement()
+	{
+		if (mFailed || mFirst.empty())
+			return false;
+		int c = next();
+		if (c == ']')
+		{
+			mPos++;
+			mFirst.pop_back();
+			return false;
+		}
+		if (mFirst.back())
+			mFirst.back() = false;
+		else if (!expect(','))
+			return false;
+		return true;
+	}
+
+	bool JsonReader::readString(string& out)
+	{
+		if (!expect('"'))
+			return false;
+		out.clear();
+		while (true)
+		{
+			// copy runs of plain characters straight out of the block
+			size_t start = mPos;
+			while (mPos < mEnd && mBuffer[mPos] != '"' && mBuffer[mPos] != '\\')
+				mPos++;
+			out.append(mBuffer + start, mPos - start);
+
+			int c = get();
+			if (c == '"')
+				return true;
+			if (c < 0)
+				return fail("unterminated string");
+			if (c != '\\')
+			{
+				// the block ran out, get() refilled it
+				out += (char)c;
+				continue;
+			}
+
+			c = get();
+			switch (c)
+			{
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				uint32_t codepoint;
+				if (!readHex(codepoint))
+					return false;
+				// surrogate pair
+				if (codepoint >= 0xd800 && codepoint <= 0xdbff && peekChar() == '\\')
+				{
+					mPos++;
+					uint32_t low;
+					if (get() != 'u' || !readHex(low))
+						return fail("invalid surrogate pair");
+					codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+				}
+				appendUtf8(out, codepoint);
+				break;
+			}
+			default:
+				return fail("invalid escape");
+			}
+		}
+	}
+
+	bool JsonReader::skipString()
+	{
+		// the opening quote has been consumed
+		while (true)
+		{
+			while (mPos < mEnd && mBuffer[mPos] != '"' && mBuffer[mPos] != '\\')
+				mPos++;
+			int c = get();
+			if (c == '"')
+				return true;
+			if (c < 0)
+				return fail("unterminated string");
+			if (c == '\\' && get() < 0)
+				return fail("unterminated string");
+		}
+	}
+
+	bool JsonReader::readHex(uint32_t& out)
+	{
+		out = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			int c = get();
+			out <<= 4;
+			if (c >= '0' && c <= '9')
+				out |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				out |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				out |= c - 'A' + 10;
+			else
+				return fail("invalid unicode escape");
+		}
+		return true;
+	}
+
+	void JsonReader::appendUtf8(string& out, uint32_t codepoint)
+	{
+		if (codepoint < 0x80)
+		{
+			out += (char)codepoint;
+		}
+		else if (codepoint < 0x800)
+		{
+			out += (char)(0xc0 | (codepoint >> 6));
+			out += (char)(0x80 | (codepoint & 0x3f));
+		}
+		else if (codepoint < 0x10000)
+		{
+			out += (char)(0xe0 | (codepoint >> 12));
+			out += (char)(0x80 | ((codepoint >> 6) & 0x3f));
+			out += (char)(0x80 | (codepoint & 0x3f));
+		}
+		else
+		{
+			out += (char)(0xf0 | (codepoint >> 18));
+			out += (char)(0x80 | ((codepoint >> 12) & 0x3f));
+			out += (char)(0x80 | ((codepoint >> 6) & 0x3f));
+			out += (char)(0x80 | (codepoint & 0x3f));
+		}
+	}
+
+	bool JsonReader::readNumber(double& out)
+	{
+		if (mFailed)
+			return false;
+		char number[64];
+		size_t length = 0;
+		next();
+		while (true)
+		{
+			int c = peekChar();
+			if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+				break;
+			if (length + 1 >= sizeof(number))
+				return fail("number too long");
+			number[length++] = (char)c;
+			mPos++;
+		}
+		number[length] = 0;
+		char* end = nullptr;
+		out = strtod(number, &end);
+		if (length == 0 || end != number + length)
+			return fail("invalid number");
+		return true;
+	}
+
+	bool JsonReader::readLiteral(const char* literal)
+	{
+		next();
+		for (const char* c = literal; *c; c++)
+		{
+			if (get() != *c)
+				return fail("invalid literal");
+		}
+		return true;
+	}
+
+	bool JsonReader::readBool(bool& out)
+	{
+		if (peek() != TYPE_BOOLEAN)
+			return fail("expected a boolean");
+		out = peekChar() == 't';
+		return readLiteral(out ? "true" : "false");
+	}
+
+	bool JsonReader::read(double& out)
+	{
+		switch (peek())
+		{
+		case TYPE_NUMBER:
+			return readNumber(out);
+		case TYPE_STRING:
+			// 64 bit integers are sent as strings
+			if (!readString(mScratch))
+				return false;
+			out = strtod(mScratch.c_str(), nullptr);
+			return true;
+		default:
+			return skipValue();
+		}
+	}
+
+	bool JsonReader::read(float& out)
+	{
+		double value = out;
+		bool result = read(value);
+		out = (float)value;
+		return result;
+	}
+
+	bool JsonReader::read(int& out)
+	{
+		double value = out;
+		bool result = read(value);
+		out = (int)value;
+		return result;
+	}
+
+	bool JsonReader::read(string& out)
+	{
+		if (peek() == TYPE_STRING)
+			return readString(out);
+		out.clear();
+		return skipValue();
+	}
+
+	bool JsonReader::skipValue()
+	{
+		switch (peek())
+		{
+		case TYPE_STRING:
+			mPos++;
+			return skipString();
+		case TYPE_NUMBER:
+		{
+			double value;
+			return readNumber(value);
+		}
+		case TYPE_BOOLEAN:
+			return readLiteral(peekChar() == 't' ? "true" : "false");
+		case TYPE_NULL:
+			return readLiteral("null");
+		case TYPE_OBJECT:
+		case TYPE_ARRAY:
+		{
+			// only brackets and strings matter while skipping a container
+			int depth = 0;
+			do
+			{
+				int c = get();
+				if (c < 0)
+					return fail("unexpected end of input");
+				if (c == '{' || c == '[')
+					depth++;
+				else if (c == '}' || c == ']')
+					depth--;
+				else if (c == '"' && !skipString())
+					return false;
+			} while (depth > 0);
+			return true;
+		}
+		default:
+			return fail("expected a value");
+		}
+	}
+
+	bool JsonReader::finish()
+	{
+		if (mFailed)
+			return false;
+		if (next() != -1)
+			return fail("trailing characters");
+		return true;
+	}
+
+	namespace
+	{
+		// every parse function below is called with the reader in front of the value it
+		// reads and leaves it behind that value; member names share one string because
+		// each one is compared before anything nested is read. Geometry is collected in
+		// the scratch vectors, which keep their capacity, and copied into the arena once complete
+		struct Context
+		{
+			Context(std::istream& in) : reader(in) {}
+			JsonReader reader;
+			string key;
+			string text;
+			ResponseArena* arena = nullptr;
+			std::vector<ofVec2f> vertices;
+			std::vector<Landmark> landmarks;
+			std::vector<latLng> locations;
+
+			StringRef intern()
+			{
+				reader.read(text);
+				return internString(text);
+			}
+
+			StringRef store()
+			{
+				reader.read(text);
+				return arena->store(text);
+			}
+
+			Likelihood likelihood()
+			{
+				reader.read(text);
+				return toLikelihood(text);
+			}
+		};
+
+		bool parseVertices(Context& ctx, BoundingPoly& poly)
+		{
+			auto& r = ctx.reader;
+			if (r.peek() != JsonReader::TYPE_OBJECT)
+				return r.skipValue();
+			auto& vertices = ctx.vertices;
+			vertices.clear();
+			r.enterObject();
+			while (r.nextMember(ctx.key))
+			{
+				if (ctx.key != "vertices" || r.peek() != JsonReader::TYPE_ARRAY)
+				{
+					r.skipValue();
+					continue;
+				}
+				r.enterArray();
+				while (r.nextElement())
+				{
+					if (r.peek() != JsonReader::TYPE_OBJECT)
+					{
+						r.skipValue();
+						continue;
+					}
+					// missing coordinates are 0
+					ofVec2f vertex(0, 0);
+					r.enterObject();
+					while (r.nextMember(ctx.key))
+					{
+						if (ctx.key == "x")
+							r.read(vertex.x);
+						else if (ctx.key == "y")
+							r.read(vertex.y);
+						else
+							r.skipValue();
+					}
+					vertices.push_back(vertex);
+				}
+			}
+			poly.vertices = ctx.arena->store(vertices);
+			return !r.failed();
+		}
+
+		bool parseLandmarks(Context& ctx, Span<Landmark>& result)
+		{
+			auto& r = ctx.reader;
+			if (r.peek() != JsonReader::TYPE_ARRAY)
+				return r.skipValue();
+			auto& landmarks = ctx.landmarks;
+			landmarks.clear();
+			r.enterArray();
+			while (r.nextElement())
+			{
+				if (r.peek() != JsonReader::TYPE_OBJECT)
+				{
+					r.skipValue();
+					continue;
+				}
+				Landmark landmark;
+				landmark.position.set(0, 0, 0);
+				r.enterObject();
+				while (r.nextMember(ctx.key))
+				{
+					if (ctx.key == "type")
+					{
+						landmark.type = ctx.intern();
+					}
+					else if (ctx.key == "position" && r.peek() == JsonReader::TYPE_OBJECT)
+					{
+						r.enterObject();
+						while (r.nextMember(ctx.key))
+						{
+							if (ctx.key == "x")
+								r.read(landmark.position.x);
+							else if (ctx.key == "y")
+								r.read(landmark.position.y);
+							else if (ctx.key == "z")
+								r.read(landmark.position.z);
+							else
+								r.skipValue();
+						}
+					}
+					else
+					{
+						r.skipValue();
+					}
+				}
+				landmarks.push_back(landmark);
+			}
+			result = ctx.arena->store(landmarks);
+			return !r.failed();
+		}
+
+		bool parseLocations(Context& ctx, Span<latLng>& result)
+		{
+			auto& r = ctx.reader;
+			if (r.peek() != JsonReader::TYPE_ARRAY)
+				return r.skipValue();
+			auto& locations = ctx.locations;
+			locations.clear();
+			r.enterArray();
+			while (r.nextElement())
+			{
+				if (r.peek() != JsonReader::TYPE_OBJECT)
+				{
+					r.skipValue();
+					continue;
+				}
+				latLng location = { 0.0, 0.0 };
+				r.enterObject();
+				while (r.nextMember(ctx.key))
+				{
+					if (ctx.key != "latLng" || r.peek() != JsonReader::TYPE_OBJECT)
+					{
+						r.skipValue();
+						continue;
+					}
+					r.enterObject();
+					while (r.nextMember(ctx.key))
+					{
+						if (ctx.key == "latitude")
+							r.read(location.latitude);
+						else if (ctx.key == "longitude")
+							r.read(location.longitude);
+						else
+							r.skipValue();
+					}
+				}
+				locations.push_back(location);
+			}
+			result = ctx.arena->store(locations);
+			return !r.failed();
+		}
+
+		// calls member(annotation) with the reader in front of each member's value
+		template<typename T, typename F>
+		bool parseAnnotations(Context& ctx, std::vector<T>& annotations, size_t expected, F member)
+		{
+			auto& r = ctx.reader;
+			if (r.peek() != JsonReader::TYPE_ARRAY)
+				return r.skipValue();
+			r.enterArray();
+			annotations.reserve(expected);
+			while (r.nextElement())
+			{
+				if (r.peek() != JsonReader::TYPE_OBJECT)
+				{
+					r.skipValue();
+					continue;
+				}
+				T annotation = T();
+				r.enterObject();
+				while (r.nextMember(ctx.key))
+					member(annotation);
+				annotations.push_back(annotation);
+			}
+			return !r.failed();
+		}
+
+		// {"code":..,"message":..,"status":..}, returns the message
+		string parseError(Context& ctx)
+		{
+			auto& r = ctx.reader;
+			string message;
+			if (r.peek() != JsonReader::TYPE_OBJECT)
+			{
+				r.skipValue();
+				return message;
+			}
+			r.enterObject();
+			while (r.nextMember(ctx.key))
+			{
+				if (ctx.key == "message")
+					r.read(message);
+				else
+					r.skipValue();
+			}
+			return message;
+		}
+
+		// one instantiation per feature mask: the sections that were not requested are
+		// compiled out and skipped like any other unknown member
+		template<size_t Mask>
+		bool parseImageResponse(Context& ctx, CloudVisionResponse& res, size_t expected)
+		{
+			typedef FeatureMask<Mask> Features;
+			auto& r = ctx.reader;
+			if (r.peek() != JsonReader::TYPE_OBJECT)
+				return r.skipValue();
+			if (!res.arena)
+				res.arena = make_shared<ResponseArena>();
+			ctx.arena = res.arena.get();
+			r.enterObject();
+			while (r.nextMember(ctx.key))
+			{
+				if (Features::has(FEATURE_LABEL) && ctx.key == "labelAnnotations")
+				{
+					parseAnnotations(ctx, res.labelAnnotations, expected, [&ctx](LabelAnnotation& label)
+					{
+						auto& key = ctx.key;
+						if (key == "mid") label.mid = ctx.intern();
+						else if (key == "description") label.description = ctx.intern();
+						else if (key == "score") ctx.reader.read(label.score);
+						else ctx.reader.skipValue();
+					});
+				}
+				else if (Features::has(FEATURE_TEXT) && ctx.key == "textAnnotations")
+				{
+					parseAnnotations(ctx, res.textAnnotations, expected, [&ctx](TextAnnotation& text)
+					{
+						auto& key = ctx.key;
+						if (key == "locale") text.locale = ctx.intern();
+						else if (key == "description") text.description = ctx.store();
+						else if (key == "boundingPoly") parseVertices(ctx, text.boundingPoly);
+						else ctx.reader.skipValue();
+					});
+				}
+				else if (Features::has(FEATURE_LOGO) && ctx.key == "logoAnnotations")
+				{
+					parseAnnotations(ctx, res.logoAnnotations, expected, [&ctx](LogoAnnotation& logo)
+					{
+						auto& key = ctx.key;
+						if (key == "mid") logo.mid = ctx.intern();
+						else if (key == "description") logo.description = ctx.intern();
+						else if (key == "score") ctx.reader.read(logo.score);
+						else if (key == "boundingPoly") parseVertices(ctx, logo.boundingPoly);
+						else ctx.reader.skipValue();
+					});
+				}
+				else if (Features::has(FEATURE_LANDMARK) && ctx.key == "landmarkAnnotations")
+				{
+					parseAnnotations(ctx, res.landmarkAnnotations, expected, [&ctx](LandmarkAnnotation& landmark)
+					{
+						auto& key = ctx.key;
+						if (key == "mid") landmark.mid = ctx.intern();
+						else if (key == "description") landmark.description = ctx.intern();
+						else if (key == "score") ctx.reader.read(landmark.score);
+						else if (key == "boundingPoly") parseVertices(ctx, landmark.boundingPoly);
+						else if (key == "locations") parseLocations(ctx, landmark.locations);
+						else ctx.reader.skipValue();
+					});
+				}
+				else if (Features::has(FEATURE_FACE) && ctx.key == "faceAnnotations")
+				{
+					parseAnnotations(ctx, res.faceAnnotations, expected, [&ctx](FaceAnnotation& face)
+					{
+						auto& key = ctx.key;
+						auto& r = ctx.reader;
+						if (key == "boundingPoly") parseVertices(ctx, face.boundingPoly);
+						else if (key == "fdBoundingPoly") parseVertices(ctx, face.fdBoundingPoly);
+						else if (key == "landmarks") parseLandmarks(ctx, face.landmarks);
+						else if (key == "rollAngle") r.read(face.rollAngle);
+						else if (key == "panAngle") r.read(face.panAngle);
+						else if (key == "tiltAngle") r.read(face.tiltAngle);
+						else if (key == "detectionConfidence") r.read(face.detectionConfidence);
+						else if (key == "landmarkingConfidence") r.read(face.landmarkingConfidence);
+						else if (key == "joyLikelihood") face.joy = ctx.likelihood();
+						else if (key == "sorrowLikelihood") face.sorrow = ctx.likelihood();
+						else if (key == "angerLikelihood") face.anger = ctx.likelihood();
+						else if (key == "surpriseLikelihood") face.surprise = ctx.likelihood();
+						else if (key == "underExposedLikelihood") face.underExposed = ctx.likelihood();
+						else if (key == "blurredLikelihood") face.blurred = ctx.likelihood();
+						else if (key == "headwearLikelihood") face.headwear = ctx.likelihood();
+						else r.skipValue();
+					});
+				}
+				else if (ctx.key == "error")
+				{
+					res.status = REQUEST_API_ERROR;
+					res.error = parseError(ctx);
+				}
+				else
+				{
+					// fullTextAnnotation and everything else that is not mapped
+					r.skipValue();
+				}
+			}
+			return !r.failed();
+		}
+
+		typedef bool(*ImageParser)(Context& ctx, CloudVisionResponse& res, size_t expected);
+
+		template<size_t... Masks>
+		const ImageParser* makeImageParsers(std::index_sequence<Masks...>)
+		{
+			static const ImageParser parsers[] = { &parseImageResponse<Masks>... };
+			return parsers;
+		}
+
+		// indexed by feature mask
+		const ImageParser* IMAGE_PARSERS = makeImageParsers(std::make_index_sequence<FEATURE_ALL + 1>());
+	}
+
+	void parseAnnotateResponse(std::istream& in, int httpStatus, const string& reason,
+		const std::vector<CloudVisionResponse*>& responses, size_t expectedResults)
+	{
+		Context ctx(in);
+		auto& r = ctx.reader;
+		size_t count = 0;
+		string error;
+		bool hasError = false;
+
+		if (r.peek() == JsonReader::TYPE_OBJECT)
+		{
+			r.enterObject();
+			while (r.nextMember(ctx.key))
+			{
+				if (ctx.key == "responses" && r.peek() == JsonReader::TYPE_ARRAY)
+				{
+					// responses[] follows the order of requests[]
+					r.enterArray();
+					while (r.nextElement())
+					{
+						if (count < responses.size())
+							IMAGE_PARSERS[responses[count]->features & FEATURE_ALL](ctx, *responses[count], expectedResults);
+						else
+							r.skipValue();
+						count++;
+					}
+				}
+				else if (ctx.key == "error")
+				{
+					hasError = true;
+					error = parseError(ctx);
+				}
+				else
+				{
+					r.skipValue();
+				}
+			}
+			r.finish();
+		}
+		else
+		{
+			r.skipValue();
+			if (!r.failed())
+				r.finish();
+		}
+
+		if (httpStatus != 200 || hasError)
+		{
+			if (error.empty())
+				error = reason;
+			for (auto res : responses)
+			{
+				res->status = httpStatus == 429 ? REQUEST_THROTTLED : REQUEST_FAILED;
+				res->error = error;
+			}
+			return;
+		}
+
+		if (r.failed())
+			ofLogError("CloudVision") << "failed to parse response: " << r.getError();
+		else if (count != responses.size())
+			ofLogError("CloudVision") << "expected " << responses.size() << " responses, got " << count;
+
+		for (size_t i = 0; i < responses.size(); i++)
+		{
+			auto res = responses[i];
+			if (res->status != REQUEST_OK)
+				continue;
+			if (r.failed())
+			{
+				res->status = REQUEST_PARSE_FAILED;
+				res->error = r.getError();
+			}
+			else if (i >= count)
+			{
+				res->status = REQUEST_FAILED;
+				res->error = "missing from responses";
+			}
+		}
+	}
+
+
+	namespace
+	{
+		void writeString(std::ostream& out, const char* data, size_t size)
+		{
+			out << '"';
+			for (size_t i = 0; i < size; i++)
+			{
+				unsigned char c = data[i];
+				if (c == '"' || c == '\\')
+				{
+					out << '\\' << (char)c;
+				}
+				else if (c < 0x20)
+				{
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+					out << escaped;
+				}
+				else
+				{
+					out << (char)c;
+				}
+			}
+			out << '"';
+		}
+
+		void writeString(std::ostream& out, const StringRef& text)
+		{
+			writeString(out, text.data(), text.size());
+		}
+
+		void writeVertices(std::ostream& out, const BoundingPoly& poly)
+		{
+			out << "{\"vertices\":[";
+			for (size_t i = 0; i < poly.vertices.size(); i++)
+			{
+				auto& vertex = poly.vertices[i];
+				out << (i ? "," : "") << "{\"x\":" << vertex.x << ",\"y\":" << vertex.y << "}";
+			}
+			out << "]}";
+		}
+
+		// member(annotation) writes the members of one object, without the braces
+		template<typename T, typename F>
+		void writeAnnotations(std::ostream& out, const char* name, const std::vector<T>& annotations, bool& first, F member)
+		{
+			if (annotations.empty())
+				return;
+			out << (first ? "\"" : ",\"") << name << "\":[";
+			first = false;
+			for (size_t i = 0; i < annotations.size(); i++)
+			{
+				out << (i ? ",{" : "{");
+				member(annotations[i]);
+				out << "}";
+			}
+			out << "]";
+		}
+	}
+
+	string toJsonString(const string& text)
+	{
+		std::ostringstream out;
+		writeString(out, text.data(), text.size());
+		return out.str();
+	}
+
+	void writeAnnotateResponse(std::ostream& out, const std::vector<const CloudVisionResponse*>& responses)
+	{
+		// enough digits for floats and doubles to read back unchanged
+		auto precision = out.precision(17);
+		out << "{\"responses\":[";
+		for (size_t i = 0; i < responses.size(); i++)
+		{
+			auto& res = *responses[i];
+			bool first = true;
+			out << (i ? ",{" : "{");
+			writeAnnotations(out, "labelAnnotations", res.labelAnnotations, first, [&out](const LabelAnnotation& label)
+			{
+				out << "\"mid\":";
+				writeString(out, label.mid);
+				out << ",\"description\":";
+				writeString(out, label.description);
+				out << ",\"score\":" << label.score;
+			});
+			writeAnnotations(out, "textAnnotations", res.textAnnotations, first, [&out](const TextAnnotation& text)
+			{
+				out << "\"locale\":";
+				writeString(out, text.locale);
+				out << ",\"description\":";
+				writeString(out, text.description);
+				out << ",\"boundingPoly\":";
+				writeVertices(out, text.boundingPoly);
+			});
+			writeAnnotations(out, "logoAnnotations", res.logoAnnotations, first, [&out](const LogoAnnotation& logo)
+			{
+				out << "\"mid\":";
+				writeString(out, logo.mid);
+				out << ",\"description\":";
+				writeString(out, logo.description);
+				out << ",\"score\":" << logo.score << ",\"boundingPoly\":";
+				writeVertices(out, logo.boundingPoly);
+			});
+			writeAnnotations(out, "landmarkAnnotations", res.landmarkAnnotations, first, [&out](const LandmarkAnnotation& landmark)
+			{
+				out << "\"mid\":";
+				writeString(out, landmark.mid);
+				out << ",\"description\":";
+				writeString(out, landmark.description);
+				out << ",\"score\":" << landmark.score << ",\"boundingPoly\":";
+				writeVertices(out, landmark.boundingPoly);
+				out << ",\"locations\":[";
+				for (size_t j = 0; j < landmark.locations.size(); j++)
+				{
+					auto& location = landmark.locations[j];
+					out << (j ? "," : "") << "{\"latLng\":{\"latitude\":" << location.latitude
+						<< ",\"longitude\":" << location.longitude << "}}";
+				}
+				out << "]";
+			});
+			writeAnnotations(out, "faceAnnotations", res.faceAnnotations, first, [&out](const FaceAnnotation& face)
+			{
+				out << "\"boundingPoly\":";
+				writeVertices(out, face.boundingPoly);
+				out << ",\"fdBoundingPoly\":";
+				writeVertices(out, face.fdBoundingPoly);
+				out << ",\"landmarks\":[";
+				for (size_t j = 0; j < face.landmarks.size(); j++)
+				{
+					auto& landmark = face.landmarks[j];
+					out << (j ? "," : "") << "{\"type\":";
+					writeString(out, landmark.type);
+					out << ",\"position\":{\"x\":" << landmark.position.x << ",\"y\":" << landmark.position.y
+						<< ",\"z\":" << landmark.position.z << "}}";
+				}
+				out << "],\"rollAngle\":" << face.rollAngle
+					<< ",\"panAngle\":" << face.panAngle
+					<< ",\"tiltAngle\":" << face.tiltAngle
+					<< ",\"detectionConfidence\":" << face.detectionConfidence
+					<< ",\"landmarkingConfidence\":" << face.landmarkingConfidence
+					<< ",\"joyLikelihood\":\"" << toString(face.joy)
+					<< "\",\"sorrowLikelihood\":\"" << toString(face.sorrow)
+					<< "\",\"angerLikelihood\":\"" << toString(face.anger)
+					<< "\",\"surpriseLikelihood\":\"" << toString(face.surprise)
+					<< "\",\"underExposedLikelihood\":\"" << toString(face.underExposed)
+					<< "\",\"blurredLikelihood\":\"" << toString(face.blurred)
+					<< "\",\"headwearLikelihood\":\"" << toString(face.headwear) << "\"";
+			});
+			out << "}";
+		}
+		out << "]}\n";
+		out.precision(precision);
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct CloudVisionResponse;
+
+	// lets the parsers read a buffer in place through an istream
+	struct MemoryBuffer : public std::streambuf
+	{
+		MemoryBuffer(const char* data, size_t size)
+		{
+			char* begin = const_cast<char*>(data);
+			setg(begin, begin, begin + size);
+		}
+
+		const char* data() const { return eback(); }
+		size_t size() const { return egptr() - eback(); }
+	};
+
+	// pull parser reading json straight from a stream in small blocks; values that are
+	// not asked for are skipped without being stored, errors never throw but put the
+	// reader in a failed state that every later call reports
+	class JsonReader
+	{
+	public:
+		enum Type
+		{
+			TYPE_NONE,
+			TYPE_OBJECT,
+			TYPE_ARRAY,
+			TYPE_STRING,
+			TYPE_NUMBER,
+			TYPE_BOOLEAN,
+			TYPE_NULL
+		};
+
+		JsonReader(std::istream& in);
+
+		// type of the next value, TYPE_NONE at the end of the input or after an error
+		Type peek();
+		bool enterObject();
+		// reads the next member name, false once the closing brace has been consumed
+		bool nextMember(string& key);
+		bool enterArray();
+		// false once the closing bracket has been consumed
+		bool nextElement();
+
+		bool readString(string& out);
+		bool readNumber(double& out);
+		bool readBool(bool& out);
+		// numbers and strings are converted, anything else is skipped and leaves out untouched
+		bool read(float& out);
+		bool read(double& out);
+		bool read(int& out);
+		// anything but a string is skipped and reads as empty, so a reused out never keeps
+		// the value of an earlier field
+		bool read(string& out);
+		bool skipValue();
+		// consumes trailing whitespace and checks nothing but the end of the input follows
+		bool finish();
+
+		bool failed() const { return mFailed; }
+		const string& getError() const { return mError; }
+
+	private:
+		int get();
+		int peekChar();
+		int next();
+		bool expect(char c);
+		bool fail(const string& error);
+		bool readLiteral(const char* literal);
+		bool skipString();
+		bool readHex(uint32_t& out);
+		static void appendUtf8(string& out, uint32_t codepoint);
+
+		std::istream& mIn;
+		char mBuffer[16 * 1024];
+		size_t mPos = 0;
+		size_t mEnd = 0;
+		size_t mOffset = 0;
+		// one entry per open object/array, set until its first element has been read
+		std::vector<bool> mFirst;
+		bool mFailed = false;
+		string mError;
+		string mScratch;
+	};
+
+	// parses an images:annotate answer into responses, responses[i] receiving the i-th entry of
+	// responses[] and only the sections in its features mask; sets status and error on each,
+	// expectedResults reserves the annotation vectors
+	void parseAnnotateResponse(std::istream& in, int httpStatus, const string& reason,
+		const std::vector<CloudVisionResponse*>& responses, size_t expectedResults = 0);
+
+	// text as a quoted and escaped json string
+	string toJsonString(const string& text);
+
+	// the inverse for successful responses, writes {"responses":[...]} with every mapped field
+	// so that parseAnnotateResponse reads back the same annotations
+	void writeAnnotateResponse(std::ostream& out, const std::vector<const CloudVisionResponse*>& responses);
+}
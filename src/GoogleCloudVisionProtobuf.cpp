@@ -0,0 +1,709 @@
+#include "GoogleCloudVisionProtobuf.h"
+#include "GoogleCloudVision.h"
+
+namespace google
+{
+	void ProtoWriter::writeVarint(uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			mOut.push_back((char)(value | 0x80));
+			value >>= 7;
+		}
+		mOut.push_back((char)value);
+	}
+
+	void ProtoWriter::writeInt(uint32_t field, int64_t value)
+	{
+		writeTag(field, WIRE_VARINT);
+		writeVarint((uint64_t)value);
+	}
+
+	void ProtoWriter::writeFloat(uint32_t field, float value)
+	{
+		// little endian like every platform openFrameworks runs on
+		writeTag(field, WIRE_FIXED32);
+		mOut.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	void ProtoWriter::writeDouble(uint32_t field, double value)
+	{
+		writeTag(field, WIRE_FIXED64);
+		mOut.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	void ProtoWriter::writeBytes(uint32_t field, const char* data, size_t size)
+	{
+		writeTag(field, WIRE_LENGTH_DELIMITED);
+		writeVarint(size);
+		mOut.append(data, size);
+	}
+
+	size_t ProtoWriter::varintSize(uint64_t value)
+	{
+		size_t size = 1;
+		while (value >= 0x80)
+		{
+			value >>= 7;
+			size++;
+		}
+		return size;
+	}
+
+	bool ProtoReader::fail()
+	{
+		mFailed = true;
+		mPos = mEnd;
+		return false;
+	}
+
+	bool ProtoReader::readRawVarint(uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (mPos >= mEnd)
+				return fail();
+			uint8_t byte = (uint8_t)*mPos++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return fail();
+	}
+
+	bool ProtoReader::next()
+	{
+		if (mFailed || mPos >= mEnd)
+			return false;
+		uint64_t tag;
+		if (!readRawVarint(tag))
+			return false;
+		mField = (uint32_t)(tag >> 3);
+		mType = (WireType)(tag & 7);
+		if (mField == 0)
+			return fail();
+		return true;
+	}
+
+	uint64_t ProtoReader::readVarint()
+	{
+		uint64_t value = 0;
+		if (mType != WIRE_VARINT)
+			skip();
+		else
+			readRawVarint(value);
+		return value;
+	}
+
+	float ProtoReader::readFloat()
+	{
+		float value = 0;
+		if (mType != WIRE_FIXED32)
+		{
+			skip();
+			return value;
+		}
+		if (mEnd - mPos < (ptrdiff_t)sizeof(value))
+		{
+			fail();
+			return value;
+		}
+		memcpy(&value, mPos, sizeof(value));
+		mPos += sizeof(value);
+		return value;
+	}
+
+	double ProtoReader::readDouble()
+	{
+		double value = 0;
+		if (mType != WIRE_FIXED64)
+		{
+			skip();
+			return value;
+		}
+		if (mEnd - mPos < (ptrdiff_t)sizeof(value))
+		{
+			fail();
+			return value;
+		}
+		memcpy(&value, mPos, sizeof(value));
+		mPos += sizeof(value);
+		return value;
+	}
+
+	bool ProtoReader::readBytes(const char*& data, size_t& size)
+	{
+		data = mPos;
+		size = 0;
+		if (mType != WIRE_LENGTH_DELIMITED)
+		{
+			skip();
+			return false;
+		}
+		uint64_t length;
+		if (!readRawVarint(length))
+			return false;
+		if (length > (uint64_t)(mEnd - mPos))
+			return fail();
+		data = mPos;
+		size = (size_t)length;
+		mPos += size;
+		return true;
+	}
+
+	ProtoReader ProtoReader::readMessage()
+	{
+		const char* data;
+		size_t size;
+		readBytes(data, size);
+		return ProtoReader(data, size);
+	}
+
+	void ProtoReader::skip()
+	{
+		uint64_t value;
+		switch (mType)
+		{
+		case WIRE_VARINT:
+			readRawVarint(value);
+			break;
+		case WIRE_FIXED64:
+			if (mEnd - mPos < 8)
+				fail();
+			else
+				mPos += 8;
+			break;
+		case WIRE_FIXED32:
+			if (mEnd - mPos < 4)
+				fail();
+			else
+				mPos += 4;
+			break;
+		case WIRE_LENGTH_DELIMITED:
+			if (readRawVarint(value))
+			{
+				if (value > (uint64_t)(mEnd - mPos))
+					fail();
+				else
+					mPos += (size_t)value;
+			}
+			break;
+		default:
+			// groups are deprecated and never used by the vision api
+			fail();
+			break;
+		}
+	}
+
+	void encodeImageRequest(size_t contentSize, const string& features, string& header, string& footer)
+	{
+		// BatchAnnotateImagesRequest.requests = 1 { image = 1 { content = 1 } features = 2 }
+		size_t image = 1 + ProtoWriter::varintSize(contentSize) + contentSize;
+		size_t request = 1 + ProtoWriter::varintSize(image) + image + features.size();
+		header.clear();
+		ProtoWriter writer(header);
+		writer.writeTag(1, WIRE_LENGTH_DELIMITED);
+		writer.writeVarint(request);
+		writer.writeTag(1, WIRE_LENGTH_DELIMITED);
+		writer.writeVarint(image);
+		writer.writeTag(1, WIRE_LENGTH_DELIMITED);
+		writer.writeVarint(contentSize);
+		footer = features;
+	}
+
+	string encodeImageRequest(const string& imageUri, const string& features)
+	{
+		// image = 1 { source = 2 { image_uri = 2 } }
+		string out;
+		ProtoWriter(out).writeMessage(1, [&](ProtoWriter& request)
+		{
+			request.writeMessage(1, [&](ProtoWriter& image)
+			{
+				image.writeMessage(2, [&](ProtoWriter& source)
+				{
+					source.writeBytes(2, imageUri);
+				});
+			});
+			request.writeRaw(features);
+		});
+		return out;
+	}
+
+	size_t countImageRequests(const char* data, size_t size)
+	{
+		ProtoReader reader(data, size);
+		size_t count = 0;
+		while (reader.next())
+		{
+			if (reader.getField() == 1 && reader.getType() == WIRE_LENGTH_DELIMITED)
+				count++;
+			reader.skip();
+		}
+		return count;
+	}
+
+	namespace
+	{
+		// Landmark.Type in the order of its enum values
+		const char* LANDMARK_TYPES[] = { "UNKNOWN_LANDMARK", "LEFT_EYE", "RIGHT_EYE", "LEFT_OF_LEFT_EYEBROW",
+			"RIGHT_OF_LEFT_EYEBROW", "LEFT_OF_RIGHT_EYEBROW", "RIGHT_OF_RIGHT_EYEBROW", "MIDPOINT_BETWEEN_EYES",
+			"NOSE_TIP", "UPPER_LIP", "LOWER_LIP", "MOUTH_LEFT", "MOUTH_RIGHT", "MOUTH_CENTER", "NOSE_BOTTOM_RIGHT",
+			"NOSE_BOTTOM_LEFT", "NOSE_BOTTOM_CENTER", "LEFT_EYE_TOP_BOUNDARY", "LEFT_EYE_RIGHT_CORNER",
+			"LEFT_EYE_BOTTOM_BOUNDARY", "LEFT_EYE_LEFT_CORNER", "RIGHT_EYE_TOP_BOUNDARY", "RIGHT_EYE_RIGHT_CORNER",
+			"RIGHT_EYE_BOTTOM_BOUNDARY", "RIGHT_EYE_LEFT_CORNER", "LEFT_EYEBROW_UPPER_MIDPOINT",
+			"RIGHT_EYEBROW_UPPER_MIDPOINT", "LEFT_EAR_TRAGION", "RIGHT_EAR_TRAGION", "LEFT_EYE_PUPIL",
+			"RIGHT_EYE_PUPIL", "FOREHEAD_GLABELLA", "CHIN_GNATHION", "CHIN_LEFT_GONION", "CHIN_RIGHT_GONION",
+			"LEFT_CHEEK_CENTER", "RIGHT_CHEEK_CENTER" };
+		const size_t NUM_LANDMARK_TYPES = sizeof(LANDMARK_TYPES) / sizeof(LANDMARK_TYPES[0]);
+
+		StringRef toLandmarkType(uint64_t type)
+		{
+			// interned once, every face has dozens of landmarks
+			static const std::vector<StringRef> types = []
+			{
+				std::vector<StringRef> interned;
+				for (auto name : LANDMARK_TYPES)
+					interned.push_back(internString(name, strlen(name)));
+				return interned;
+			}();
+			return type < types.size() ? types[(size_t)type] : types[0];
+		}
+
+		int fromLandmarkType(const StringRef& type)
+		{
+			for (size_t i = 1; i < NUM_LANDMARK_TYPES; i++)
+			{
+				if (type == string(LANDMARK_TYPES[i]))
+					return (int)i;
+			}
+			return 0;
+		}
+
+		Likelihood toLikelihood(uint64_t value)
+		{
+			return value <= LIKELIHOOD_VERY_LIKELY ? (Likelihood)value : LIKELIHOOD_UNKNOWN;
+		}
+
+		// scratch vectors keep their capacity across annotations, like the json parser's
+		struct Context
+		{
+			ResponseArena* arena = nullptr;
+			std::vector<ofVec2f> vertices;
+			std::vector<Landmark> landmarks;
+			std::vector<latLng> locations;
+			// set when any nested message was malformed, their readers fail on their own
+			bool failed = false;
+
+			void check(const ProtoReader& r)
+			{
+				failed = failed || r.failed();
+			}
+
+			StringRef intern(ProtoReader& r)
+			{
+				const char* data;
+				size_t size;
+				r.readBytes(data, size);
+				return internString(data, size);
+			}
+
+			StringRef store(ProtoReader& r)
+			{
+				const char* data;
+				size_t size;
+				r.readBytes(data, size);
+				return arena->store(data, size);
+			}
+		};
+
+		void decodeVertices(Context& ctx, ProtoReader poly, BoundingPoly& result)
+		{
+			auto& vertices = ctx.vertices;
+			vertices.clear();
+			while (poly.next())
+			{
+				if (poly.getField() != 1)
+				{
+					poly.skip();
+					continue;
+				}
+				// missing coordinates are 0
+				ofVec2f vertex(0, 0);
+				ProtoReader r = poly.readMessage();
+				while (r.next())
+				{
+					if (r.getField() == 1) vertex.x = (float)r.readInt();
+					else if (r.getField() == 2) vertex.y = (float)r.readInt();
+					else r.skip();
+				}
+				ctx.check(r);
+				vertices.push_back(vertex);
+			}
+			ctx.check(poly);
+			result.vertices = ctx.arena->store(vertices);
+		}
+
+		// Landmark { type = 3, position = 4 { x = 1, y = 2, z = 3 } }
+		void decodeLandmark(Context& ctx, ProtoReader r, Landmark& landmark)
+		{
+			landmark.type = toLandmarkType(0);
+			landmark.position.set(0, 0, 0);
+			while (r.next())
+			{
+				if (r.getField() == 3)
+				{
+					landmark.type = toLandmarkType(r.readVarint());
+				}
+				else if (r.getField() == 4)
+				{
+					ProtoReader p = r.readMessage();
+					while (p.next())
+					{
+						if (p.getField() == 1) landmark.position.x = p.readFloat();
+						else if (p.getField() == 2) landmark.position.y = p.readFloat();
+						else if (p.getField() == 3) landmark.position.z = p.readFloat();
+						else p.skip();
+					}
+					ctx.check(p);
+				}
+				else
+				{
+					r.skip();
+				}
+			}
+			ctx.check(r);
+		}
+
+		// LocationInfo { lat_lng = 1 { latitude = 1, longitude = 2 } }
+		latLng decodeLocation(Context& ctx, ProtoReader r)
+		{
+			latLng location = { 0.0, 0.0 };
+			while (r.next())
+			{
+				if (r.getField() != 1)
+				{
+					r.skip();
+					continue;
+				}
+				ProtoReader l = r.readMessage();
+				while (l.next())
+				{
+					if (l.getField() == 1) location.latitude = l.readDouble();
+					else if (l.getField() == 2) location.longitude = l.readDouble();
+					else l.skip();
+				}
+				ctx.check(l);
+			}
+			ctx.check(r);
+			return location;
+		}
+
+		// EntityAnnotation { mid = 1, locale = 2, description = 3, score = 4, bounding_poly = 7, locations = 8 },
+		// shared by labels, text, logos and landmarks; text descriptions are free text, the rest is vocabulary
+		void decodeEntity(Context& ctx, ProtoReader r, StringRef& description, bool freeText,
+			StringRef* mid, StringRef* locale, float* score, BoundingPoly* poly, Span<latLng>* locations)
+		{
+			ctx.locations.clear();
+			while (r.next())
+			{
+				switch (r.getField())
+				{
+				case 1: if (mid) *mid = ctx.intern(r); else r.skip(); break;
+				case 2: if (locale) *locale = ctx.intern(r); else r.skip(); break;
+				case 3: description = freeText ? ctx.store(r) : ctx.intern(r); break;
+				case 4: if (score) *score = r.readFloat(); else r.skip(); break;
+				case 7: if (poly) decodeVertices(ctx, r.readMessage(), *poly); else r.skip(); break;
+				case 8: if (locations) ctx.locations.push_back(decodeLocation(ctx, r.readMessage())); else r.skip(); break;
+				default: r.skip(); break;
+				}
+			}
+			ctx.check(r);
+			if (locations)
+				*locations = ctx.arena->store(ctx.locations);
+		}
+
+		void decodeFace(Context& ctx, ProtoReader r, FaceAnnotation& face)
+		{
+			ctx.landmarks.clear();
+			while (r.next())
+			{
+				switch (r.getField())
+				{
+				case 1: decodeVertices(ctx, r.readMessage(), face.boundingPoly); break;
+				case 2: decodeVertices(ctx, r.readMessage(), face.fdBoundingPoly); break;
+				case 3:
+				{
+					Landmark landmark;
+					decodeLandmark(ctx, r.readMessage(), landmark);
+					ctx.landmarks.push_back(landmark);
+					break;
+				}
+				case 4: face.rollAngle = r.readFloat(); break;
+				case 5: face.panAngle = r.readFloat(); break;
+				case 6: face.tiltAngle = r.readFloat(); break;
+				case 7: face.detectionConfidence = r.readFloat(); break;
+				case 8: face.landmarkingConfidence = r.readFloat(); break;
+				case 9: face.joy = toLikelihood(r.readVarint()); break;
+				case 10: face.sorrow = toLikelihood(r.readVarint()); break;
+				case 11: face.anger = toLikelihood(r.readVarint()); break;
+				case 12: face.surprise = toLikelihood(r.readVarint()); break;
+				case 13: face.underExposed = toLikelihood(r.readVarint()); break;
+				case 14: face.blurred = toLikelihood(r.readVarint()); break;
+				case 15: face.headwear = toLikelihood(r.readVarint()); break;
+				default: r.skip(); break;
+				}
+			}
+			ctx.check(r);
+			face.landmarks = ctx.arena->store(ctx.landmarks);
+		}
+
+		// google.rpc.Status { code = 1, message = 2 }, returns the message
+		string decodeError(Context& ctx, ProtoReader r)
+		{
+			string message;
+			while (r.next())
+			{
+				const char* data;
+				size_t size;
+				if (r.getField() != 2)
+					r.skip();
+				else if (r.readBytes(data, size))
+					message.assign(data, size);
+			}
+			ctx.check(r);
+			return message;
+		}
+
+		// AnnotateImageResponse { face = 1, landmark = 2, logo = 3, label = 4, text = 5, error = 9 },
+		// sections that were not requested are skipped
+		void decodeImageResponse(Context& ctx, ProtoReader r, CloudVisionResponse& res, size_t expected)
+		{
+			if (!res.arena)
+				res.arena = make_shared<ResponseArena>();
+			ctx.arena = res.arena.get();
+			uint32_t mask = res.features;
+			while (r.next())
+			{
+				uint32_t field = r.getField();
+				if (field == 1 && (mask & FEATURE_FACE))
+				{
+					res.faceAnnotations.reserve(expected);
+					FaceAnnotation face = FaceAnnotation();
+					decodeFace(ctx, r.readMessage(), face);
+					res.faceAnnotations.push_back(face);
+				}
+				else if (field == 2 && (mask & FEATURE_LANDMARK))
+				{
+					res.landmarkAnnotations.reserve(expected);
+					LandmarkAnnotation landmark = LandmarkAnnotation();
+					decodeEntity(ctx, r.readMessage(), landmark.description, false, &landmark.mid, nullptr, &landmark.score, &landmark.boundingPoly, &landmark.locations);
+					res.landmarkAnnotations.push_back(landmark);
+				}
+				else if (field == 3 && (mask & FEATURE_LOGO))
+				{
+					res.logoAnnotations.reserve(expected);
+					LogoAnnotation logo = LogoAnnotation();
+					decodeEntity(ctx, r.readMessage(), logo.description, false, &logo.mid, nullptr, &logo.score, &logo.boundingPoly, nullptr);
+					res.logoAnnotations.push_back(logo);
+				}
+				else if (field == 4 && (mask & FEATURE_LABEL))
+				{
+					res.labelAnnotations.reserve(expected);
+					LabelAnnotation label = LabelAnnotation();
+					decodeEntity(ctx, r.readMessage(), label.description, false, &label.mid, nullptr, &label.score, nullptr, nullptr);
+					res.labelAnnotations.push_back(label);
+				}
+				else if (field == 5 && (mask & FEATURE_TEXT))
+				{
+					res.textAnnotations.reserve(expected);
+					TextAnnotation text = TextAnnotation();
+					decodeEntity(ctx, r.readMessage(), text.description, true, nullptr, &text.locale, nullptr, &text.boundingPoly, nullptr);
+					res.textAnnotations.push_back(text);
+				}
+				else if (field == 9)
+				{
+					res.status = REQUEST_API_ERROR;
+					res.error = decodeError(ctx, r.readMessage());
+				}
+				else
+				{
+					// full_text_annotation and everything else that is not mapped
+					r.skip();
+				}
+			}
+			ctx.check(r);
+		}
+
+		void encodeVertices(ProtoWriter& out, uint32_t field, const BoundingPoly& poly)
+		{
+			out.writeMessage(field, [&](ProtoWriter& w)
+			{
+				for (auto& vertex : poly.vertices)
+				{
+					w.writeMessage(1, [&](ProtoWriter& v)
+					{
+						if ((int)vertex.x) v.writeInt(1, (int)vertex.x);
+						if ((int)vertex.y) v.writeInt(2, (int)vertex.y);
+					});
+				}
+			});
+		}
+
+		void encodeEntity(ProtoWriter& out, uint32_t field, const StringRef& mid, const StringRef& locale,
+			const StringRef& description, float score, const BoundingPoly* poly, const Span<latLng>* locations)
+		{
+			out.writeMessage(field, [&](ProtoWriter& w)
+			{
+				if (!mid.empty()) w.writeBytes(1, mid.data(), mid.size());
+				if (!locale.empty()) w.writeBytes(2, locale.data(), locale.size());
+				if (!description.empty()) w.writeBytes(3, description.data(), description.size());
+				if (score != 0) w.writeFloat(4, score);
+				if (poly) encodeVertices(w, 7, *poly);
+				if (locations)
+				{
+					for (auto& location : *locations)
+					{
+						w.writeMessage(8, [&](ProtoWriter& info)
+						{
+							info.writeMessage(1, [&](ProtoWriter& latlng)
+							{
+								latlng.writeDouble(1, location.latitude);
+								latlng.writeDouble(2, location.longitude);
+							});
+						});
+					}
+				}
+			});
+		}
+	}
+
+	bool decodeImageResponse(const char* data, size_t size, CloudVisionResponse& response, size_t expectedResults)
+	{
+		Context ctx;
+		decodeImageResponse(ctx, ProtoReader(data, size), response, expectedResults);
+		return !ctx.failed;
+	}
+
+	void decodeAnnotateResponse(const char* data, size_t size, int status, const string& reason,
+		const std::vector<CloudVisionResponse*>& responses, size_t expectedResults)
+	{
+		if (status != 200)
+		{
+			for (auto res : responses)
+			{
+				res->status = status == 429 ? REQUEST_THROTTLED : REQUEST_FAILED;
+				res->error = reason;
+			}
+			return;
+		}
+
+		// responses[] follows the order of requests[]
+		Context ctx;
+		ProtoReader r(data, size);
+		size_t count = 0;
+		while (r.next())
+		{
+			if (r.getField() != 1)
+			{
+				r.skip();
+				continue;
+			}
+			ProtoReader image = r.readMessage();
+			if (count < responses.size())
+				decodeImageResponse(ctx, image, *responses[count], expectedResults);
+			count++;
+		}
+
+		ctx.check(r);
+		if (ctx.failed)
+			ofLogError("CloudVision") << "failed to decode response";
+		else if (count != responses.size())
+			ofLogError("CloudVision") << "expected " << responses.size() << " responses, got " << count;
+
+		for (size_t i = 0; i < responses.size(); i++)
+		{
+			auto res = responses[i];
+			if (res->status != REQUEST_OK)
+				continue;
+			if (ctx.failed)
+			{
+				res->status = REQUEST_PARSE_FAILED;
+				res->error = "malformed protobuf";
+			}
+			else if (i >= count)
+			{
+				res->status = REQUEST_FAILED;
+				res->error = "missing from responses";
+			}
+		}
+	}
+
+	void encodeImageResponse(string& out, const CloudVisionResponse& res)
+	{
+		ProtoWriter w(out);
+		for (auto& face : res.faceAnnotations)
+		{
+			w.writeMessage(1, [&](ProtoWriter& f)
+			{
+				encodeVertices(f, 1, face.boundingPoly);
+				encodeVertices(f, 2, face.fdBoundingPoly);
+				for (auto& landmark : face.landmarks)
+				{
+					f.writeMessage(3, [&](ProtoWriter& l)
+					{
+						l.writeInt(3, fromLandmarkType(landmark.type));
+						l.writeMessage(4, [&](ProtoWriter& p)
+						{
+							p.writeFloat(1, landmark.position.x);
+							p.writeFloat(2, landmark.position.y);
+							p.writeFloat(3, landmark.position.z);
+						});
+					});
+				}
+				f.writeFloat(4, face.rollAngle);
+				f.writeFloat(5, face.panAngle);
+				f.writeFloat(6, face.tiltAngle);
+				f.writeFloat(7, face.detectionConfidence);
+				f.writeFloat(8, face.landmarkingConfidence);
+				const Likelihood likelihoods[] = { face.joy, face.sorrow, face.anger, face.surprise,
+					face.underExposed, face.blurred, face.headwear };
+				for (uint32_t i = 0; i < 7; i++)
+				{
+					if (likelihoods[i] != LIKELIHOOD_UNKNOWN)
+						f.writeInt(9 + i, likelihoods[i]);
+				}
+			});
+		}
+		for (auto& landmark : res.landmarkAnnotations)
+			encodeEntity(w, 2, landmark.mid, StringRef(), landmark.description, landmark.score, &landmark.boundingPoly, &landmark.locations);
+		for (auto& logo : res.logoAnnotations)
+			encodeEntity(w, 3, logo.mid, StringRef(), logo.description, logo.score, &logo.boundingPoly, nullptr);
+		for (auto& label : res.labelAnnotations)
+			encodeEntity(w, 4, label.mid, StringRef(), label.description, label.score, nullptr, nullptr);
+		for (auto& text : res.textAnnotations)
+			encodeEntity(w, 5, StringRef(), text.locale, text.description, 0, &text.boundingPoly, nullptr);
+		if (res.status == REQUEST_API_ERROR)
+		{
+			w.writeMessage(9, [&](ProtoWriter& e)
+			{
+				// google.rpc.Code INVALID_ARGUMENT
+				e.writeInt(1, 3);
+				e.writeBytes(2, res.error);
+			});
+		}
+	}
+
+	string encodeAnnotateResponse(const std::vector<const CloudVisionResponse*>& responses)
+	{
+		string out, image;
+		ProtoWriter writer(out);
+		for (auto res : responses)
+		{
+			image.clear();
+			encodeImageResponse(image, *res);
+			writer.writeBytes(1, image);
+		}
+		return out;
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct CloudVisionResponse;
+
+	// the protocol buffers wire format, as much of it as the google.cloud.vision.v1 messages
+	// need; written by hand so the REST build does not depend on protoc and libprotobuf
+	enum WireType
+	{
+		WIRE_VARINT = 0,
+		WIRE_FIXED64 = 1,
+		WIRE_LENGTH_DELIMITED = 2,
+		WIRE_FIXED32 = 5
+	};
+
+	// appends fields to a string; proto3 leaves out fields holding their default, so do the callers
+	class ProtoWriter
+	{
+	public:
+		ProtoWriter(string& out) : mOut(out) {}
+
+		void writeVarint(uint64_t value);
+		void writeTag(uint32_t field, WireType type) { writeVarint((uint64_t)field << 3 | type); }
+		// int32 and enum fields, negative values take ten bytes like they do in protobuf
+		void writeInt(uint32_t field, int64_t value);
+		void writeFloat(uint32_t field, float value);
+		void writeDouble(uint32_t field, double value);
+		void writeBytes(uint32_t field, const char* data, size_t size);
+		void writeBytes(uint32_t field, const string& data) { writeBytes(field, data.data(), data.size()); }
+		// fields encoded elsewhere
+		void writeRaw(const string& data) { mOut += data; }
+		// a nested message, fill(writer) writes its fields
+		template<typename F>
+		void writeMessage(uint32_t field, F fill)
+		{
+			string nested;
+			ProtoWriter writer(nested);
+			fill(writer);
+			writeBytes(field, nested);
+		}
+
+		static size_t varintSize(uint64_t value);
+
+	private:
+		string& mOut;
+	};
+
+	// reads the fields of one message in place; malformed input puts it in a failed state
+	// that stops next(), nothing throws
+	class ProtoReader
+	{
+	public:
+		ProtoReader(const char* data, size_t size) : mPos(data), mEnd(data + size) {}
+
+		// moves to the next field, false at the end of the message or after an error
+		bool next();
+		uint32_t getField() const { return mField; }
+		WireType getType() const { return mType; }
+
+		// the value of the current field; one that does not match the field's wire type is skipped and reads as 0
+		uint64_t readVarint();
+		int32_t readInt() { return (int32_t)readVarint(); }
+		float readFloat();
+		double readDouble();
+		// a length delimited field, pointing into the message
+		bool readBytes(const char*& data, size_t& size);
+		ProtoReader readMessage();
+		void skip();
+
+		bool failed() const { return mFailed; }
+
+	private:
+		bool fail();
+		bool readRawVarint(uint64_t& value);
+
+		const char* mPos;
+		const char* mEnd;
+		uint32_t mField = 0;
+		WireType mType = WIRE_VARINT;
+		bool mFailed = false;
+	};
+
+	// the BatchAnnotateImagesRequest.requests[] entry for one image, its image field and
+	// features, as field 1 of the batch; features holds the encoded repeated Feature
+	// fields (FeatureSet::toProtobuf()). header and footer go around the raw content,
+	// so the image bytes are never copied into the message
+	void encodeImageRequest(size_t contentSize, const string& features, string& header, string& footer);
+	// the same for an image the service downloads itself
+	string encodeImageRequest(const string& imageUri, const string& features);
+	// number of requests[] in a BatchAnnotateImagesRequest, for fake servers
+	size_t countImageRequests(const char* data, size_t size);
+
+	// decodes a BatchAnnotateImagesResponse into responses like parseAnnotateResponse does
+	// for json, responses[i] receiving the i-th entry and only the sections in its features
+	// mask; status 200 is a successful call, anything else fails every response with reason
+	void decodeAnnotateResponse(const char* data, size_t size, int status, const string& reason,
+		const std::vector<CloudVisionResponse*>& responses, size_t expectedResults = 0);
+	// the inverse, for fake servers and tests
+	string encodeAnnotateResponse(const std::vector<const CloudVisionResponse*>& responses);
+
+	// one AnnotateImageResponse, the annotations of a single image and its error; decoding
+	// leaves status alone unless there is an error and is false for malformed data
+	void encodeImageResponse(string& out, const CloudVisionResponse& response);
+	bool decodeImageResponse(const char* data, size_t size, CloudVisionResponse& response, size_t expectedResults = 0);
+}
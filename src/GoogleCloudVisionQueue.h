@@ -0,0 +1,363 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	enum OverflowPolicy
+	{
+		// the producer waits until a worker makes room
+		OVERFLOW_BLOCK,
+		// the oldest queued item is dropped to make room
+		OVERFLOW_DROP_OLDEST,
+		// the item being pushed is dropped
+		OVERFLOW_DROP_NEWEST,
+		// everything queued is dropped, only the freshest item is kept
+		OVERFLOW_LATEST_WINS
+	};
+
+	// bounded multi-producer / multi-consumer queue, consumers block until items arrive
+	template<typename T>
+	class BoundedQueue
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		BoundedQueue(size_t capacity = 16, OverflowPolicy policy = OVERFLOW_BLOCK)
+			:mCapacity(std::max<size_t>(capacity, 1))
+			,mPolicy(policy)
+		{
+
+		}
+
+		// false when the item was not queued, items pushed out to make room are appended to dropped
+		bool push(T&& item, std::vector<T>& dropped)
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			if (mClosed)
+				return false;
+
+			if (mPolicy == OVERFLOW_LATEST_WINS)
+			{
+				while (!mItems.empty())
+					dropFront(dropped);
+			}
+			else if (mItems.size() >= mCapacity)
+			{
+				switch (mPolicy)
+				{
+				case OVERFLOW_BLOCK:
+					mNotFull.wait(lck, [this] { return mClosed || mItems.size() < mCapacity; });
+					if (mClosed)
+						return false;
+					break;
+				case OVERFLOW_DROP_OLDEST:
+					dropFront(dropped);
+					break;
+				default:
+					mDropCount++;
+					return false;
+				}
+			}
+
+			mItems.emplace_back(Clock::now(), std::move(item));
+			mNotEmpty.notify_all();
+			return true;
+		}
+
+		// blocks until an item is queued, then waits until maxCount items are there or the
+		// oldest one has been queued for linger, false once closed
+		bool popBatch(std::vector<T>& out, size_t maxCount, Clock::duration linger = Clock::duration::zero())
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mNotEmpty.wait(lck, [this] { return mClosed || !mItems.empty(); });
+			if (mClosed)
+				return false;
+
+			if (linger > Clock::duration::zero())
+			{
+				mNotEmpty.wait_until(lck, mItems.front().first + linger, [this, maxCount] {
+					return mClosed || mItems.empty() || mItems.size() >= maxCount;
+				});
+				if (mClosed)
+					return false;
+				// another consumer may have taken everything meanwhile
+				if (mItems.empty())
+					return true;
+			}
+
+			size_t count = std::min(mItems.size(), maxCount);
+			for (size_t i = 0; i < count; i++)
+			{
+				out.emplace_back(std::move(mItems.front().second));
+				mItems.pop_front();
+			}
+			mNotFull.notify_all();
+			return true;
+		}
+
+		// wakes every blocked producer and consumer, later pushes fail
+		void close()
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mClosed = true;
+			mNotEmpty.notify_all();
+			mNotFull.notify_all();
+		}
+
+		size_t size() const
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			return mItems.size();
+		}
+
+		// moves everything still queued to out, for cleaning up once the consumers are gone
+		void drain(std::vector<T>& out)
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			for (auto& it : mItems)
+				out.emplace_back(std::move(it.second));
+			mItems.clear();
+			mNotFull.notify_all();
+		}
+
+		uint64_t getDropCount() const
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			return mDropCount;
+		}
+
+	private:
+		void dropFront(std::vector<T>& dropped)
+		{
+			dropped.emplace_back(std::move(mItems.front().second));
+			mItems.pop_front();
+			mDropCount++;
+		}
+
+		const size_t mCapacity;
+		const OverflowPolicy mPolicy;
+		std::deque<std::pair<Clock::time_point, T>> mItems;
+		uint64_t mDropCount = 0;
+		bool mClosed = false;
+		mutable std::mutex mMutex;
+		std::condition_variable mNotEmpty;
+		std::condition_variable mNotFull;
+	};
+
+	// bounded lock-free multi-producer / multi-consumer ring after Dmitry Vyukov, used to hand
+	// work from one pipeline stage to the next; items move through per-cell sequence numbers
+	// and a mutex is only touched by threads that have to sleep because it is full or empty
+	template<typename T>
+	class StageQueue
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		// capacity is rounded up to a power of two
+		StageQueue(size_t capacity = 16)
+		{
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+			mMask = size - 1;
+			mCells.reset(new Cell[size]);
+			for (size_t i = 0; i < size; i++)
+				mCells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		// false when full, item is left alone then
+		bool tryPush(T&& item)
+		{
+			size_t pos = mTail.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				Cell& cell = mCells[pos & mMask];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+				if (diff == 0)
+				{
+					if (mTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						cell.item = std::move(item);
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						wake(mNotEmpty);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = mTail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// false when empty
+		bool tryPop(T& item)
+		{
+			return tryTake([&item](T& taken) { item = std::move(taken); });
+		}
+
+		// waits while the queue is full, false once closed
+		bool push(T&& item)
+		{
+			while (!tryPush(std::move(item)))
+			{
+				if (mClosed)
+					return false;
+				wait(mNotFull, Clock::now() + WAIT_SLICE, [this] { return mClosed || canPush(); });
+			}
+			return true;
+		}
+
+		// blocks until an item arrives, then keeps taking items until there are maxCount or
+		// linger has passed since the first one; false once closed
+		bool popBatch(std::vector<T>& out, size_t maxCount, Clock::duration linger = Clock::duration::zero())
+		{
+			// items are moved straight into out, nothing is default constructed on the way
+			auto take = [&out](T& item) { out.emplace_back(std::move(item)); };
+			while (!tryTake(take))
+			{
+				if (mClosed)
+					return false;
+				wait(mNotEmpty, Clock::now() + WAIT_SLICE, [this] { return mClosed || canPop(); });
+			}
+
+			auto deadline = Clock::now() + linger;
+			while (out.size() < maxCount)
+			{
+				if (tryTake(take))
+					continue;
+				if (mClosed || Clock::now() >= deadline)
+					break;
+				wait(mNotEmpty, deadline, [this] { return mClosed || canPop(); });
+			}
+			return true;
+		}
+
+		void close()
+		{
+			mClosed = true;
+			for (auto waiters : { &mNotEmpty, &mNotFull })
+			{
+				std::unique_lock<std::mutex> lck(waiters->mutex);
+				waiters->condition.notify_all();
+			}
+		}
+
+		// moves everything still queued to out, for cleaning up once the consumers are gone
+		void drain(std::vector<T>& out)
+		{
+			auto take = [&out](T& item) { out.emplace_back(std::move(item)); };
+			while (tryTake(take)) {}
+		}
+
+		// approximate while other threads push or pop
+		size_t size() const
+		{
+			size_t tail = mTail.load(std::memory_order_relaxed);
+			size_t head = mHead.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			T item;
+		};
+
+		struct Waiters
+		{
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::atomic<int> count{ 0 };
+		};
+
+		// sleepers recheck at least this often, a safety net for the wake up protocol below
+		static constexpr Clock::duration WAIT_SLICE = std::chrono::milliseconds(50);
+
+		// hands the head item to take(item), false when empty
+		template<typename Take>
+		bool tryTake(Take take)
+		{
+			size_t pos = mHead.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				Cell& cell = mCells[pos & mMask];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+				if (diff == 0)
+				{
+					if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						take(cell.item);
+						cell.sequence.store(pos + mMask + 1, std::memory_order_release);
+						wake(mNotFull);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = mHead.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool canPush() const
+		{
+			size_t pos = mTail.load(std::memory_order_relaxed);
+			return mCells[pos & mMask].sequence.load(std::memory_order_acquire) == pos;
+		}
+
+		bool canPop() const
+		{
+			size_t pos = mHead.load(std::memory_order_relaxed);
+			return mCells[pos & mMask].sequence.load(std::memory_order_acquire) == pos + 1;
+		}
+
+		// the fences pair with the ones in wake(): either the sleeper sees the new state in
+		// ready() or the waker sees the sleeper's count and notifies
+		template<typename F>
+		void wait(Waiters& waiters, Clock::time_point until, F ready)
+		{
+			std::unique_lock<std::mutex> lck(waiters.mutex);
+			waiters.count++;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			waiters.condition.wait_until(lck, until, ready);
+			waiters.count--;
+		}
+
+		void wake(Waiters& waiters)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiters.count.load(std::memory_order_relaxed) == 0)
+				return;
+			std::unique_lock<std::mutex> lck(waiters.mutex);
+			waiters.condition.notify_all();
+		}
+
+		std::unique_ptr<Cell[]> mCells;
+		size_t mMask = 0;
+		// producers and consumers work on separate cache lines
+		char mPad0[64];
+		std::atomic<size_t> mTail{ 0 };
+		char mPad1[64];
+		std::atomic<size_t> mHead{ 0 };
+		char mPad2[64];
+		std::atomic<bool> mClosed{ false };
+		Waiters mNotEmpty;
+		Waiters mNotFull;
+	};
+
+	template<typename T>
+	constexpr typename StageQueue<T>::Clock::duration StageQueue<T>::WAIT_SLICE;
+}
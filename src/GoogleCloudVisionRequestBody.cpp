@@ -0,0 +1,147 @@
+#include "GoogleCloudVisionRequestBody.h"
+#include "GoogleCloudVisionBase64.h"
+#include "Poco/DeflatingStream.h"
+
+namespace google
+{
+	namespace
+	{
+		// raw bytes encoded per write, a multiple of 3 so only the last chunk is padded
+		const size_t CHUNK_SIZE = 48 * 1024;
+
+		// appends whatever is written to a string
+		struct StringSink : public std::streambuf
+		{
+			StringSink(string& target) : target(target) {}
+
+			int_type overflow(int_type c) override
+			{
+				if (c != traits_type::eof())
+					target.push_back((char)c);
+				return c;
+			}
+
+			std::streamsize xsputn(const char* data, std::streamsize count) override
+			{
+				target.append(data, (size_t)count);
+				return count;
+			}
+
+			string& target;
+		};
+	}
+
+	void RequestBody::appendText(const string& text)
+	{
+		if (!mParts.empty() && mParts.back().type == PART_TEXT)
+		{
+			mParts.back().text += text;
+		}
+		else
+		{
+			Part part;
+			part.text = text;
+			mParts.emplace_back(std::move(part));
+		}
+		mSize += text.size();
+	}
+
+	void RequestBody::appendBase64(ofBuffer&& data)
+	{
+		Part part;
+		part.data = std::move(data);
+		part.type = PART_BASE64;
+		mSize += base64EncodedSize(part.data.size());
+		mParts.emplace_back(std::move(part));
+	}
+
+	void RequestBody::appendBytes(ofBuffer&& data)
+	{
+		Part part;
+		part.data = std::move(data);
+		part.type = PART_BYTES;
+		mSize += part.data.size();
+		mParts.emplace_back(std::move(part));
+	}
+
+	void RequestBody::writeTo(std::ostream& out) const
+	{
+		if (mCompressed.empty())
+			writeParts(out);
+		else
+			out.write(mCompressed.data(), mCompressed.size());
+	}
+
+	void RequestBody::compress(int level)
+	{
+		string compressed;
+		// base64 of jpeg data shrinks to about 3/4, the json around it to almost nothing
+		compressed.reserve(mSize * 3 / 4 + 1024);
+		StringSink sink(compressed);
+		std::ostream out(&sink);
+		Poco::DeflatingOutputStream deflater(out, Poco::DeflatingStreamBuf::STREAM_GZIP, std::max(1, std::min(level, 9)));
+		writeParts(deflater);
+		deflater.close();
+		mCompressed = std::move(compressed);
+	}
+
+	void RequestBody::writeParts(std::ostream& out) const
+	{
+		std::vector<char> chunk(base64EncodedSize(CHUNK_SIZE));
+		for (auto& part : mParts)
+		{
+			if (part.type == PART_TEXT)
+			{
+				out.write(part.text.data(), part.text.size());
+				continue;
+			}
+			if (part.type == PART_BYTES)
+			{
+				out.write(part.data.getData(), part.data.size());
+				continue;
+			}
+			const char* data = part.data.getData();
+			size_t remaining = part.data.size();
+			while (remaining > 0 && out.good())
+			{
+				size_t count = std::min(remaining, CHUNK_SIZE);
+				size_t encoded = base64Encode(data, count, chunk.data());
+				out.write(chunk.data(), encoded);
+				data += count;
+				remaining -= count;
+			}
+		}
+	}
+
+	string RequestBody::toString() const
+	{
+		std::ostringstream out;
+		writeParts(out);
+		return out.str();
+	}
+
+	void RequestBody::forEachPart(const std::function<void(const char* data, size_t size)>& visit) const
+	{
+		for (auto& part : mParts)
+		{
+			if (part.type == PART_TEXT)
+				visit(part.text.data(), part.text.size());
+			else if (part.type == PART_BYTES)
+				visit(part.data.getData(), part.data.size());
+			else
+				ofLogError("CloudVision") << "RequestBody::forEachPart skips base64 parts";
+		}
+	}
+
+	void RequestBody::takeImages(std::vector<ofBuffer>& images)
+	{
+		for (auto& part : mParts)
+		{
+			if (part.type != PART_TEXT)
+				images.emplace_back(std::move(part.data));
+		}
+		mParts.clear();
+		mSize = 0;
+		mCompressed.clear();
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct CompressionSettings
+	{
+		// gzip request bodies of at least minRequestBytes, sent with Content-Encoding: gzip;
+		// a compressed body is built in memory as a whole, unlike a plain one that is encoded
+		// while it is written, so retries and hedges resend it without deflating again and
+		// it keeps its Content-Length
+		bool compressRequests = false;
+		size_t minRequestBytes = 32 * 1024;
+		// 1 is fastest, 9 smallest
+		int level = 6;
+		// ask for gzip responses, they are decoded while they are parsed
+		bool acceptGzip = true;
+	};
+
+	// a request body kept as its parts, literal json and raw image bytes; the images are
+	// base64 encoded one small chunk at a time while the body is written to the socket
+	// so the encoded payload never exists in memory as a whole. Binary bodies (protobuf)
+	// carry the image bytes as they are
+	class RequestBody
+	{
+	public:
+		void appendText(const string& text);
+		// appended as base64, without quotes
+		void appendBase64(ofBuffer&& data);
+		// appended unchanged
+		void appendBytes(ofBuffer&& data);
+
+		// bytes writeTo() produces, used as Content-Length
+		size_t size() const { return mCompressed.empty() ? mSize : mCompressed.size(); }
+		bool empty() const { return mParts.empty(); }
+		// may be called again to resend the body
+		void writeTo(std::ostream& out) const;
+		// gzips the body once into memory, from then on writeTo() sends the compressed bytes;
+		// the parts stay for toString() and takeImages()
+		void compress(int level);
+		// "gzip" once compressed, empty otherwise
+		string getContentEncoding() const { return mCompressed.empty() ? "" : "gzip"; }
+		// the whole body as one uncompressed string, only meant for debugging
+		string toString() const;
+		// visits the parts as they are written, for binary bodies that have no base64 parts
+		void forEachPart(const std::function<void(const char* data, size_t size)>& visit) const;
+		// moves the image buffers out for reuse, leaving the body empty
+		void takeImages(std::vector<ofBuffer>& images);
+
+	private:
+		void writeParts(std::ostream& out) const;
+
+		enum PartType
+		{
+			PART_TEXT,
+			PART_BASE64,
+			PART_BYTES
+		};
+
+		struct Part
+		{
+			string text;
+			ofBuffer data;
+			PartType type = PART_TEXT;
+		};
+
+		std::vector<Part> mParts;
+		size_t mSize = 0;
+		string mCompressed;
+	};
+}
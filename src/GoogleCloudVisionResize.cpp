@@ -0,0 +1,303 @@
+#include "GoogleCloudVisionResize.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CLOUD_VISION_RESIZE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace google
+{
+	namespace
+	{
+		// keeps 255 * MAX_BOX within the 16 bit column sums
+		const size_t MAX_BOX = 256;
+
+		// helper threads shared by every downscale, started as they are first needed and kept
+		// for the life of the process, so a frame never pays for creating threads. Encoders
+		// resizing at the same time queue their bands on the same helpers
+		class BandPool
+		{
+		public:
+			~BandPool()
+			{
+				{
+					std::unique_lock<std::mutex> lck(mMutex);
+					mRunning = false;
+				}
+				mCondition.notify_all();
+				for (auto& thread : mThreads)
+					thread.join();
+			}
+
+			// runs task on a helper, starting helpers until there are at least that many
+			void post(std::function<void()> task, size_t helpers)
+			{
+				std::unique_lock<std::mutex> lck(mMutex);
+				while (mThreads.size() < helpers)
+					mThreads.emplace_back(&BandPool::run, this);
+				mTasks.push_back(std::move(task));
+				mCondition.notify_one();
+			}
+
+		private:
+			void run()
+			{
+				while (true)
+				{
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lck(mMutex);
+						mCondition.wait(lck, [this] { return !mTasks.empty() || !mRunning; });
+						if (mTasks.empty())
+							return;
+						task = std::move(mTasks.front());
+						mTasks.pop_front();
+					}
+					task();
+				}
+			}
+
+			std::mutex mMutex;
+			std::condition_variable mCondition;
+			std::deque<std::function<void()>> mTasks;
+			std::vector<std::thread> mThreads;
+			bool mRunning = true;
+		};
+
+		BandPool& getBandPool()
+		{
+			static BandPool pool;
+			return pool;
+		}
+
+		// calls fn(begin, end) for bands of rows, on the calling thread and up to threads - 1 helpers
+		template<typename F>
+		void forEachBand(size_t rows, size_t threads, F fn)
+		{
+			// bands below this are not worth a thread
+			const size_t MIN_ROWS = 16;
+			threads = std::max<size_t>(std::min(threads, rows / MIN_ROWS), 1);
+			if (threads == 1)
+			{
+				fn(0, rows);
+				return;
+			}
+			std::mutex mutex;
+			std::condition_variable done;
+			size_t pending = threads - 1;
+			for (size_t i = 1; i < threads; i++)
+			{
+				getBandPool().post([&, i]
+				{
+					fn(rows * i / threads, rows * (i + 1) / threads);
+					std::unique_lock<std::mutex> lck(mutex);
+					if (--pending == 0)
+						done.notify_all();
+				}, threads - 1);
+			}
+			fn(0, rows / threads);
+			std::unique_lock<std::mutex> lck(mutex);
+			done.wait(lck, [&] { return pending == 0; });
+		}
+
+		// adds count rows of bytes bytes into 16 bit column sums
+		void sumRows(const uint8_t* first, size_t stride, size_t count, size_t bytes, uint16_t* sums)
+		{
+			size_t x = 0;
+#ifdef CLOUD_VISION_RESIZE_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			for (; x + 16 <= bytes; x += 16)
+			{
+				__m128i lo = zero;
+				__m128i hi = zero;
+				const uint8_t* p = first + x;
+				for (size_t r = 0; r < count; r++, p += stride)
+				{
+					__m128i v = _mm_loadu_si128((const __m128i*)p);
+					lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+					hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+				}
+				_mm_storeu_si128((__m128i*)(sums + x), lo);
+				_mm_storeu_si128((__m128i*)(sums + x + 8), hi);
+			}
+#endif
+			for (; x < bytes; x++)
+			{
+				uint16_t sum = 0;
+				const uint8_t* p = first + x;
+				for (size_t r = 0; r < count; r++, p += stride)
+					sum += *p;
+				sums[x] = sum;
+			}
+		}
+
+		// averages boxX x boxY blocks of src into dst rows [begin, end); C is the channel count
+		// when known at compile time, 0 for any other
+		template<size_t C>
+		void boxReduce(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+			size_t dstWidth, size_t channels, size_t boxX, size_t boxY, size_t begin, size_t end)
+		{
+			if (C)
+				channels = C;
+			size_t bytes = dstWidth * boxX * channels;
+			std::vector<uint16_t> sums(bytes);
+			// rounding division by the box area; one divide per output byte is little next to
+			// the area additions behind it, and a fixed point reciprocal is off for large boxes
+			const uint32_t area = (uint32_t)(boxX * boxY);
+			for (size_t y = begin; y < end; y++)
+			{
+				sumRows(src + y * boxY * srcStride, srcStride, boxY, bytes, sums.data());
+				uint8_t* out = dst + y * dstStride;
+				const uint16_t* in = sums.data();
+				for (size_t x = 0; x < dstWidth; x++)
+				{
+					for (size_t c = 0; c < channels; c++)
+					{
+						uint32_t sum = 0;
+						for (size_t i = 0; i < boxX; i++)
+							sum += in[i * channels + c];
+						out[c] = (uint8_t)((sum + area / 2) / area);
+					}
+					in += boxX * channels;
+					out += channels;
+				}
+			}
+		}
+
+		// 8 bit fixed point bilinear resampling of rows [begin, end), pixel centres aligned
+		template<size_t C>
+		void bilinear(const uint8_t* src, size_t srcStride, size_t srcWidth, size_t srcHeight,
+			uint8_t* dst, size_t dstStride, size_t dstWidth, size_t dstHeight, size_t channels, size_t begin, size_t end)
+		{
+			if (C)
+				channels = C;
+			auto position = [](size_t i, size_t srcSize, size_t dstSize, size_t& index, uint32_t& weight)
+			{
+				float s = ((float)i + 0.5f) * srcSize / dstSize - 0.5f;
+				s = std::max(s, 0.0f);
+				index = std::min((size_t)s, srcSize - 1);
+				weight = index + 1 < srcSize ? (uint32_t)((s - index) * 256.0f + 0.5f) : 0;
+			};
+
+			std::vector<size_t> xIndex(dstWidth);
+			std::vector<uint32_t> xWeight(dstWidth);
+			for (size_t x = 0; x < dstWidth; x++)
+				position(x, srcWidth, dstWidth, xIndex[x], xWeight[x]);
+
+			for (size_t y = begin; y < end; y++)
+			{
+				size_t sy;
+				uint32_t wy;
+				position(y, srcHeight, dstHeight, sy, wy);
+				const uint8_t* row0 = src + sy * srcStride;
+				const uint8_t* row1 = wy ? row0 + srcStride : row0;
+				uint8_t* out = dst + y * dstStride;
+				for (size_t x = 0; x < dstWidth; x++)
+				{
+					size_t i0 = xIndex[x] * channels;
+					size_t i1 = xWeight[x] ? i0 + channels : i0;
+					uint32_t wx = xWeight[x];
+					for (size_t c = 0; c < channels; c++)
+					{
+						uint32_t top = row0[i0 + c] * (256 - wx) + row0[i1 + c] * wx;
+						uint32_t bottom = row1[i0 + c] * (256 - wx) + row1[i1 + c] * wx;
+						out[c] = (uint8_t)((top * (256 - wy) + bottom * wy + (1u << 15)) >> 16);
+					}
+					out += channels;
+				}
+			}
+		}
+
+		// instantiates fn for the usual grey, rgb and rgba layouts
+		template<typename F>
+		void withChannels(size_t channels, F fn)
+		{
+			switch (channels)
+			{
+			case 1: fn(std::integral_constant<size_t, 1>()); break;
+			case 3: fn(std::integral_constant<size_t, 3>()); break;
+			case 4: fn(std::integral_constant<size_t, 4>()); break;
+			default: fn(std::integral_constant<size_t, 0>()); break;
+			}
+		}
+	}
+
+	void fitSize(size_t width, size_t height, size_t maxWidth, size_t maxHeight, size_t& outWidth, size_t& outHeight)
+	{
+		outWidth = width;
+		outHeight = height;
+		if (width == 0 || height == 0 || (width <= maxWidth && height <= maxHeight))
+			return;
+		double scale = std::min((double)maxWidth / width, (double)maxHeight / height);
+		outWidth = std::max<size_t>((size_t)(width * scale + 0.5), 1);
+		outHeight = std::max<size_t>((size_t)(height * scale + 0.5), 1);
+		outWidth = std::min(outWidth, maxWidth);
+		outHeight = std::min(outHeight, maxHeight);
+	}
+
+	void downscale(const ofPixels& src, ofPixels& dst, size_t threads)
+	{
+		size_t srcWidth = src.getWidth();
+		size_t srcHeight = src.getHeight();
+		size_t dstWidth = dst.getWidth();
+		size_t dstHeight = dst.getHeight();
+		size_t channels = src.getNumChannels();
+		if (dstWidth == 0 || dstHeight == 0 || dstWidth > srcWidth || dstHeight > srcHeight || dst.getNumChannels() != channels)
+		{
+			ofLogError("CloudVision") << "downscale: cannot resize " << srcWidth << "x" << srcHeight
+				<< " to " << dstWidth << "x" << dstHeight;
+			return;
+		}
+
+		size_t boxX = std::min(srcWidth / dstWidth, MAX_BOX);
+		size_t boxY = std::min(srcHeight / dstHeight, MAX_BOX);
+		const uint8_t* in = src.getData();
+		size_t inStride = src.getBytesStride();
+		size_t inWidth = srcWidth;
+		size_t inHeight = srcHeight;
+
+		// the box pass writes straight into dst when it already lands on the target size
+		ofPixels reduced;
+		if (boxX > 1 || boxY > 1)
+		{
+			inWidth = srcWidth / boxX;
+			inHeight = srcHeight / boxY;
+			bool exact = inWidth == dstWidth && inHeight == dstHeight;
+			ofPixels& out = exact ? dst : reduced;
+			if (!exact)
+				out.allocate(inWidth, inHeight, channels);
+			uint8_t* outData = out.getData();
+			size_t outStride = out.getBytesStride();
+			withChannels(channels, [&](auto c)
+			{
+				forEachBand(inHeight, threads, [&](size_t begin, size_t end)
+				{
+					boxReduce<decltype(c)::value>(in, inStride, outData, outStride, inWidth, channels, boxX, boxY, begin, end);
+				});
+			});
+			if (exact)
+				return;
+			in = reduced.getData();
+			inStride = reduced.getBytesStride();
+		}
+
+		uint8_t* outData = dst.getData();
+		size_t outStride = dst.getBytesStride();
+		withChannels(channels, [&](auto c)
+		{
+			forEachBand(dstHeight, threads, [&](size_t begin, size_t end)
+			{
+				bilinear<decltype(c)::value>(in, inStride, inWidth, inHeight, outData, outStride, dstWidth, dstHeight, channels, begin, end);
+			});
+		});
+	}
+
+	const char* downscaleGetImplementation()
+	{
+#ifdef CLOUD_VISION_RESIZE_SSE2
+		return "sse2";
+#else
+		return "scalar";
+#endif
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	// size that fits width x height into maxWidth x maxHeight keeping the aspect ratio,
+	// never larger than the original
+	void fitSize(size_t width, size_t height, size_t maxWidth, size_t maxHeight, size_t& outWidth, size_t& outHeight);
+
+	// shrinks src into dst, which must already be allocated with the target size and the
+	// same number of channels; whole multiples of the target are reduced by box averaging
+	// with SSE2 where available, what remains (less than 2x) is resampled bilinearly.
+	// Rows are split across the calling thread and up to threads - 1 helpers that are
+	// shared by every call and kept running once started
+	void downscale(const ofPixels& src, ofPixels& dst, size_t threads = 1);
+
+	// "sse2" or "scalar"
+	const char* downscaleGetImplementation();
+}
@@ -0,0 +1,119 @@
+#include "GoogleCloudVisionRetry.h"
+#include <random>
+
+namespace google
+{
+	uint64_t getBackoffMillis(const RetrySettings& settings, size_t retry)
+	{
+		double delay = (double)settings.initialBackoffMillis * std::pow((double)settings.backoffMultiplier, (double)retry);
+		delay = std::min(delay, (double)settings.maxBackoffMillis);
+		// one generator per thread, seeded differently so workers do not retry in lockstep
+		thread_local std::mt19937 rng(std::random_device{}());
+		std::uniform_real_distribution<double> jitter(0.0, 1.0);
+		return (uint64_t)(delay * jitter(rng));
+	}
+
+	LatencyTracker::LatencyTracker(size_t capacity)
+		:mSamples(std::max<size_t>(capacity, 1))
+	{
+
+	}
+
+	void LatencyTracker::add(uint64_t micros)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mSamples[mNext] = micros;
+		mNext = (mNext + 1) % mSamples.size();
+		mCount = std::min(mCount + 1, mSamples.size());
+	}
+
+	uint64_t LatencyTracker::getPercentile(float percentile, size_t minSamples) const
+	{
+		std::vector<uint64_t> samples;
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			if (mCount == 0 || mCount < minSamples)
+				return 0;
+			samples.assign(mSamples.begin(), mSamples.begin() + mCount);
+		}
+		size_t index = std::min((size_t)(ofClamp(percentile, 0.0f, 1.0f) * (samples.size() - 1) + 0.5f), samples.size() - 1);
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+		return samples[index];
+	}
+
+	bool AbortHandle::attach(const SessionPool::SessionRef& session)
+	{
+		// shuts the socket down, the blocked send or receive throws right away
+		return attach([session] { session->abort(); });
+	}
+
+	bool AbortHandle::attach(std::function<void()> cancel)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		if (mAborted)
+		{
+			cancel();
+			return false;
+		}
+		mCancel = cancel;
+		return true;
+	}
+
+	void AbortHandle::detach()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mCancel = nullptr;
+	}
+
+	void AbortHandle::abort()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mAborted = true;
+		if (mCancel)
+			mCancel();
+	}
+
+	InFlightRequest::InFlightRequest(size_t images)
+		:mImages(images)
+		,mRemaining(images)
+	{
+
+	}
+
+	std::shared_ptr<AbortHandle> InFlightRequest::addAttempt()
+	{
+		auto attempt = make_shared<AbortHandle>();
+		std::unique_lock<std::mutex> lck(mMutex);
+		if (mAborted)
+			attempt->abort();
+		mAttempts.push_back(attempt);
+		return attempt;
+	}
+
+	void InFlightRequest::cancelImage()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		if (mRemaining == 0 || --mRemaining > 0)
+			return;
+		mAborted = true;
+		for (auto& attempt : mAttempts)
+			attempt->abort();
+		mAbortedCondition.notify_all();
+	}
+
+	bool InFlightRequest::sleep(uint64_t millis)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		return !mAbortedCondition.wait_for(lck, std::chrono::milliseconds(millis), [this] { return mAborted.load(); });
+	}
+
+	void RequestState::cancel()
+	{
+		// under the lock, so the worker registering inFlight counts each image once
+		std::unique_lock<std::mutex> lck(mutex);
+		if (cancelled.exchange(true))
+			return;
+		if (inFlight)
+			inFlight->cancelImage();
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ofMain.h"
+#include "GoogleCloudVisionSessionPool.h"
+
+namespace google
+{
+	struct RetrySettings
+	{
+		// further attempts for 429, 5xx and connection errors
+		size_t maxRetries = 2;
+		// the n-th retry waits a random time up to min(maxBackoff, initialBackoff * multiplier^n)
+		uint64_t initialBackoffMillis = 250;
+		uint64_t maxBackoffMillis = 8000;
+		float backoffMultiplier = 2;
+		// time from the push by which a request has to be finished, it fails with
+		// REQUEST_TIMED_OUT otherwise; 0 for no deadline
+		uint64_t deadlineMillis = 0;
+		// sends a second copy of a request that has not been answered within the
+		// hedgePercentile latency of recent requests, the slower one is aborted
+		bool hedge = false;
+		float hedgePercentile = 0.95f;
+		// successful requests needed before the percentile is trusted
+		size_t hedgeMinSamples = 20;
+	};
+
+	// 429, 5xx and connection errors (status -1)
+	inline bool isRetryable(int status)
+	{
+		return status < 0 || status == 429 || status >= 500;
+	}
+
+	// full jitter: uniformly random between 0 and the capped exponential delay
+	uint64_t getBackoffMillis(const RetrySettings& settings, size_t retry);
+
+	// latencies of the most recent requests
+	class LatencyTracker
+	{
+	public:
+		LatencyTracker(size_t capacity = 256);
+		void add(uint64_t micros);
+		// 0 while there are fewer than minSamples
+		uint64_t getPercentile(float percentile, size_t minSamples = 1) const;
+
+	private:
+		std::vector<uint64_t> mSamples;
+		size_t mNext = 0;
+		size_t mCount = 0;
+		mutable std::mutex mMutex;
+	};
+
+	// sessions (or calls) a blocking request is waiting on, so another thread can abort it
+	class AbortHandle
+	{
+	public:
+		// false, with the session aborted, when abort() came first
+		bool attach(const SessionPool::SessionRef& session);
+		// the same for anything else that can be cancelled, like a grpc call
+		bool attach(std::function<void()> cancel);
+		void detach();
+		void abort();
+		bool isAborted() const { return mAborted; }
+
+	private:
+		std::function<void()> mCancel;
+		std::atomic<bool> mAborted{ false };
+		std::mutex mMutex;
+	};
+
+	// the attempts of one request in flight, aborted together once every image in it has been cancelled
+	class InFlightRequest
+	{
+	public:
+		InFlightRequest(size_t images);
+		std::shared_ptr<AbortHandle> addAttempt();
+		// images sent with the request, cancelled ones included
+		size_t getImageCount() const { return mImages; }
+		void cancelImage();
+		bool isAborted() const { return mAborted; }
+		// sleeps for millis or until the request is aborted, false when it was
+		bool sleep(uint64_t millis);
+
+	private:
+		size_t mImages;
+		size_t mRemaining;
+		std::atomic<bool> mAborted{ false };
+		std::vector<std::shared_ptr<AbortHandle>> mAttempts;
+		std::mutex mMutex;
+		std::condition_variable mAbortedCondition;
+	};
+
+	// shared by a CloudVisionRequest and the pipeline working on it
+	struct RequestState
+	{
+		std::atomic<bool> cancelled{ false };
+		// set while the request is being sent
+		std::shared_ptr<InFlightRequest> inFlight;
+		std::mutex mutex;
+
+		void cancel();
+	};
+}
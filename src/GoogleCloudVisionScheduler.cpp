@@ -0,0 +1,137 @@
+#include "GoogleCloudVisionScheduler.h"
+
+namespace google
+{
+	uint64_t parseRetryAfter(const string& value)
+	{
+		// HTTP dates are not used by the service and come out as 0, the caller's backoff applies then
+		char* end = nullptr;
+		double seconds = strtod(value.c_str(), &end);
+		if (end == value.c_str() || seconds <= 0)
+			return 0;
+		return (uint64_t)(seconds * 1000);
+	}
+
+	void TokenBucket::setRate(double perSecond, double capacity, uint64_t now)
+	{
+		bool first = mLast == 0;
+		refill(now);
+		mRate = perSecond;
+		mCapacity = std::max(capacity, 1.0);
+		mTokens = first ? mCapacity : std::min(mTokens, mCapacity);
+		mLast = now;
+	}
+
+	void TokenBucket::refill(uint64_t now)
+	{
+		if (mLast != 0 && now > mLast)
+			mTokens = std::min(mCapacity, mTokens + mRate * (now - mLast) / 1e6);
+		mLast = now;
+	}
+
+	uint64_t TokenBucket::getWaitMicros(double count) const
+	{
+		if (mRate <= 0 || mTokens >= count)
+			return 0;
+		return (uint64_t)((count - mTokens) / mRate * 1e6) + 1;
+	}
+
+	RateController::RateController(const RateLimitSettings& settings)
+		:mSettings(settings)
+	{
+		applyScale(ofGetElapsedTimeMicros());
+	}
+
+	void RateController::applyScale(uint64_t now)
+	{
+		double burst = std::max(mSettings.burstSeconds, 0.0f);
+		double requests = mSettings.requestsPerSecond * mScale;
+		double images = mSettings.imagesPerMinute / 60.0 * mScale;
+		mRequests.setRate(requests, requests * burst, now);
+		mImages.setRate(images, images * burst, now);
+	}
+
+	size_t RateController::acquire(size_t wanted, uint64_t now, uint64_t& waitMicros)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		waitMicros = 0;
+		if (now < mPausedUntil)
+		{
+			waitMicros = mPausedUntil - now;
+			return 0;
+		}
+		if (wanted == 0)
+			return 0;
+
+		mRequests.refill(now);
+		mImages.refill(now);
+		size_t count = wanted;
+		if (mImages.isLimited())
+		{
+			// a batch larger than the tokens there are is cut down to them, the rest of it
+			// stays queued for a later request
+			double tokens = mImages.getTokens();
+			count = std::min(count, (size_t)std::max(tokens, 0.0));
+			if (count == 0)
+				waitMicros = mImages.getWaitMicros(1);
+		}
+		if (mRequests.isLimited() && mRequests.getTokens() < 1)
+			waitMicros = std::max(waitMicros, mRequests.getWaitMicros(1));
+		if (waitMicros > 0)
+			return 0;
+
+		mRequests.take(1);
+		mImages.take((double)count);
+		return count;
+	}
+
+	void RateController::charge(size_t images, uint64_t now)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mRequests.refill(now);
+		mImages.refill(now);
+		mRequests.take(1);
+		mImages.take((double)images);
+	}
+
+	void RateController::onThrottled(uint64_t retryAfterMillis, uint64_t now)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		if (retryAfterMillis > 0)
+			mPausedUntil = std::max(mPausedUntil, now + retryAfterMillis * 1000);
+		// what is left of the burst would only be throttled as well
+		mRequests.clear();
+		mImages.clear();
+		if (!mSettings.adaptive)
+			return;
+
+		// the 429s of requests that were in flight together count once
+		if (mLastDecrease != 0 && now - mLastDecrease < 1000000)
+			return;
+		mLastDecrease = now;
+		mScale = std::max(mScale * 0.5f, std::max(mSettings.minRateFraction, 0.001f));
+		applyScale(now);
+		ofLogNotice("CloudVision") << "throttled, sending at " << (int)(mScale * 100) << "% of the configured rate";
+	}
+
+	void RateController::onSuccess(uint64_t now)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		if (!mSettings.adaptive || mScale >= 1)
+			return;
+		mScale = std::min(1.0f, mScale + mSettings.recoveryStep);
+		applyScale(now);
+	}
+
+	uint64_t RateController::getPauseMicros(uint64_t now) const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		return now < mPausedUntil ? mPausedUntil - now : 0;
+	}
+
+	float RateController::getRateFraction() const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		return mScale;
+	}
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	enum Priority
+	{
+		// someone is waiting for the result, e.g. a dropped file
+		PRIORITY_INTERACTIVE,
+		PRIORITY_NORMAL,
+		// only sent while nothing more important is waiting, e.g. camera frames
+		PRIORITY_BACKGROUND,
+		NUM_PRIORITIES
+	};
+
+	struct RateLimitSettings
+	{
+		// requests wait in the scheduler until the budget below allows them; retries and
+		// hedges go out right away but are charged to the same budget
+		bool enabled = false;
+		// 0 for no limit
+		float requestsPerSecond = 10;
+		float imagesPerMinute = 1800;
+		// unused budget that may be spent at once, in seconds of the rate
+		float burstSeconds = 1;
+		// sending pauses for the Retry-After of a 429; with adaptive the 429 also halves
+		// the rates, and every successful request wins back recoveryStep of them
+		bool adaptive = true;
+		float recoveryStep = 0.02f;
+		float minRateFraction = 0.05f;
+		// images waiting to be scheduled, the encoders wait beyond that
+		size_t maxQueueSize = 64;
+	};
+
+	// Retry-After in milliseconds, 0 when missing; the service sends delay-seconds
+	uint64_t parseRetryAfter(const string& value);
+
+	class TokenBucket
+	{
+	public:
+		// tokens start full
+		void setRate(double perSecond, double capacity, uint64_t now);
+		void refill(uint64_t now);
+		double getTokens() const { return mTokens; }
+		// may go negative, later requests then wait for the debt to be paid off
+		void take(double tokens) { mTokens -= tokens; }
+		void clear() { mTokens = std::min(mTokens, 0.0); }
+		// time until count tokens are there
+		uint64_t getWaitMicros(double count) const;
+		bool isLimited() const { return mRate > 0; }
+
+	private:
+		double mRate = 0;
+		double mCapacity = 0;
+		double mTokens = 0;
+		uint64_t mLast = 0;
+	};
+
+	// the request and image budgets, scaled down by 429s and back up by successes
+	class RateController
+	{
+	public:
+		RateController(const RateLimitSettings& settings);
+		// how many of wanted images may go out in one request now, at least 1 unless it
+		// returns 0 and the time to wait
+		size_t acquire(size_t wanted, uint64_t now, uint64_t& waitMicros);
+		// spends the budget of a request that goes out without acquire(), a retry or a hedge,
+		// without waiting; the buckets go into debt and later requests wait for it instead
+		void charge(size_t images, uint64_t now);
+		void onThrottled(uint64_t retryAfterMillis, uint64_t now);
+		void onSuccess(uint64_t now);
+		// what is left of the last Retry-After
+		uint64_t getPauseMicros(uint64_t now) const;
+		// share of the configured rates currently used
+		float getRateFraction() const;
+
+	private:
+		void applyScale(uint64_t now);
+
+		RateLimitSettings mSettings;
+		TokenBucket mRequests;
+		TokenBucket mImages;
+		float mScale = 1;
+		uint64_t mLastDecrease = 0;
+		uint64_t mPausedUntil = 0;
+		mutable std::mutex mMutex;
+	};
+
+	// between the encode and the request stage when rate limiting is enabled: batches are
+	// only handed out when the RateController allows them, highest priority first
+	template<typename T>
+	class RequestScheduler
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		RequestScheduler(RateController& controller, size_t capacity)
+			:mController(controller)
+			,mCapacity(std::max<size_t>(capacity, 1))
+		{
+
+		}
+
+		// waits while the scheduler is full, false once closed
+		bool push(T&& item, Priority priority)
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mNotFull.wait(lck, [this] { return mClosed || mSize < mCapacity; });
+			if (mClosed)
+				return false;
+			if (mSize == 0)
+				mFirstQueued = Clock::now();
+			mItems[priority < NUM_PRIORITIES ? priority : PRIORITY_NORMAL].emplace_back(std::move(item));
+			mSize++;
+			mChanged.notify_all();
+			return true;
+		}
+
+		// blocks until an item is queued, lingers for more like BoundedQueue::popBatch, then
+		// until the budget allows a request; false once closed
+		bool popBatch(std::vector<T>& out, size_t maxCount, Clock::duration linger = Clock::duration::zero())
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mChanged.wait(lck, [this] { return mClosed || mSize > 0; });
+			if (mClosed)
+				return false;
+
+			if (linger > Clock::duration::zero())
+			{
+				mChanged.wait_until(lck, mFirstQueued + linger, [this, maxCount] {
+					return mClosed || mSize == 0 || mSize >= maxCount;
+				});
+			}
+
+			// items may arrive, or be taken by another worker, while waiting for the budget
+			size_t count = 0;
+			while (!mClosed)
+			{
+				if (mSize == 0)
+				{
+					mChanged.wait(lck, [this] { return mClosed || mSize > 0; });
+					continue;
+				}
+				uint64_t wait = 0;
+				count = mController.acquire(std::min(maxCount, mSize), ofGetElapsedTimeMicros(), wait);
+				if (count > 0)
+					break;
+				mChanged.wait_for(lck, std::chrono::microseconds(std::max<uint64_t>(wait, 1000)));
+			}
+			if (mClosed)
+				return false;
+
+			for (auto& items : mItems)
+			{
+				while (count > 0 && !items.empty())
+				{
+					out.emplace_back(std::move(items.front()));
+					items.pop_front();
+					mSize--;
+					count--;
+				}
+			}
+			mFirstQueued = Clock::now();
+			mNotFull.notify_all();
+			return true;
+		}
+
+		void close()
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mClosed = true;
+			mChanged.notify_all();
+			mNotFull.notify_all();
+		}
+
+		size_t size() const
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			return mSize;
+		}
+
+		// moves everything still queued to out, highest priority first
+		void drain(std::vector<T>& out)
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			for (auto& items : mItems)
+			{
+				for (auto& item : items)
+					out.emplace_back(std::move(item));
+				items.clear();
+			}
+			mSize = 0;
+			mNotFull.notify_all();
+		}
+
+	private:
+		RateController& mController;
+		std::deque<T> mItems[NUM_PRIORITIES];
+		size_t mSize = 0;
+		size_t mCapacity;
+		bool mClosed = false;
+		Clock::time_point mFirstQueued;
+		mutable std::mutex mMutex;
+		std::condition_variable mChanged;
+		std::condition_variable mNotFull;
+	};
+}
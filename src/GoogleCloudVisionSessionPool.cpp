@@ -0,0 +1,122 @@
+#include "GoogleCloudVisionSessionPool.h"
+#include "Poco/Net/HTTPSClientSession.h"
+
+using namespace Poco;
+using namespace Poco::Net;
+
+namespace google
+{
+	SessionPool::SessionPool(const SessionPoolSettings& settings)
+		:mSettings(settings)
+	{
+
+	}
+
+	SessionPool::~SessionPool()
+	{
+		clear();
+	}
+
+	SessionPool::SessionRef SessionPool::acquire(const URI& uri, bool& reused)
+	{
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			uint64_t now = ofGetElapsedTimeMillis();
+			evictExpired(now);
+			auto it = mIdle.find(getKey(uri));
+			while (it != mIdle.end() && !it->second.empty())
+			{
+				// most recently used first, it is the least likely to have been closed by the server
+				auto idle = std::move(it->second.back());
+				it->second.pop_back();
+				if (idle.session->connected())
+				{
+					reused = true;
+					return idle.session;
+				}
+			}
+		}
+		reused = false;
+		return createSession(uri);
+	}
+
+	void SessionPool::release(const URI& uri, SessionRef session)
+	{
+		if (!session || !session->connected())
+			return;
+
+		std::unique_lock<std::mutex> lck(mMutex);
+		auto& idle = mIdle[getKey(uri)];
+		if (idle.size() >= mSettings.maxIdlePerHost)
+			return;
+		IdleSession entry;
+		entry.session = std::move(session);
+		entry.releasedTime = ofGetElapsedTimeMillis();
+		idle.emplace_back(std::move(entry));
+	}
+
+	void SessionPool::clear()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mIdle.clear();
+	}
+
+	void SessionPool::setMaxIdlePerHost(size_t count)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mSettings.maxIdlePerHost = count;
+		for (auto& it : mIdle)
+		{
+			while (it.second.size() > count)
+				it.second.pop_front();
+		}
+	}
+
+	void SessionPool::setIdleTimeout(uint64_t millis)
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		mSettings.idleTimeoutMillis = millis;
+	}
+
+	size_t SessionPool::getIdleCount() const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		size_t count = 0;
+		for (auto& it : mIdle)
+			count += it.second.size();
+		return count;
+	}
+
+	SessionPoolSettings SessionPool::getSettings() const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		return mSettings;
+	}
+
+	string SessionPool::getKey(const URI& uri)
+	{
+		return uri.getScheme() + "://" + uri.getHost() + ":" + ofToString(uri.getPort());
+	}
+
+	SessionPool::SessionRef SessionPool::createSession(const URI& uri) const
+	{
+		SessionRef session;
+		if (uri.getScheme() == "https")
+			session = make_shared<HTTPSClientSession>(uri.getHost(), uri.getPort());
+		else
+			session = make_shared<HTTPClientSession>(uri.getHost(), uri.getPort());
+		session->setTimeout(Timespan(static_cast<Timespan::TimeDiff>(mSettings.timeoutMillis) * 1000));
+		session->setKeepAlive(mSettings.maxIdlePerHost > 0);
+		return session;
+	}
+
+	void SessionPool::evictExpired(uint64_t now)
+	{
+		for (auto& it : mIdle)
+		{
+			auto& idle = it.second;
+			while (!idle.empty() && now - idle.front().releasedTime > mSettings.idleTimeoutMillis)
+				idle.pop_front();
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ofMain.h"
+#include "Poco/Net/HTTPClientSession.h"
+#include "Poco/URI.h"
+
+namespace google
+{
+	struct SessionPoolSettings
+	{
+		// idle keep-alive sessions kept per host:port, 0 disables reuse
+		size_t maxIdlePerHost = 4;
+		// idle sessions older than this are closed instead of reused
+		uint64_t idleTimeoutMillis = 30000;
+		// send/receive timeout of every session
+		uint64_t timeoutMillis = 20000;
+	};
+
+	// keeps keep-alive HTTP(S) sessions around so consecutive requests to the same
+	// host skip the TCP connect and TLS handshake
+	class SessionPool
+	{
+	public:
+		typedef std::shared_ptr<Poco::Net::HTTPClientSession> SessionRef;
+
+		SessionPool(const SessionPoolSettings& settings = SessionPoolSettings());
+		~SessionPool();
+
+		// an idle session for the uri's host:port if one is alive, a new one otherwise
+		SessionRef acquire(const Poco::URI& uri, bool& reused);
+		// hand a session back once its response has been read completely
+		void release(const Poco::URI& uri, SessionRef session);
+		void clear();
+
+		void setMaxIdlePerHost(size_t count);
+		void setIdleTimeout(uint64_t millis);
+		size_t getIdleCount() const;
+		SessionPoolSettings getSettings() const;
+
+	private:
+		struct IdleSession
+		{
+			SessionRef session;
+			uint64_t releasedTime = 0;
+		};
+
+		static string getKey(const Poco::URI& uri);
+		SessionRef createSession(const Poco::URI& uri) const;
+		void evictExpired(uint64_t now);
+
+		SessionPoolSettings mSettings;
+		std::map<string, std::deque<IdleSession>> mIdle;
+		mutable std::mutex mMutex;
+	};
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct StageStats
+	{
+		string name;
+		size_t threads = 0;
+		// items the stage has finished
+		uint64_t items = 0;
+		// time spent working on them, summed over the stage's threads
+		uint64_t busyMicros = 0;
+		// waiting in the queue in front of the stage
+		size_t queued = 0;
+		// busy time over the time the stage's threads have been running, 1 when it never waits
+		float utilization = 0;
+	};
+
+	// lock-free counters a pipeline stage updates after every item
+	class StageCounter
+	{
+	public:
+		StageCounter()
+			:mStartMicros(ofGetElapsedTimeMicros())
+		{
+
+		}
+
+		void add(uint64_t busyMicros, uint64_t items = 1)
+		{
+			mBusyMicros += busyMicros;
+			mItems += items;
+		}
+
+		StageStats getStats(const string& name, size_t threads, size_t queued) const
+		{
+			StageStats stats;
+			stats.name = name;
+			stats.threads = threads;
+			stats.items = mItems;
+			stats.busyMicros = mBusyMicros;
+			stats.queued = queued;
+			uint64_t elapsed = ofGetElapsedTimeMicros() - mStartMicros;
+			if (elapsed > 0 && threads > 0)
+				stats.utilization = (float)((double)stats.busyMicros / ((double)elapsed * threads));
+			return stats;
+		}
+
+	private:
+		const uint64_t mStartMicros;
+		std::atomic<uint64_t> mBusyMicros{ 0 };
+		std::atomic<uint64_t> mItems{ 0 };
+	};
+}
@@ -0,0 +1,174 @@
+#include "GoogleCloudVisionTrace.h"
+
+namespace google
+{
+	namespace
+	{
+		// every entry is a header line followed by the raw response and a newline:
+		// TRACE <timestamp> <latency> <http status> <reused> <request bytes> <ids,...> <response bytes>
+		const string TRACE_TAG = "TRACE";
+	}
+
+	TraceRecorder::TraceRecorder(const TraceSettings& settings)
+		:mSettings(settings)
+	{
+		mRing.resize(std::max<size_t>(mSettings.capacity, 1));
+		mSettings.maxFiles = std::max<size_t>(mSettings.maxFiles, 1);
+		mWriter = std::thread(&TraceRecorder::writerFunction, this);
+	}
+
+	TraceRecorder::~TraceRecorder()
+	{
+		{
+			std::unique_lock<std::mutex> lck(mMutex);
+			mRunning = false;
+			mCondition.notify_all();
+		}
+		if (mWriter.joinable())
+			mWriter.join();
+	}
+
+	void TraceRecorder::record(TraceEntry&& entry)
+	{
+		if (!mSettings.recordResponses)
+			entry.response.clear();
+
+		std::unique_lock<std::mutex> lck(mMutex);
+		size_t index = (mHead + mCount) % mRing.size();
+		if (mCount == mRing.size())
+		{
+			mHead = (mHead + 1) % mRing.size();
+			mDropped++;
+			mWritten++;
+		}
+		else
+		{
+			mCount++;
+		}
+		mRing[index] = std::move(entry);
+		mRecorded++;
+		mCondition.notify_all();
+	}
+
+	void TraceRecorder::flush()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		uint64_t target = mRecorded;
+		mCondition.wait(lck, [this, target] { return mWritten >= target || !mRunning; });
+	}
+
+	uint64_t TraceRecorder::getDroppedCount() const
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		return mDropped;
+	}
+
+	void TraceRecorder::writerFunction()
+	{
+		std::unique_lock<std::mutex> lck(mMutex);
+		while (true)
+		{
+			mCondition.wait(lck, [this] { return mCount > 0 || !mRunning; });
+			if (mCount == 0 && !mRunning)
+				break;
+
+			// take the entry out of the ring and write it without holding the lock
+			TraceEntry entry = std::move(mRing[mHead]);
+			mHead = (mHead + 1) % mRing.size();
+			mCount--;
+			lck.unlock();
+			write(entry);
+			lck.lock();
+			mWritten++;
+			mCondition.notify_all();
+		}
+		if (mFile.is_open())
+			mFile.close();
+	}
+
+	void TraceRecorder::write(const TraceEntry& entry)
+	{
+		if (!mFile.is_open())
+		{
+			mFile.open(getFileName(0), std::ios::binary | std::ios::app);
+			mFile.seekp(0, std::ios::end);
+			mFileSize = mFile.tellp();
+		}
+		if (mFileSize >= mSettings.maxFileSize)
+			rotate();
+
+		string ids;
+		for (auto id : entry.ids)
+		{
+			if (!ids.empty())
+				ids += ",";
+			ids += ofToString(id);
+		}
+		if (ids.empty())
+			ids = "-";
+
+		string header = TRACE_TAG + " " + ofToString(entry.timestamp) + " " + ofToString(entry.latencyMicros) + " " +
+			ofToString(entry.httpStatus) + " " + (entry.connectionReused ? "1" : "0") + " " + ofToString(entry.requestBytes) + " " +
+			ids + " " + ofToString(entry.response.size()) + "\n";
+		mFile.write(header.data(), header.size());
+		mFile.write(entry.response.data(), entry.response.size());
+		mFile.put('\n');
+		mFile.flush();
+		mFileSize += header.size() + entry.response.size() + 1;
+	}
+
+	void TraceRecorder::rotate()
+	{
+		mFile.close();
+		// the oldest file falls off, the others move one index up
+		std::remove(getFileName(mSettings.maxFiles - 1).c_str());
+		for (size_t i = mSettings.maxFiles - 1; i > 0; i--)
+			std::rename(getFileName(i - 1).c_str(), getFileName(i).c_str());
+		mFile.open(getFileName(0), std::ios::binary | std::ios::trunc);
+		mFileSize = 0;
+	}
+
+	string TraceRecorder::getFileName(size_t index) const
+	{
+		string name = mSettings.path;
+		if (index > 0)
+			name += "." + ofToString(index);
+		return ofToDataPath(name + ".trace", true);
+	}
+
+	size_t TraceRecorder::read(const string& file, std::function<void(const TraceEntry&)> callback)
+	{
+		std::ifstream in(ofToDataPath(file, true), std::ios::binary);
+		size_t count = 0;
+		string line;
+		while (std::getline(in, line))
+		{
+			std::istringstream header(line);
+			string tag, ids;
+			int reused = 0;
+			size_t length = 0;
+			TraceEntry entry;
+			header >> tag >> entry.timestamp >> entry.latencyMicros >> entry.httpStatus >> reused >> entry.requestBytes >> ids >> length;
+			if (tag != TRACE_TAG || header.fail())
+			{
+				ofLogError("TraceRecorder") << "malformed entry in " << file;
+				break;
+			}
+			entry.connectionReused = reused != 0;
+			if (ids != "-")
+			{
+				for (auto& id : ofSplitString(ids, ","))
+					entry.ids.push_back((size_t)strtoull(id.c_str(), nullptr, 10));
+			}
+			entry.response.resize(length);
+			if (length > 0)
+				in.read(&entry.response[0], length);
+			in.get();
+			if (!in)
+				break;
+			callback(entry);
+			count++;
+		}
+		return count;
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ofMain.h"
+
+namespace google
+{
+	struct TraceSettings
+	{
+		bool enabled = false;
+		// written as <path>.trace, rotated to <path>.1.trace ... <path>.<maxFiles - 1>.trace
+		string path = "cloudvision";
+		uint64_t maxFileSize = 64 * 1024 * 1024;
+		size_t maxFiles = 4;
+		// entries waiting for the writer, the oldest are overwritten when it falls behind
+		size_t capacity = 256;
+		// keep the raw response bodies, needed for replay
+		bool recordResponses = true;
+	};
+
+	// one images:annotate round trip
+	struct TraceEntry
+	{
+		// ofGetSystemTimeMicros() when the request was sent
+		uint64_t timestamp = 0;
+		uint64_t latencyMicros = 0;
+		int httpStatus = 0;
+		bool connectionReused = false;
+		uint64_t requestBytes = 0;
+		// ids of the images in the request, in request order
+		std::vector<size_t> ids;
+		string response;
+	};
+
+	// records request metadata and raw responses into an in-memory ring that a background
+	// thread appends to rotating trace files, so recording never waits on the disk
+	class TraceRecorder
+	{
+	public:
+		TraceRecorder(const TraceSettings& settings);
+		~TraceRecorder();
+
+		void record(TraceEntry&& entry);
+		// blocks until everything recorded so far is on disk
+		void flush();
+		// entries overwritten before the writer got to them
+		uint64_t getDroppedCount() const;
+
+		// reads the entries of one trace file in order, returns how many were read
+		static size_t read(const string& file, std::function<void(const TraceEntry&)> callback);
+
+	private:
+		void writerFunction();
+		void write(const TraceEntry& entry);
+		void rotate();
+		string getFileName(size_t index) const;
+
+		TraceSettings mSettings;
+		std::vector<TraceEntry> mRing;
+		size_t mHead = 0;
+		size_t mCount = 0;
+		uint64_t mDropped = 0;
+		uint64_t mRecorded = 0;
+		uint64_t mWritten = 0;
+		bool mRunning = true;
+		mutable std::mutex mMutex;
+		std::condition_variable mCondition;
+		std::ofstream mFile;
+		uint64_t mFileSize = 0;
+		std::thread mWriter;
+	};
+}
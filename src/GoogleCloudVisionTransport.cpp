@@ -0,0 +1,398 @@
+#include "GoogleCloudVisionTransport.h"
+#include "GoogleCloudVision.h"
+#include "GoogleCloudVisionParser.h"
+#include "GoogleCloudVisionProtobuf.h"
+#include "Poco/Net/HTTPResponse.h"
+#include "Poco/Net/HTTPRequest.h"
+#include "Poco/URI.h"
+#include "Poco/InflatingStream.h"
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/generic/generic_stub.h>
+#endif
+
+using namespace Poco;
+using namespace Poco::Net;
+
+namespace google
+{
+	RestTransport::RestTransport(const TransportContext& context)
+		:Transport(context)
+		,mUrl(context.endpoint + "images:annotate?key=" + context.key)
+	{
+
+	}
+
+	RequestBody RestTransport::buildRequest(std::vector<AnnotateImage>& images) const
+	{
+		RequestBody body;
+		body.appendText(R"({"requests":[)");
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			if (i > 0)
+				body.appendText(",");
+			if (!images[i].uri.empty())
+			{
+				body.appendText(R"({"image":{"source":{"imageUri":)" + toJsonString(images[i].uri) + "}}");
+			}
+			else
+			{
+				body.appendText(R"({"image":{"content":")");
+				body.appendBase64(std::move(images[i].content));
+				body.appendText(R"("})");
+			}
+			body.appendText(R"(,"features":[)" + *images[i].features + "]}");
+		}
+		body.appendText("]}");
+		auto& compression = mContext.compression;
+		if (compression.compressRequests && body.size() >= compression.minRequestBytes)
+			body.compress(compression.level);
+		return body;
+	}
+
+	void RestTransport::parseResponse(std::istream& in, const ofHttpResponse& response,
+		const std::vector<CloudVisionResponse*>& responses, size_t expectedResults) const
+	{
+		parseAnnotateResponse(in, response.status, response.error, responses, expectedResults);
+	}
+
+	ofHttpResponse RestTransport::post(const RequestBody& body, bool* connectionReused, ResponseHandler handler,
+		AbortHandle* abort, uint64_t timeoutMillis)
+	{
+		ofHttpResponse response;
+		URI uri(mUrl.c_str());
+		std::string path(uri.getPathAndQuery());
+		if (path.empty()) path = "/";
+		auto& pool = *mContext.sessionPool;
+
+		// a pooled keep-alive session may have been closed by the server while idle,
+		// in that case the request is sent once more on a fresh connection; not once an
+		// answer has started to arrive, the server has seen the request then and the
+		// handler may have consumed part of it
+		for (int attempt = 0; attempt < 2; attempt++)
+		{
+			bool reused = false;
+			bool received = false;
+			SessionPool::SessionRef session;
+			try {
+				session = pool.acquire(uri, reused);
+				// pooled sessions keep the last timeout, so it is set on every request
+				uint64_t timeout = pool.getSettings().timeoutMillis;
+				if (timeoutMillis)
+					timeout = std::min(timeout, timeoutMillis);
+				session->setTimeout(Poco::Timespan((Poco::Timespan::TimeDiff)timeout * 1000));
+				if (abort && !abort->attach(session))
+				{
+					response.status = -1;
+					response.error = "aborted";
+					return response;
+				}
+
+				HTTPRequest req(HTTPRequest::HTTP_POST, path, HTTPMessage::HTTP_1_1);
+				req.setContentType("application/json");
+				req.setContentLength(body.size());
+				req.setKeepAlive(session->getKeepAlive());
+				string encoding = body.getContentEncoding();
+				if (!encoding.empty())
+					req.set("Content-Encoding", encoding);
+				if (mContext.compression.acceptGzip)
+				{
+					req.set("Accept-Encoding", "gzip");
+					// Google APIs only compress for user agents that mention gzip
+					req.set("User-Agent", "ofxGoogleCloudVision (gzip)");
+				}
+
+				HTTPResponse res;
+				// a new session connects and shakes hands in its first send
+				uint64_t phaseStart = ofGetElapsedTimeMicros();
+				std::ostream& os = session->sendRequest(req);
+				uint64_t now = ofGetElapsedTimeMicros();
+				if (!reused)
+				{
+					record(PHASE_CONNECT, now - phaseStart);
+					count(COUNTER_CONNECTIONS);
+				}
+				phaseStart = now;
+				body.writeTo(os);
+				now = ofGetElapsedTimeMicros();
+				record(PHASE_UPLOAD, now - phaseStart);
+				count(COUNTER_REQUESTS);
+				count(COUNTER_BYTES_SENT, body.size());
+				phaseStart = now;
+				istream& source = session->receiveResponse(res);
+				received = true;
+				now = ofGetElapsedTimeMicros();
+				record(PHASE_SERVER, now - phaseStart);
+				phaseStart = now;
+
+				// counted on the way through only when someone is looking
+				std::unique_ptr<CountingStreamBuffer> counter;
+				std::unique_ptr<std::istream> counted;
+				if (mContext.metrics)
+				{
+					counter.reset(new CountingStreamBuffer(source));
+					counted.reset(new std::istream(counter.get()));
+				}
+				istream& wire = counted ? *counted : source;
+				// gzip is decoded on the way into the parser, never buffered as a whole
+				std::unique_ptr<InflatingInputStream> inflated;
+				if (ofToLower(res.get("Content-Encoding", "")) == "gzip")
+					inflated.reset(new InflatingInputStream(wire, InflatingStreamBuf::STREAM_GZIP));
+				istream& rs = inflated ? static_cast<istream&>(*inflated) : wire;
+
+				response.status = res.getStatus();
+				response.error = res.getReason();
+				response.request.url = mUrl;
+				if (response.status == 429)
+					mContext.rateController->onThrottled(parseRetryAfter(res.get("Retry-After", "")), ofGetElapsedTimeMicros());
+				else if (response.status == 200)
+					mContext.rateController->onSuccess(ofGetElapsedTimeMicros());
+				if (handler)
+				{
+					handler(response, rs);
+					// the rest of the body has to be read before the session can be reused
+					rs.ignore(std::numeric_limits<std::streamsize>::max());
+					if (inflated)
+						wire.ignore(std::numeric_limits<std::streamsize>::max());
+				}
+				else
+				{
+					response.data.set(rs);
+					record(PHASE_DOWNLOAD, ofGetElapsedTimeMicros() - phaseStart);
+				}
+				if (counter)
+					count(COUNTER_BYTES_RECEIVED, counter->getCount());
+
+				if (abort)
+					abort->detach();
+				if (connectionReused)
+					*connectionReused = reused;
+				if (res.getKeepAlive() && !source.bad())
+					pool.release(uri, session);
+				return response;
+			}
+			catch (Exception& exc) {
+				if (abort)
+				{
+					abort->detach();
+					if (abort->isAborted())
+					{
+						ofLogVerbose("CloudVision") << "request aborted";
+						response.status = -1;
+						response.error = "aborted";
+						break;
+					}
+				}
+				if (reused && !received)
+				{
+					ofLogVerbose("CloudVision") << "pooled connection broken, reconnecting: " << exc.displayText();
+					continue;
+				}
+
+				ofLogError("CloudVision") << "CloudVision error postData --";
+
+				// for now print error, need to broadcast a response
+				ofLogError("CloudVision") << exc.displayText();
+				response.status = -1;
+				response.error = exc.displayText();
+				break;
+			}
+		}
+		return response;
+	}
+
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+	namespace
+	{
+		const char* BATCH_ANNOTATE_METHOD = "/google.cloud.vision.v1.ImageAnnotator/BatchAnnotateImages";
+
+		// the closest HTTP status, so retries and the rate controller see the same as with REST
+		int toHttpStatus(grpc::StatusCode code)
+		{
+			switch (code)
+			{
+			case grpc::StatusCode::OK: return 200;
+			case grpc::StatusCode::INVALID_ARGUMENT:
+			case grpc::StatusCode::FAILED_PRECONDITION:
+			case grpc::StatusCode::OUT_OF_RANGE: return 400;
+			case grpc::StatusCode::UNAUTHENTICATED: return 401;
+			case grpc::StatusCode::PERMISSION_DENIED: return 403;
+			case grpc::StatusCode::NOT_FOUND: return 404;
+			case grpc::StatusCode::RESOURCE_EXHAUSTED: return 429;
+			case grpc::StatusCode::UNIMPLEMENTED: return 501;
+			case grpc::StatusCode::UNAVAILABLE: return 503;
+			case grpc::StatusCode::DEADLINE_EXCEEDED: return 504;
+			// aborted by us, like a reset connection
+			case grpc::StatusCode::CANCELLED: return -1;
+			default: return 500;
+			}
+		}
+	}
+
+	struct GrpcTransport::Channel
+	{
+		std::shared_ptr<grpc::Channel> channel;
+		std::unique_ptr<grpc::GenericStub> stub;
+	};
+
+	GrpcTransport::GrpcTransport(const TransportContext& context)
+		:Transport(context)
+		,mChannel(new Channel)
+	{
+		auto credentials = context.grpc.insecure ? grpc::InsecureChannelCredentials()
+			: grpc::SslCredentials(grpc::SslCredentialsOptions());
+		grpc::ChannelArguments args;
+		// answers for large batches exceed the default limit of 4MB
+		args.SetMaxReceiveMessageSize(-1);
+		args.SetMaxSendMessageSize(-1);
+		mChannel->channel = grpc::CreateCustomChannel(context.grpc.target, credentials, args);
+		mChannel->stub.reset(new grpc::GenericStub(mChannel->channel));
+	}
+
+	GrpcTransport::~GrpcTransport()
+	{
+
+	}
+
+	RequestBody GrpcTransport::buildRequest(std::vector<AnnotateImage>& images) const
+	{
+		// BatchAnnotateImagesRequest, the image bytes stay in their buffers
+		RequestBody body;
+		string header, footer;
+		for (auto& image : images)
+		{
+			if (!image.uri.empty())
+			{
+				body.appendText(encodeImageRequest(image.uri, *image.features));
+				continue;
+			}
+			encodeImageRequest(image.content.size(), *image.features, header, footer);
+			body.appendText(header);
+			body.appendBytes(std::move(image.content));
+			body.appendText(footer);
+		}
+		return body;
+	}
+
+	void GrpcTransport::parseResponse(std::istream& in, const ofHttpResponse& response,
+		const std::vector<CloudVisionResponse*>& responses, size_t expectedResults) const
+	{
+		// post() hands out the message in place, anything else is read first
+		auto buffer = dynamic_cast<MemoryBuffer*>(in.rdbuf());
+		if (buffer)
+		{
+			decodeAnnotateResponse(buffer->data(), buffer->size(), response.status, response.error, responses, expectedResults);
+			return;
+		}
+		string message((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		decodeAnnotateResponse(message.data(), message.size(), response.status, response.error, responses, expectedResults);
+	}
+
+	ofHttpResponse GrpcTransport::post(const RequestBody& body, bool* connectionReused, ResponseHandler handler,
+		AbortHandle* abort, uint64_t timeoutMillis)
+	{
+		ofHttpResponse response;
+		response.request.url = mContext.grpc.target;
+
+		// the parts are referenced, not copied; body outlives the call
+		std::vector<grpc::Slice> parts;
+		body.forEachPart([&parts](const char* data, size_t size)
+		{
+			parts.emplace_back(data, size, grpc::Slice::STATIC_SLICE);
+		});
+		grpc::ByteBuffer request(parts.data(), parts.size());
+
+		grpc::ClientContext context;
+		context.AddMetadata("x-goog-api-key", mContext.key);
+		if (timeoutMillis)
+			context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(timeoutMillis));
+		if (abort && !abort->attach([&context] { context.TryCancel(); }))
+		{
+			response.status = -1;
+			response.error = "aborted";
+			return response;
+		}
+
+		// calls share the channel's connection, a new one is only made when it is idle or broken
+		bool reused = mChannel->channel->GetState(true) == GRPC_CHANNEL_READY;
+		if (!reused)
+			count(COUNTER_CONNECTIONS);
+		uint64_t phaseStart = ofGetElapsedTimeMicros();
+		grpc::CompletionQueue queue;
+		grpc::ByteBuffer reply;
+		grpc::Status status;
+		auto call = mChannel->stub->PrepareUnaryCall(&context, BATCH_ANNOTATE_METHOD, request, &queue);
+		call->StartCall();
+		call->Finish(&reply, &status, nullptr);
+		void* tag;
+		bool ok;
+		queue.Next(&tag, &ok);
+		if (abort)
+			abort->detach();
+		queue.Shutdown();
+		while (queue.Next(&tag, &ok)) {}
+		// upload and server time are one phase, grpc does not report them apart
+		record(PHASE_SERVER, ofGetElapsedTimeMicros() - phaseStart);
+		count(COUNTER_REQUESTS);
+		count(COUNTER_BYTES_SENT, body.size());
+		count(COUNTER_BYTES_RECEIVED, reply.Length());
+
+		response.status = toHttpStatus(status.error_code());
+		response.error = status.ok() ? "OK" : status.error_message();
+		if (response.status == 429)
+			mContext.rateController->onThrottled(0, ofGetElapsedTimeMicros());
+		else if (response.status == 200)
+			mContext.rateController->onSuccess(ofGetElapsedTimeMicros());
+		if (response.status < 0 && abort && abort->isAborted())
+			response.error = "aborted";
+		else if (!status.ok())
+			ofLogError("CloudVision") << "grpc error " << status.error_code() << ": " << status.error_message();
+		if (connectionReused)
+			*connectionReused = reused;
+
+		// a message usually arrives in one slice and is read in place
+		std::vector<grpc::Slice> slices;
+		reply.Dump(&slices);
+		string joined;
+		const char* data = nullptr;
+		size_t size = 0;
+		if (slices.size() == 1)
+		{
+			data = reinterpret_cast<const char*>(slices[0].begin());
+			size = slices[0].size();
+		}
+		else
+		{
+			for (auto& slice : slices)
+				joined.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+			data = joined.data();
+			size = joined.size();
+		}
+
+		if (handler)
+		{
+			MemoryBuffer buffer(data, size);
+			std::istream in(&buffer);
+			handler(response, in);
+		}
+		else
+		{
+			response.data.set(data, size);
+		}
+		return response;
+	}
+#endif
+
+	std::unique_ptr<Transport> createTransport(TransportType type, const TransportContext& context)
+	{
+		if (type == TRANSPORT_GRPC)
+		{
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+			return std::unique_ptr<Transport>(new GrpcTransport(context));
+#else
+			ofLogError("CloudVision") << "TRANSPORT_GRPC needs OFX_GOOGLE_CLOUD_VISION_GRPC, using REST";
+#endif
+		}
+		return std::unique_ptr<Transport>(new RestTransport(context));
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "ofMain.h"
+#include "GoogleCloudVisionFeatures.h"
+#include "GoogleCloudVisionMetrics.h"
+#include "GoogleCloudVisionRequestBody.h"
+#include "GoogleCloudVisionRetry.h"
+#include "GoogleCloudVisionScheduler.h"
+#include "GoogleCloudVisionSessionPool.h"
+
+namespace google
+{
+	struct CloudVisionResponse;
+
+	enum TransportType
+	{
+		// images:annotate, base64 images in json over pooled HTTP/1.1 keep-alive connections
+		TRANSPORT_REST,
+		// ImageAnnotator/BatchAnnotateImages, raw image bytes in protobuf, every request
+		// multiplexed over one HTTP/2 channel; needs grpc++ and OFX_GOOGLE_CLOUD_VISION_GRPC
+		// defined for the addon, REST is used without
+		TRANSPORT_GRPC
+	};
+
+	struct GrpcSettings
+	{
+		// host:port of the service, or of a local fake server
+		string target = "vision.googleapis.com:443";
+		// plain text instead of TLS, only for local fake servers
+		bool insecure = false;
+	};
+
+	// what a transport gets from the CloudVision that owns it
+	struct TransportContext
+	{
+		string key;
+		// base url for REST, see CloudVisionSettings::endpoint
+		string endpoint;
+		CompressionSettings compression;
+		GrpcSettings grpc;
+		SessionPool* sessionPool = nullptr;
+		// told about 429s and successes, see RateController
+		RateController* rateController = nullptr;
+		// null unless CloudVisionSettings::metrics is enabled
+		Metrics* metrics = nullptr;
+	};
+
+	// one image of a batch: its encoded content, or the url the service downloads itself
+	struct AnnotateImage
+	{
+		ofBuffer content;
+		string uri;
+		// encodeFeatures() of what is requested for it
+		std::shared_ptr<const string> features;
+	};
+
+	// the wire between CloudVision and the service: builds the body for a batch, sends one
+	// attempt of it and reads the answer into the responses. Retries, hedging, deadlines
+	// and cancellation stay with CloudVision and work the same for every transport
+	class Transport
+	{
+	public:
+		// reads the answer from the stream instead of post() buffering it into response.data
+		typedef std::function<void(ofHttpResponse& response, std::istream& stream)> ResponseHandler;
+
+		Transport(const TransportContext& context) : mContext(context) {}
+		virtual ~Transport() {}
+
+		// "rest", "grpc"
+		virtual string getName() const = 0;
+		// bodies and answers are binary rather than json
+		virtual bool isBinary() const = 0;
+		// the features of one image in the form buildRequest() puts them in the body
+		virtual string encodeFeatures(const FeatureSet& features) const = 0;
+		// moves the images of a batch into one body
+		virtual RequestBody buildRequest(std::vector<AnnotateImage>& images) const = 0;
+		// sends one attempt; status is an HTTP status, gRPC codes are mapped to the closest
+		// one so retries treat both alike, -1 when nothing was received
+		virtual ofHttpResponse post(const RequestBody& body, bool* connectionReused, ResponseHandler handler,
+			AbortHandle* abort, uint64_t timeoutMillis) = 0;
+		// fills responses from an answer read by post(), setting status and error on each
+		virtual void parseResponse(std::istream& in, const ofHttpResponse& response,
+			const std::vector<CloudVisionResponse*>& responses, size_t expectedResults) const = 0;
+
+	protected:
+		void record(MetricPhase phase, uint64_t micros)
+		{
+			if (mContext.metrics)
+				mContext.metrics->record(phase, micros);
+		}
+		void count(MetricCounter counter, uint64_t value = 1)
+		{
+			if (mContext.metrics)
+				mContext.metrics->add(counter, value);
+		}
+
+		TransportContext mContext;
+	};
+
+	// images:annotate with the api key in the query, gzip both ways when CompressionSettings allow
+	class RestTransport : public Transport
+	{
+	public:
+		RestTransport(const TransportContext& context);
+
+		string getName() const override { return "rest"; }
+		bool isBinary() const override { return false; }
+		string encodeFeatures(const FeatureSet& features) const override { return features.toJson(); }
+		RequestBody buildRequest(std::vector<AnnotateImage>& images) const override;
+		ofHttpResponse post(const RequestBody& body, bool* connectionReused, ResponseHandler handler,
+			AbortHandle* abort, uint64_t timeoutMillis) override;
+		void parseResponse(std::istream& in, const ofHttpResponse& response,
+			const std::vector<CloudVisionResponse*>& responses, size_t expectedResults) const override;
+
+	private:
+		string mUrl;
+	};
+
+#ifdef OFX_GOOGLE_CLOUD_VISION_GRPC
+	// BatchAnnotateImages through grpc's generic stub with the hand written codec in
+	// GoogleCloudVisionProtobuf.h, so no generated code is needed; the api key goes in the
+	// x-goog-api-key metadata. All workers share one channel, grpc multiplexes their
+	// calls as HTTP/2 streams over a single connection
+	class GrpcTransport : public Transport
+	{
+	public:
+		GrpcTransport(const TransportContext& context);
+		~GrpcTransport();
+
+		string getName() const override { return "grpc"; }
+		bool isBinary() const override { return true; }
+		string encodeFeatures(const FeatureSet& features) const override { return features.toProtobuf(); }
+		RequestBody buildRequest(std::vector<AnnotateImage>& images) const override;
+		ofHttpResponse post(const RequestBody& body, bool* connectionReused, ResponseHandler handler,
+			AbortHandle* abort, uint64_t timeoutMillis) override;
+		void parseResponse(std::istream& in, const ofHttpResponse& response,
+			const std::vector<CloudVisionResponse*>& responses, size_t expectedResults) const override;
+
+	private:
+		struct Channel;
+		std::unique_ptr<Channel> mChannel;
+	};
+#endif
+
+	// TRANSPORT_GRPC falls back to REST, with an error, when the addon is built without grpc
+	std::unique_ptr<Transport> createTransport(TransportType type, const TransportContext& context);
+}
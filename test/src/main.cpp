@@ -0,0 +1,71 @@
+#include "ofMain.h"
+#include "GoogleCloudVision.h"
+#include "GoogleCloudVisionParser.h"
+
+// checks of the response parser that need no network or key:
+//   test
+// prints every failed check and exits non-zero if there was one
+
+namespace
+{
+	int failures = 0;
+
+	void check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			printf("[test] FAILED: %s\n", what);
+			failures++;
+		}
+	}
+
+	google::CloudVisionResponse parse(const string& json)
+	{
+		google::CloudVisionResponse response;
+		std::istringstream in(json);
+		google::parseAnnotateResponse(in, 200, "OK", { &response });
+		return response;
+	}
+
+	// a string member that is null, a number or an object must not keep the string read before it
+	void testNonStringValues()
+	{
+		auto labels = parse(R"({"responses":[{"labelAnnotations":[
+			{"mid":"/m/01","description":null,"score":0.9},
+			{"mid":7,"description":"dog","score":0.8},
+			{"description":"cat","mid":{"id":"/m/02"},"score":0.7}]}]})");
+		check(labels.status == google::REQUEST_OK, "labels parse");
+		check(labels.labelAnnotations.size() == 3, "three labels");
+		if (labels.labelAnnotations.size() == 3)
+		{
+			check(labels.labelAnnotations[0].mid == string("/m/01"), "mid before a null description");
+			check(labels.labelAnnotations[0].description.empty(), "null description is empty");
+			check(labels.labelAnnotations[1].mid.empty(), "numeric mid is empty");
+			check(labels.labelAnnotations[1].description == string("dog"), "description after a numeric mid");
+			check(labels.labelAnnotations[2].mid.empty(), "object mid is empty");
+		}
+
+		auto text = parse(R"({"responses":[{"textAnnotations":[{"locale":"en","description":42}]}]})");
+		check(text.textAnnotations.size() == 1 && text.textAnnotations[0].description.empty(), "numeric text description is empty");
+
+		auto faces = parse(R"({"responses":[{"faceAnnotations":[
+			{"joyLikelihood":"VERY_LIKELY","sorrowLikelihood":null,"angerLikelihood":3}]}]})");
+		check(faces.faceAnnotations.size() == 1, "one face");
+		if (faces.faceAnnotations.size() == 1)
+		{
+			check(faces.faceAnnotations[0].joy == google::LIKELIHOOD_VERY_LIKELY, "joy likelihood");
+			check(faces.faceAnnotations[0].sorrow == google::LIKELIHOOD_UNKNOWN, "null likelihood is unknown");
+			check(faces.faceAnnotations[0].anger == google::LIKELIHOOD_UNKNOWN, "numeric likelihood is unknown");
+		}
+	}
+}
+
+int main()
+{
+	testNonStringValues();
+	if (failures)
+		printf("[test] %d checks failed\n", failures);
+	else
+		printf("[test] all checks passed\n");
+	return failures ? 1 : 0;
+}